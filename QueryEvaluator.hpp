@@ -11,9 +11,9 @@
 #include <vector>
 
 #include "../../Containers/Stack.h"
+#include "poolAllocator.hpp"
 
 using namespace std;
-using nlohmann::json;
 
 class QueryEvaluator {
 public:
@@ -109,6 +109,8 @@ private:
                     return false;
                 }
             }
+
+            return true;
         } 
         else 
         {
@@ -129,6 +131,8 @@ private:
         return false;
     }
 
+public:
+    // Both LIKE matchers are public so that the benchmark can compare them.
     bool wildcardMatchSec(const string& text, const string& pattern)
     {
         if (pattern.empty()) {
@@ -0,0 +1,526 @@
+#ifndef AGGREGATION_HPP
+#define AGGREGATION_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "compiledQuery.hpp"
+#include "findOptions.hpp"
+#include "jsonUtils.hpp"
+#include "threadPool.hpp"
+#include "deadline.hpp"
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+enum stageType
+{
+    STAGE_MATCH,
+    STAGE_GROUP,
+    STAGE_COUNT,
+    STAGE_SORT,
+    STAGE_LIMIT,
+    STAGE_PROJECT
+};
+
+enum accumulatorOperator
+{
+    ACC_SUM,
+    ACC_AVG,
+    ACC_MIN,
+    ACC_MAX
+};
+
+// "$field" or "$a.b" reads a document field, anything else is a constant. Missing fields read as null.
+inline json evaluateExpression(const json& doc, const json& expression)
+{
+    if (expression.is_object())
+    {
+        json result = json::object();
+        for (auto it = expression.begin(); it != expression.end(); ++it)
+        {
+            result[it.key()] = evaluateExpression(doc, it.value());
+        }
+        return result;
+    }
+
+    if (!expression.is_string() || expression.get_ref<const string&>().empty() || expression.get_ref<const string&>()[0] != '$')
+    {
+        return expression;
+    }
+
+    const string& path = expression.get_ref<const string&>();
+    const json* current = &doc;
+    size_t begin = 1;
+    while (begin <= path.size())
+    {
+        size_t end = path.find('.', begin);
+        if (end == string::npos)
+        {
+            end = path.size();
+        }
+        if (!current->is_object())
+        {
+            return json();
+        }
+        auto it = current->find(path.substr(begin, end - begin));
+        if (it == current->end())
+        {
+            return json();
+        }
+        current = &*it;
+        begin = end + 1;
+    }
+    return *current;
+}
+
+struct AccumulatorState
+{
+    int64_t integerSum = 0;
+    double floatSum = 0;
+    bool hasFloat = false;
+    size_t count = 0;
+    json extreme;
+
+    void add(accumulatorOperator op, const json& value)
+    {
+        if (op == ACC_MIN || op == ACC_MAX)
+        {
+            if (value.is_null())
+            {
+                return;
+            }
+            int order = count == 0 ? 0 : compareJson(value, extreme);
+            if (count == 0 || (op == ACC_MIN ? order < 0 : order > 0))
+            {
+                extreme = value;
+            }
+            count++;
+            return;
+        }
+
+        if (value.is_number_float())
+        {
+            floatSum += value.get<double>();
+            hasFloat = true;
+        }
+        else if (value.is_number())
+        {
+            integerSum += value.get<int64_t>();
+        }
+        else
+        {
+            return;
+        }
+        count++;
+    }
+
+    void merge(accumulatorOperator op, const AccumulatorState& other)
+    {
+        if (other.count == 0)
+        {
+            return;
+        }
+        if (op == ACC_MIN || op == ACC_MAX)
+        {
+            add(op, other.extreme);
+            count += other.count - 1;
+            return;
+        }
+        integerSum += other.integerSum;
+        floatSum += other.floatSum;
+        hasFloat = hasFloat || other.hasFloat;
+        count += other.count;
+    }
+
+    json result(accumulatorOperator op) const
+    {
+        switch (op)
+        {
+            case ACC_SUM:
+                return hasFloat ? json(floatSum + static_cast<double>(integerSum)) : json(integerSum);
+            case ACC_AVG:
+                return count == 0 ? json() : json((floatSum + static_cast<double>(integerSum)) / static_cast<double>(count));
+            default:
+                return count == 0 ? json() : extreme;
+        }
+    }
+};
+
+struct GroupAccumulator
+{
+    string field;
+    accumulatorOperator op;
+    json expression;
+};
+
+// {"$group": {"_id": <expression>, "<field>": {"$sum"|"$avg"|"$min"|"$max": <expression>}, ...}}
+// with hash aggregation. Partial tables are built independently and merged.
+class GroupStage
+{
+public:
+    struct Group
+    {
+        json key;
+        vector<AccumulatorState> states;
+    };
+    using Partial = unordered_map<string, Group>;
+
+private:
+    json idExpression;
+    vector<GroupAccumulator> accumulators;
+
+    static accumulatorOperator parseAccumulator(const string& field, const string& name)
+    {
+        if (name == "$sum")
+        {
+            return ACC_SUM;
+        }
+        if (name == "$avg")
+        {
+            return ACC_AVG;
+        }
+        if (name == "$min")
+        {
+            return ACC_MIN;
+        }
+        if (name == "$max")
+        {
+            return ACC_MAX;
+        }
+        throw invalid_argument("unknown accumulator '" + name + "' for field '" + field + "'");
+    }
+
+public:
+    explicit GroupStage(const json& spec)
+    {
+        if (!spec.is_object() || !spec.contains("_id"))
+        {
+            throw invalid_argument("$group requires an object with an _id expression");
+        }
+
+        idExpression = spec["_id"];
+        for (auto it = spec.begin(); it != spec.end(); ++it)
+        {
+            if (it.key() == "_id")
+            {
+                continue;
+            }
+            if (!it.value().is_object() || it.value().size() != 1)
+            {
+                throw invalid_argument("$group field '" + it.key() + "' must be a single accumulator");
+            }
+            auto accumulator = it.value().begin();
+            accumulators.push_back(GroupAccumulator{it.key(), parseAccumulator(it.key(), accumulator.key()), accumulator.value()});
+        }
+    }
+
+    void add(Partial& partial, const json& doc) const
+    {
+        json key = evaluateExpression(doc, idExpression);
+        Group& group = partial[jsonValueKey(key)];
+        if (group.states.empty())
+        {
+            group.key = move(key);
+            group.states.resize(accumulators.size());
+        }
+
+        for (size_t i = 0; i < accumulators.size(); i++)
+        {
+            group.states[i].add(accumulators[i].op, evaluateExpression(doc, accumulators[i].expression));
+        }
+    }
+
+    void merge(Partial& into, Partial& from) const
+    {
+        for (auto& entry : from)
+        {
+            auto it = into.find(entry.first);
+            if (it == into.end())
+            {
+                into.emplace(entry.first, move(entry.second));
+                continue;
+            }
+            for (size_t i = 0; i < accumulators.size(); i++)
+            {
+                it->second.states[i].merge(accumulators[i].op, entry.second.states[i]);
+            }
+        }
+    }
+
+    void finish(const Partial& partial, deque<json>& output) const
+    {
+        for (const auto& entry : partial)
+        {
+            json row = {{"_id", entry.second.key}};
+            for (size_t i = 0; i < accumulators.size(); i++)
+            {
+                row[accumulators[i].field] = entry.second.states[i].result(accumulators[i].op);
+            }
+            output.push_back(move(row));
+        }
+    }
+};
+
+struct PipelineStage
+{
+    stageType type;
+    shared_ptr<CompiledQuery> match;
+    shared_ptr<GroupStage> group;
+    FindOptions shape;
+    string countField;
+};
+
+struct AggregationSettings
+{
+    size_t threads = 1;
+    size_t chunkSize = 16 * 1024;
+    size_t parallelThreshold = 64 * 1024;
+    Deadline deadline;
+};
+
+// Parsed pipeline of $match, $group, $count, $sort, $limit and $project stages. Its leading $match,
+// $sort and $limit run as a find, so they use indexes and stop early; the remaining stages run over
+// the matched documents in memory without copying them until a stage produces new rows.
+class AggregationPipeline
+{
+private:
+    vector<PipelineStage> stages;
+    CompiledQuery prefixQuery;
+    FindOptions prefixOptions;
+    size_t prefixLength;
+
+    static PipelineStage parseStage(const json& stage)
+    {
+        if (!stage.is_object() || stage.size() != 1)
+        {
+            throw invalid_argument("every pipeline stage must be an object with exactly one operator");
+        }
+
+        const string& name = stage.begin().key();
+        const json& spec = stage.begin().value();
+        PipelineStage parsed;
+
+        if (name == "$match")
+        {
+            parsed.type = STAGE_MATCH;
+            parsed.match = make_shared<CompiledQuery>(spec);
+        }
+        else if (name == "$group")
+        {
+            parsed.type = STAGE_GROUP;
+            parsed.group = make_shared<GroupStage>(spec);
+        }
+        else if (name == "$count")
+        {
+            if (!spec.is_string() || spec.get_ref<const string&>().empty())
+            {
+                throw invalid_argument("$count requires a non-empty field name");
+            }
+            parsed.type = STAGE_COUNT;
+            parsed.countField = spec.get<string>();
+        }
+        else if (name == "$sort")
+        {
+            parsed.type = STAGE_SORT;
+            parsed.shape = parseFindOptions({{"sort", spec}});
+        }
+        else if (name == "$limit")
+        {
+            parsed.type = STAGE_LIMIT;
+            parsed.shape = parseFindOptions({{"limit", spec}});
+        }
+        else if (name == "$project")
+        {
+            parsed.type = STAGE_PROJECT;
+            parsed.shape = parseFindOptions({{"projection", spec}});
+        }
+        else
+        {
+            throw invalid_argument("unknown pipeline stage '" + name + "'");
+        }
+        return parsed;
+    }
+
+    static void groupRows(const GroupStage& group, vector<const json*>& rows, deque<json>& storage, const AggregationSettings& settings)
+    {
+        GroupStage::Partial merged;
+
+        if (rows.size() < settings.parallelThreshold || settings.threads <= 1)
+        {
+            for (size_t i = 0; i < rows.size(); i++)
+            {
+                settings.deadline.poll(i);
+                group.add(merged, *rows[i]);
+            }
+        }
+        else
+        {
+            // One partial table per participating thread, merged once the scan is done.
+            mutex slotsMutex;
+            map<thread::id, size_t> slots;
+            vector<unique_ptr<GroupStage::Partial>> partials;
+
+            parallelFor(rows.size(), settings.chunkSize, settings.threads, [&](size_t begin, size_t end, size_t)
+            {
+                GroupStage::Partial* partial;
+                {
+                    lock_guard<mutex> lock(slotsMutex);
+                    auto slot = slots.find(this_thread::get_id());
+                    if (slot == slots.end())
+                    {
+                        slot = slots.emplace(this_thread::get_id(), partials.size()).first;
+                        partials.push_back(make_unique<GroupStage::Partial>());
+                    }
+                    partial = partials[slot->second].get();
+                }
+
+                for (size_t i = begin; i < end; i++)
+                {
+                    settings.deadline.poll(i - begin);
+                    group.add(*partial, *rows[i]);
+                }
+            });
+
+            for (unique_ptr<GroupStage::Partial>& partial : partials)
+            {
+                group.merge(merged, *partial);
+            }
+        }
+
+        size_t first = storage.size();
+        group.finish(merged, storage);
+        rows.clear();
+        for (size_t i = first; i < storage.size(); i++)
+        {
+            rows.push_back(&storage[i]);
+        }
+    }
+
+public:
+    explicit AggregationPipeline(const json& pipeline)
+        : prefixQuery(json::object()), prefixLength(0)
+    {
+        if (!pipeline.is_array())
+        {
+            throw invalid_argument("pipeline must be an array of stages");
+        }
+        for (const auto& stage : pipeline)
+        {
+            stages.push_back(parseStage(stage));
+        }
+
+        if (prefixLength < stages.size() && stages[prefixLength].type == STAGE_MATCH)
+        {
+            prefixQuery = *stages[prefixLength].match;
+            prefixLength++;
+        }
+        if (prefixLength < stages.size() && stages[prefixLength].type == STAGE_SORT)
+        {
+            prefixOptions.sort = stages[prefixLength].shape.sort;
+            prefixLength++;
+        }
+        if (prefixLength < stages.size() && stages[prefixLength].type == STAGE_LIMIT)
+        {
+            prefixOptions.limit = stages[prefixLength].shape.limit;
+            prefixLength++;
+        }
+    }
+
+    // The query and options that select the input of the remaining stages.
+    const CompiledQuery& getQuery() const
+    {
+        return prefixQuery;
+    }
+
+    const FindOptions& getFindOptions() const
+    {
+        return prefixOptions;
+    }
+
+    // Runs the stages after the find prefix over rows, which must stay valid during the call.
+    vector<json> run(vector<const json*> rows, const AggregationSettings& settings) const
+    {
+        deque<json> storage;
+
+        for (size_t s = prefixLength; s < stages.size(); s++)
+        {
+            settings.deadline.check();
+            const PipelineStage& stage = stages[s];
+            switch (stage.type)
+            {
+                case STAGE_MATCH:
+                {
+                    vector<const json*> kept;
+                    for (size_t i = 0; i < rows.size(); i++)
+                    {
+                        settings.deadline.poll(i);
+                        if (stage.match->matches(*rows[i]))
+                        {
+                            kept.push_back(rows[i]);
+                        }
+                    }
+                    rows.swap(kept);
+                    break;
+                }
+                case STAGE_GROUP:
+                    groupRows(*stage.group, rows, storage, settings);
+                    break;
+                case STAGE_COUNT:
+                {
+                    storage.push_back(json{{stage.countField, rows.size()}});
+                    rows.assign(1, &storage.back());
+                    break;
+                }
+                case STAGE_SORT:
+                {
+                    size_t keep = rows.size();
+                    if (s + 1 < stages.size() && stages[s + 1].type == STAGE_LIMIT && stages[s + 1].shape.limit > 0)
+                    {
+                        keep = stages[s + 1].shape.limit;
+                    }
+                    keepFirstSorted(rows, keep, [&](const json* a, const json* b)
+                    {
+                        return compareDocuments(*a, *b, stage.shape.sort) < 0;
+                    });
+                    break;
+                }
+                case STAGE_LIMIT:
+                    if (stage.shape.limit > 0 && rows.size() > stage.shape.limit)
+                    {
+                        rows.resize(stage.shape.limit);
+                    }
+                    break;
+                case STAGE_PROJECT:
+                {
+                    for (const json*& row : rows)
+                    {
+                        storage.push_back(applyProjection(*row, stage.shape));
+                        row = &storage.back();
+                    }
+                    break;
+                }
+            }
+        }
+
+        vector<json> output;
+        output.reserve(rows.size());
+        for (const json* row : rows)
+        {
+            output.push_back(*row);
+        }
+        return output;
+    }
+};
+
+#endif
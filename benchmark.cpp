@@ -0,0 +1,383 @@
+#include <nlohmann/json.hpp>
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+
+#include "database.hpp"
+#include "benchmarkReport.hpp"
+
+using namespace std;
+
+#define DEFAULT_REPORT_PATH "benchmark_results.json"
+#define DEFAULT_MICRO_ITERATIONS 200000
+#define MACRO_LOOKUPS 1000
+
+// Results of measured calls are added here so the compiler cannot drop the calls.
+volatile size_t benchmarkSink = 0;
+
+// Silences the per-operation messages Database prints while the benchmark runs.
+class QuietOutput
+{
+private:
+    streambuf* original;
+
+public:
+    QuietOutput() : original(cout.rdbuf(nullptr))
+    {
+    }
+
+    ~QuietOutput()
+    {
+        cout.rdbuf(original);
+    }
+};
+
+void printUsage()
+{
+    cout << "Usage: ./benchmark [scan|micro|macro|all] [arguments] [--output <file>]" << endl;
+    cout << "  scan [documents] [max_threads]  parallel scan speedup by thread count" << endl;
+    cout << "  micro [iterations]              QueryEvaluator operators, LIKE matchers, Document construction" << endl;
+    cout << "  macro [max_documents]           insert, find and remove latency from 1k documents up to the maximum" << endl;
+    cout << "  --output <file>                 JSON results, " << DEFAULT_REPORT_PATH << " by default" << endl;
+    cout << "Example: ./benchmark 1000000 32" << endl;
+    cout << "Example: ./benchmark macro 100000 --output release.json" << endl;
+}
+
+string itemJson(size_t i, mt19937& random)
+{
+    json doc = {
+        {"_id", "item_" + to_string(i)},
+        {"price", random() % 1000},
+        {"status", i % 5 == 0 ? "archived" : "active"},
+        {"email", "user" + to_string(i) + (i % 3 == 0 ? "@corp.org" : "@gmail.com")}
+    };
+    return doc.dump();
+}
+
+DatabaseOptions benchmarkOptions()
+{
+    DatabaseOptions options;
+    options.flush = FLUSH_MANUAL;
+    options.walSync = WAL_SYNC_NONE;
+    return options;
+}
+
+void generateCollection(const string& dbName, size_t documentCount)
+{
+    filesystem::remove_all("databases/" + dbName);
+
+    Database db(dbName, benchmarkOptions());
+    mt19937 random(42);
+    QuietOutput quiet;
+
+    for (size_t i = 0; i < documentCount; i++)
+    {
+        db.insert("items", itemJson(i, random));
+    }
+}
+
+double measureFind(Database& db, const string& query, size_t repetitions, size_t& found)
+{
+    vector<double> timings;
+    for (size_t i = 0; i < repetitions; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        found = db.find("items", query).size();
+        auto end = chrono::steady_clock::now();
+        timings.push_back(chrono::duration<double, milli>(end - start).count());
+    }
+
+    sort(timings.begin(), timings.end());
+    return timings[timings.size() / 2];
+}
+
+void runScan(const vector<string>& arguments, BenchmarkReport& report)
+{
+    size_t documentCount = arguments.size() > 0 ? stoul(arguments[0]) : 1000000;
+    size_t maxThreads = arguments.size() > 1 ? stoul(arguments[1]) : max(thread::hardware_concurrency(), 1u);
+    string dbName = "bench_scan";
+
+    cout << "Generating " << documentCount << " documents..." << endl;
+    generateCollection(dbName, documentCount);
+
+    const string queries[] = {
+        "{\"price\": {\"$gt\": 990}}",
+        "{\"email\": {\"$like\": \"user12%7@corp.org\"}}"
+    };
+
+    for (const string& query : queries)
+    {
+        cout << endl << "Query: " << query << endl;
+        cout << "threads\tmedian_ms\tspeedup\tmatches" << endl;
+
+        double baseline = 0;
+        for (size_t step = 1; ; step *= 2)
+        {
+            size_t threads = min(step, maxThreads);
+            DatabaseOptions options;
+            options.scanThreads = threads;
+            options.parallelScanThreshold = 0;
+            Database db(dbName, options);
+
+            size_t found = 0;
+            measureFind(db, query, 1, found);
+            double median = measureFind(db, query, 5, found);
+            if (threads == 1)
+            {
+                baseline = median;
+            }
+
+            cout << threads << "\t" << median << "\t\t" << baseline / median << "\t" << found << endl;
+            report.add({{"suite", "scan"}, {"query", query}, {"documents", documentCount}, {"threads", threads},
+                        {"medianMs", median}, {"speedup", baseline / median}, {"matches", found}});
+
+            if (threads == maxThreads)
+            {
+                break;
+            }
+        }
+    }
+
+    filesystem::remove_all("databases/" + dbName);
+}
+
+// Nanoseconds per call, the median of five rounds of iterations calls each.
+template <typename Operation>
+double measureNanos(size_t iterations, Operation operation)
+{
+    vector<double> rounds;
+    for (int round = 0; round < 5; round++)
+    {
+        size_t sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            sink += operation();
+        }
+        auto end = chrono::steady_clock::now();
+        benchmarkSink = benchmarkSink + sink;
+        rounds.push_back(chrono::duration<double, nano>(end - start).count() / iterations);
+    }
+
+    sort(rounds.begin(), rounds.end());
+    return rounds[rounds.size() / 2];
+}
+
+void runMicro(const vector<string>& arguments, BenchmarkReport& report)
+{
+    size_t iterations = arguments.size() > 0 ? stoul(arguments[0]) : DEFAULT_MICRO_ITERATIONS;
+    QueryEvaluator evaluator;
+    json doc = json::parse("{\"_id\": \"a1\", \"name\": \"Alice Smith\", \"age\": 31, \"city\": \"London\", "
+                           "\"email\": \"alice.smith@corp.org\", \"tags\": [\"a\", \"b\", \"c\"]}");
+
+    const pair<string, string> operators[] = {
+        {"equal", "{\"city\": \"London\"}"},
+        {"$eq", "{\"city\": {\"$eq\": \"London\"}}"},
+        {"$gt", "{\"age\": {\"$gt\": 30}}"},
+        {"$lt", "{\"age\": {\"$lt\": 30}}"},
+        {"$in", "{\"city\": {\"$in\": [\"Paris\", \"Berlin\", \"London\"]}}"},
+        {"$like", "{\"email\": {\"$like\": \"%smith@corp%\"}}"},
+        {"$or", "{\"$or\": [{\"age\": {\"$lt\": 18}}, {\"city\": \"London\"}]}"},
+        {"range and equal", "{\"age\": {\"$gt\": 18, \"$lt\": 65}, \"city\": \"London\"}"},
+        {"missing field", "{\"country\": \"UK\"}"}
+    };
+
+    cout << endl << "QueryEvaluator::evaluate" << endl;
+    cout << "operator\tns/op" << endl;
+    for (const auto& entry : operators)
+    {
+        json query = json::parse(entry.second);
+        double nanos = measureNanos(iterations, [&]() { return evaluator.evaluate(doc, query); });
+        cout << entry.first << "\t" << nanos << endl;
+        report.add({{"suite", "micro"}, {"name", "evaluate " + entry.first}, {"query", entry.second}, {"nsPerOp", nanos}});
+    }
+
+    const string text = "alice.smith@corp.org";
+    const string patterns[] = {"alice%", "%corp.org", "%smith%corp%", "a_ice.%", "%x%", "alice.smith@corp.org"};
+
+    cout << endl << "LIKE matchers on \"" << text << "\"" << endl;
+    cout << "pattern\twildcardMatchSec ns\twildcardMatch ns" << endl;
+    for (const string& pattern : patterns)
+    {
+        double secNanos = measureNanos(iterations, [&]() { return evaluator.wildcardMatchSec(text, pattern); });
+        double plainNanos = measureNanos(iterations, [&]() { return evaluator.wildcardMatch(text, pattern); });
+        bool agree = evaluator.wildcardMatchSec(text, pattern) == evaluator.wildcardMatch(text, pattern);
+        cout << pattern << "\t" << secNanos << "\t\t" << plainNanos << (agree ? "" : "\t(results differ)") << endl;
+        report.add({{"suite", "micro"}, {"name", "like"}, {"pattern", pattern}, {"wildcardMatchSecNs", secNanos},
+                    {"wildcardMatchNs", plainNanos}, {"agree", agree}});
+    }
+
+    const string docText = doc.dump();
+    json withoutId = doc;
+    withoutId.erase("_id");
+    const pair<string, function<size_t()>> constructions[] = {
+        {"Document()", [&]() { return Document().getId().size(); }},
+        {"Document(const json&)", [&]() { return Document(doc).getId().size(); }},
+        {"Document(const json&) with generated id", [&]() { return Document(withoutId).getId().size(); }},
+        {"Document(json::parse(text))", [&]() { return Document(json::parse(docText)).getId().size(); }}
+    };
+
+    cout << endl << "Document construction" << endl;
+    cout << "constructor\tns/op" << endl;
+    for (const auto& entry : constructions)
+    {
+        double nanos = measureNanos(iterations, entry.second);
+        cout << entry.first << "\t" << nanos << endl;
+        report.add({{"suite", "micro"}, {"name", entry.first}, {"nsPerOp", nanos}});
+    }
+}
+
+// Times every call of operation(i) for i below count; returns the calls per second.
+template <typename Operation>
+double measureCalls(size_t count, Operation operation, LatencySummary& summary)
+{
+    vector<double> samples;
+    samples.reserve(count);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+    {
+        auto callStart = chrono::steady_clock::now();
+        operation(i);
+        samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - callStart).count());
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    summary = summarizeLatencies(samples);
+    return seconds > 0 ? count / seconds : 0;
+}
+
+void printMacro(BenchmarkReport& report, const string& operation, size_t documentCount, double opsPerSec, const LatencySummary& summary)
+{
+    cout << operation << "\t" << documentCount << "\t" << static_cast<size_t>(opsPerSec) << "\t" << summary.p50 << "\t"
+         << summary.p99 << "\t" << summary.p999 << endl;
+
+    json result = {{"suite", "macro"}, {"operation", operation}, {"documents", documentCount}, {"opsPerSec", opsPerSec}};
+    result.update(latencyJson(summary));
+    report.add(result);
+}
+
+void runMacro(const vector<string>& arguments, BenchmarkReport& report)
+{
+    size_t maxDocuments = arguments.size() > 0 ? stoul(arguments[0]) : 1000000;
+    string dbName = "bench_macro";
+
+    cout << endl << "operation\tdocuments\tops/sec\tp50_us\tp99_us\tp999_us" << endl;
+    for (size_t documentCount = 1000; documentCount <= maxDocuments; documentCount *= 10)
+    {
+        filesystem::remove_all("databases/" + dbName);
+        Database db(dbName, benchmarkOptions());
+        mt19937 random(42);
+
+        vector<string> texts;
+        for (size_t i = 0; i < documentCount; i++)
+        {
+            texts.push_back(itemJson(i, random));
+        }
+
+        // Lookups and removals hit random distinct documents.
+        vector<size_t> picks(documentCount);
+        for (size_t i = 0; i < documentCount; i++)
+        {
+            picks[i] = i;
+        }
+        shuffle(picks.begin(), picks.end(), random);
+        size_t lookups = min<size_t>(MACRO_LOOKUPS, documentCount);
+        size_t scans = max<size_t>(5, min<size_t>(100, 1000000 / documentCount));
+
+        LatencySummary summary;
+        double opsPerSec = 0;
+        {
+            QuietOutput quiet;
+            opsPerSec = measureCalls(documentCount, [&](size_t i) { db.insert("items", texts[i]); }, summary);
+        }
+        printMacro(report, "insert", documentCount, opsPerSec, summary);
+
+        {
+            QuietOutput quiet;
+            opsPerSec = measureCalls(lookups, [&](size_t i)
+            {
+                benchmarkSink = benchmarkSink + db.find("items", "{\"_id\": \"item_" + to_string(picks[i]) + "\"}").size();
+            }, summary);
+        }
+        printMacro(report, "find by _id", documentCount, opsPerSec, summary);
+
+        {
+            QuietOutput quiet;
+            opsPerSec = measureCalls(scans, [&](size_t)
+            {
+                benchmarkSink = benchmarkSink + db.find("items", "{\"price\": {\"$gt\": 990}}").size();
+            }, summary);
+        }
+        printMacro(report, "find scan", documentCount, opsPerSec, summary);
+
+        {
+            QuietOutput quiet;
+            opsPerSec = measureCalls(lookups, [&](size_t i)
+            {
+                db.remove("items", "{\"_id\": \"item_" + to_string(picks[i]) + "\"}");
+            }, summary);
+        }
+        printMacro(report, "remove by _id", documentCount, opsPerSec, summary);
+    }
+
+    filesystem::remove_all("databases/" + dbName);
+}
+
+int main(int argc, char* argv[])
+{
+    string suite = "scan";
+    string outputPath = DEFAULT_REPORT_PATH;
+    vector<string> arguments;
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        if (argument == "--help")
+        {
+            printUsage();
+            return 0;
+        }
+        else if (argument == "--output" && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else if (i == 1 && (argument == "scan" || argument == "micro" || argument == "macro" || argument == "all"))
+        {
+            suite = argument;
+        }
+        else
+        {
+            arguments.push_back(argument);
+        }
+    }
+
+    BenchmarkReport report("benchmark");
+    try
+    {
+        if (suite == "micro" || suite == "all")
+        {
+            runMicro(suite == "all" ? vector<string>() : arguments, report);
+        }
+        if (suite == "macro" || suite == "all")
+        {
+            runMacro(suite == "all" ? vector<string>() : arguments, report);
+        }
+        if (suite == "scan" || suite == "all")
+        {
+            runScan(suite == "all" ? vector<string>() : arguments, report);
+        }
+
+        report.write(outputPath);
+    }
+    catch (const exception& e)
+    {
+        cerr << "Benchmark failed: " << e.what() << endl;
+        return 1;
+    }
+
+    cout << endl << "Results written to " << outputPath << endl;
+    return 0;
+}
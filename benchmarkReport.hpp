@@ -0,0 +1,105 @@
+#ifndef BENCHMARK_REPORT_HPP
+#define BENCHMARK_REPORT_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+#include <stdexcept>
+
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+// Latency distribution of one measured operation, in microseconds.
+struct LatencySummary
+{
+    size_t count = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double p999 = 0;
+    double max = 0;
+};
+
+// Nearest-rank percentile of sorted samples.
+inline double percentile(const vector<double>& sorted, double fraction)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(fraction * sorted.size());
+    return sorted[min(rank, sorted.size() - 1)];
+}
+
+// Sorts the samples in place.
+inline LatencySummary summarizeLatencies(vector<double>& samples)
+{
+    LatencySummary summary;
+    if (samples.empty())
+    {
+        return summary;
+    }
+
+    sort(samples.begin(), samples.end());
+    double total = 0;
+    for (double sample : samples)
+    {
+        total += sample;
+    }
+    summary.count = samples.size();
+    summary.mean = total / samples.size();
+    summary.p50 = percentile(samples, 0.50);
+    summary.p99 = percentile(samples, 0.99);
+    summary.p999 = percentile(samples, 0.999);
+    summary.max = samples.back();
+    return summary;
+}
+
+inline json latencyJson(const LatencySummary& summary)
+{
+    return {{"count", summary.count}, {"meanUs", summary.mean}, {"p50Us", summary.p50}, {"p99Us", summary.p99},
+            {"p999Us", summary.p999}, {"maxUs", summary.max}};
+}
+
+// Machine-readable results: {"tool", "timestamp", "results": [...]}, one entry per measurement, so runs
+// of different releases can be diffed.
+class BenchmarkReport
+{
+private:
+    string tool;
+    json results = json::array();
+
+public:
+    explicit BenchmarkReport(const string& toolName) : tool(toolName)
+    {
+    }
+
+    void add(const json& result)
+    {
+        results.push_back(result);
+    }
+
+    void write(const string& path) const
+    {
+        json report = {
+            {"tool", tool},
+            {"timestamp", static_cast<int64_t>(time(nullptr))},
+            {"results", results}
+        };
+
+        ofstream out(path, ios::trunc);
+        if (!out)
+        {
+            throw runtime_error("Cannot write benchmark report to " + path);
+        }
+        out << report.dump(2) << endl;
+    }
+};
+
+#endif
@@ -6,51 +6,67 @@
 #include <sstream>
 #include <thread>
 #include <chrono>
+#include <vector>
 #include "../database.hpp"
+#include "../protocol.hpp"
 
 using namespace std;
 
 #define RESPONSE_TIMEOUT_SEC 10
 
+#define RECEIVE_BUFFER_BYTES 65536
+
+// Bytes past the current response stay in the decoder for the next call.
+FrameDecoder responseDecoder;
+
 string receive(int clientSocket, int timeoutSec) 
 {
-    char buffer[1024];
-    memset(buffer, 0, sizeof(buffer));
-
     struct timeval timeout;
     timeout.tv_sec = timeoutSec;
     timeout.tv_usec = 0;
     setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    
-    int receivedBytes = recv(clientSocket, buffer, sizeof(buffer) - 1, 0);
-    
-    if (receivedBytes > 0) 
-    {
-        return string(buffer, receivedBytes);
-    }
-    else if (receivedBytes == 0) 
-    {
-        return "SERVER_DISCONNECTED";
-    }
-    else 
+
+    string line;
+    vector<char> buffer(RECEIVE_BUFFER_BYTES);
+    while (!responseDecoder.next(line))
     {
-        return "TIMEOUT_OR_ERROR";
+        ssize_t receivedBytes = recv(clientSocket, buffer.data(), buffer.size(), 0);
+        if (receivedBytes == 0) 
+        {
+            return "SERVER_DISCONNECTED";
+        }
+        else if (receivedBytes < 0) 
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return "TIMEOUT_OR_ERROR";
+        }
+        responseDecoder.feed(buffer.data(), static_cast<size_t>(receivedBytes));
     }
+    return line;
 }
 
 void printUsage()
 {
-    cout << "Usage: ./client --host <host> --port <port> --database <dbname>" << endl;
+    cout << "Usage: ./client --host <host> --port <port> --database <dbname> [--format text|cbor|msgpack] [--pipeline]" << endl;
     cout << "Example: ./client --host localhost --port 8080 --database myDatabase" << endl;
+    cout << "--format cbor|msgpack exchanges binary frames instead of JSON text" << endl;
+    cout << "--pipeline sends every command read from stdin without waiting, then reads the responses in order" << endl;
     cout << "Response timeout: " << RESPONSE_TIMEOUT_SEC << " seconds" << endl;
 }
 
-void parseArguments(int argc, char* argv[], string& host, int& port, string& databaseName)
+void parseArguments(int argc, char* argv[], string& host, int& port, string& databaseName, string& formatName, bool& pipeline)
 {
     for (int i = 1; i < argc; i++)
     {
         string arg = argv[i];
-        if (i + 1 < argc)
+        if (arg == "--pipeline")
+        {
+            pipeline = true;
+        }
+        else if (i + 1 < argc)
         {
             if (arg == "--host")
             {
@@ -64,8 +80,133 @@ void parseArguments(int argc, char* argv[], string& host, int& port, string& dat
             {
                 databaseName = argv[++i];
             }
+            else if (arg == "--format")
+            {
+                formatName = argv[++i];
+            }
+        }
+    }
+}
+
+void printResponse(const json& jsonResponse, chrono::seconds duration)
+{
+    cout << "\n[SERVER RESPONSE]" << endl;
+    cout << "Status: " << jsonResponse.value("status", "unknown") << endl;
+    cout << "Message: " << jsonResponse.value("message", "") << endl;
+    
+    if (jsonResponse.contains("data") && !jsonResponse["data"].empty()) 
+    {
+        cout << "Data (" << jsonResponse.value("count", 0) << " documents):" << endl;
+        cout << jsonResponse["data"].dump(2) << endl;
+    } 
+    else if (jsonResponse.contains("count")) 
+    {
+        cout << "Count: " << jsonResponse["count"] << endl;
+    }
+
+    if (jsonResponse.contains("stats")) 
+    {
+        cout << "Statistics:" << endl;
+        cout << jsonResponse["stats"].dump(2) << endl;
+    }
+
+    if (jsonResponse.contains("explain")) 
+    {
+        cout << "Explain:" << endl;
+        cout << jsonResponse["explain"].dump(2) << endl;
+    }
+
+    if (jsonResponse.contains("errors") && !jsonResponse["errors"].empty()) 
+    {
+        cout << "Errors:" << endl;
+        cout << jsonResponse["errors"].dump(2) << endl;
+    }
+
+    uint64_t cursorId = jsonResponse.value("cursor", uint64_t(0));
+    if (cursorId != 0) 
+    {
+        cout << "More results available: GETMORE " << cursorId << " [batch_size], or KILLCURSOR " << cursorId << endl;
+    }
+    
+    if (duration.count() >= RESPONSE_TIMEOUT_SEC) 
+    {
+        cout << "Warning: Response took " << duration.count() << " seconds (near timeout)" << endl;
+    }
+}
+
+void printResponse(const string& response, wireFormat format, chrono::seconds duration)
+{
+    try 
+    {
+        printResponse(decodeMessage(response, format), duration);
+    } 
+    catch (const json::exception&) 
+    {
+        cout << "\n[SERVER]: " << response << endl;
+    }
+}
+
+// Text commands are sent as typed; binary formats send the same command as an encoded request object.
+string encodeCommand(const string& commandWithArgs, wireFormat format)
+{
+    if (format == WIRE_TEXT)
+    {
+        return commandWithArgs + "\n";
+    }
+    return encodeMessage(parseTextCommand(commandWithArgs), format);
+}
+
+// Writes every command up front and then matches responses to commands by order, which the server
+// preserves per connection.
+int runPipeline(int clientSocket, wireFormat format)
+{
+    string batch;
+    size_t commands = 0;
+    string commandWithArgs;
+    while (getline(cin, commandWithArgs))
+    {
+        if (commandWithArgs.empty())
+        {
+            continue;
         }
+        if (commandWithArgs == "EXIT")
+        {
+            break;
+        }
+
+        try
+        {
+            batch += encodeCommand(commandWithArgs, format);
+            commands++;
+        }
+        catch (const exception& e)
+        {
+            cout << "Skipping invalid command '" << commandWithArgs << "': " << e.what() << endl;
+        }
+    }
+
+    auto startTime = chrono::steady_clock::now();
+    if (!sendAll(clientSocket, batch))
+    {
+        cout << "Error sending commands" << endl;
+        return -1;
     }
+
+    for (size_t i = 0; i < commands; i++)
+    {
+        string response = receive(clientSocket, RESPONSE_TIMEOUT_SEC);
+        auto duration = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - startTime);
+        if (response == "TIMEOUT_OR_ERROR" || response == "SERVER_DISCONNECTED")
+        {
+            cout << "\nError: " << response << " after " << i << " of " << commands << " responses" << endl;
+            return -1;
+        }
+        printResponse(response, format, duration);
+    }
+
+    auto total = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime);
+    cout << "\n" << commands << " commands completed in " << total.count() << " ms" << endl;
+    return 0;
 }
 
 int main(int argc, char* argv[])
@@ -73,10 +214,13 @@ int main(int argc, char* argv[])
     int port = 8080;
     string databaseName = "myDatabase";
     string host = "localhost";
+    string formatName = "text";
+    wireFormat format = WIRE_TEXT;
+    bool pipeline = false;
 
-    parseArguments(argc, argv, host, port, databaseName);
+    parseArguments(argc, argv, host, port, databaseName, formatName, pipeline);
     
-    if (host.empty() || port == 0 || databaseName.empty()) 
+    if (host.empty() || port == 0 || databaseName.empty() || !parseWireFormat(formatName, format)) 
     {
         printUsage();
         return -1;
@@ -115,7 +259,12 @@ int main(int argc, char* argv[])
 
         cout << "Connected to " << host << ":" << port << " successful" << endl;
 
-        send(clientSocket, databaseName.c_str(), databaseName.length(), 0);
+        if (!sendAll(clientSocket, databaseName + " " + wireFormatName(format) + "\n"))
+        {
+            cout << "Error sending database name" << endl;
+            close(clientSocket);
+            return -1;
+        }
 
         string welcomeMsg = receive(clientSocket, RESPONSE_TIMEOUT_SEC);
         
@@ -132,7 +281,12 @@ int main(int argc, char* argv[])
             return -1;
         }
         
-        cout << "Server: " << welcomeMsg;
+        cout << "Server: " << welcomeMsg << endl;
+
+        if (format != WIRE_TEXT)
+        {
+            responseDecoder.setFraming(FRAMING_LENGTH);
+        }
     }
     catch (const std::exception& e)
     {
@@ -141,6 +295,13 @@ int main(int argc, char* argv[])
         return -1;
     }
     
+    if (pipeline)
+    {
+        int result = runPipeline(clientSocket, format);
+        close(clientSocket);
+        return result;
+    }
+
     bool exit = false;
     cout << "Connected to database: " << databaseName << endl;
     cout << "Response timeout: " << RESPONSE_TIMEOUT_SEC << " seconds" << endl;
@@ -161,14 +322,27 @@ int main(int argc, char* argv[])
         if (commandWithArgs == "EXIT")
         {
             exit = true;
-            string exitMsg = "EXIT\n";
-            send(clientSocket, exitMsg.c_str(), exitMsg.length(), 0);
+            sendAll(clientSocket, encodeCommand("EXIT", format));
             break;
         }
 
-        string requestStr = commandWithArgs + "\n";
+        string request;
+        try
+        {
+            request = encodeCommand(commandWithArgs, format);
+        }
+        catch (const exception& e)
+        {
+            cout << "\nError: invalid command: " << e.what() << endl;
+            cout << "> " << flush;
+            continue;
+        }
 
-        send(clientSocket, requestStr.c_str(), requestStr.length(), 0);
+        if (!sendAll(clientSocket, request))
+        {
+            cout << "\nError sending command" << endl;
+            break;
+        }
         
         auto startTime = chrono::steady_clock::now();
         string response = receive(clientSocket, RESPONSE_TIMEOUT_SEC);
@@ -187,32 +361,7 @@ int main(int argc, char* argv[])
         }
         else 
         {
-            try 
-            {
-                json jsonResponse = json::parse(response);
-                cout << "\n[SERVER RESPONSE]" << endl;
-                cout << "Status: " << jsonResponse.value("status", "unknown") << endl;
-                cout << "Message: " << jsonResponse.value("message", "") << endl;
-                
-                if (jsonResponse.contains("data") && !jsonResponse["data"].empty()) 
-                {
-                    cout << "Data (" << jsonResponse.value("count", 0) << " documents):" << endl;
-                    cout << jsonResponse["data"].dump(2) << endl;
-                } 
-                else if (jsonResponse.contains("count")) 
-                {
-                    cout << "Count: " << jsonResponse["count"] << endl;
-                }
-                
-                if (duration.count() >= RESPONSE_TIMEOUT_SEC) 
-                {
-                    cout << "Warning: Response took " << duration.count() << " seconds (near timeout)" << endl;
-                }
-            } 
-            catch (const json::parse_error&) 
-            {
-                cout << "\n[SERVER]: " << response << endl;
-            }
+            printResponse(response, format, duration);
         }
         
         cout << "> " << flush;
@@ -0,0 +1,929 @@
+#ifndef COLLECTION_HPP
+#define COLLECTION_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <shared_mutex>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../../Containers/hashtable.hpp"
+#include "document.hpp"
+#include "wal.hpp"
+#include "index.hpp"
+#include "orderedIndex.hpp"
+#include "segment.hpp"
+#include "columnStore.hpp"
+#include "queryPlan.hpp"
+#include "../../Containers/Go/vector.h"
+#include "poolAllocator.hpp"
+
+class Collection
+{
+private:
+    string name;
+    string filePath;
+    string segmentPath;
+    string walPath;
+    string indexPath;
+    size_t groupCommitDelayMicros;
+    unique_ptr<WriteAheadLog> wal;
+    // Documents written since the segment, and their positions in it by storage key.
+    vector<DocumentPtr> resident;
+    ChainHashTable<string, size_t> documents;
+    unique_ptr<SegmentReader> segment;
+    unique_ptr<ChainHashTable<string, size_t>> segmentSlots;
+    vector<uint8_t> segmentLive;
+    myVector<shared_ptr<SecondaryIndex>> indexes;
+    ColumnStore columns;
+    mutable PlanCache planCache;
+    size_t documentCount;
+    atomic<size_t> memoryBytes;
+    size_t pendingWrites;
+    atomic<chrono::steady_clock::rep> lastAccess;
+    atomic<bool> loaded;
+    atomic<bool> evicted;
+    shared_mutex collectionMutex;
+
+    static size_t estimateSize(const Document& doc)
+    {
+        return doc.getId().size() + doc.getData().dump().size();
+    }
+
+    // Key of a document in the documents table. Generated ids are stored as their 12-byte binary form;
+    // other ids of that length get a 0xFF byte appended, which never occurs in UTF-8, so the two kinds of
+    // key cannot collide.
+    static string storageKey(const string& id)
+    {
+        DocumentId generated;
+        if (DocumentId::parse(id, generated))
+        {
+            return generated.toBinary();
+        }
+        if (id.size() == DOCUMENT_ID_BYTES)
+        {
+            return id + '\xFF';
+        }
+        return id;
+    }
+
+    static void syncPath(const string& path, int flags)
+    {
+        int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw runtime_error("Cannot open " + path + " for sync");
+        }
+        int result = ::fsync(fd);
+        ::close(fd);
+        if (result != 0)
+        {
+            throw runtime_error("Cannot sync " + path);
+        }
+    }
+
+    static void writeFileAtomically(const string& path, const string& contents)
+    {
+        string tempPath = path + ".tmp";
+        ofstream file(tempPath);
+        if (!file.is_open())
+        {
+            throw runtime_error("Cannot write file: " + path);
+        }
+        file << contents;
+        file.close();
+        if (file.fail())
+        {
+            throw runtime_error("Cannot write file: " + path);
+        }
+
+        syncPath(tempPath, O_RDONLY);
+        filesystem::rename(tempPath, path);
+        syncPath(filesystem::path(path).parent_path().string(), O_RDONLY | O_DIRECTORY);
+    }
+
+    void loadIndexDefinitions()
+    {
+        if (!filesystem::exists(indexPath))
+        {
+            return;
+        }
+
+        ifstream file(indexPath);
+        if (!file.is_open())
+        {
+            throw runtime_error("Cannot open index definitions: " + name);
+        }
+
+        json definitions;
+        file >> definitions;
+        file.close();
+
+        for (const auto& definition : definitions)
+        {
+            indexType type = INDEX_HASH;
+            parseIndexType(definition.value("type", "hash"), type);
+            if (type == INDEX_COLUMN)
+            {
+                columns.addColumn(definition["field"].get<string>());
+            }
+            else
+            {
+                indexes.push_back(makeIndex(definition["field"].get<string>(), type));
+            }
+        }
+    }
+
+    void saveIndexDefinitions()
+    {
+        json definitions = json::array();
+        for (size_t i = 0; i < indexes.size(); i++)
+        {
+            definitions.push_back({{"field", indexes[i]->getField()}, {"type", indexTypeName(indexes[i]->getType())}});
+        }
+        for (const string& field : columns.getFields())
+        {
+            definitions.push_back({{"field", field}, {"type", indexTypeName(INDEX_COLUMN)}});
+        }
+        writeFileAtomically(indexPath, definitions.dump(2));
+    }
+
+    static shared_ptr<SecondaryIndex> makeIndex(const string& field, indexType type)
+    {
+        if (type == INDEX_ORDERED)
+        {
+            return make_shared<OrderedIndex>(field);
+        }
+        return make_shared<HashIndex>(field);
+    }
+
+    static bool rangeBounds(const json& condition, RangeBound& lower, RangeBound& upper)
+    {
+        if (!condition.is_object())
+        {
+            return false;
+        }
+
+        auto gt = condition.find("$gt");
+        if (gt != condition.end())
+        {
+            lower.value = &*gt;
+        }
+        auto lt = condition.find("$lt");
+        if (lt != condition.end())
+        {
+            upper.value = &*lt;
+        }
+        return lower.value || upper.value;
+    }
+
+    static bool equalityValues(const json& condition, json& values)
+    {
+        if (!condition.is_object())
+        {
+            values = json::array({condition});
+            return true;
+        }
+        if (condition.contains("$eq"))
+        {
+            values = json::array({condition["$eq"]});
+            return true;
+        }
+        if (condition.contains("$in") && condition["$in"].is_array())
+        {
+            values = condition["$in"];
+            return true;
+        }
+        return false;
+    }
+
+    // Replacing a stored document only touches the indexes whose field value changed.
+    void reindex(const string& id, const json& before, const json& after)
+    {
+        columns.put(id, after);
+        for (size_t i = 0; i < indexes.size(); i++)
+        {
+            auto oldValue = before.find(indexes[i]->getField());
+            auto newValue = after.find(indexes[i]->getField());
+            bool hadValue = oldValue != before.end();
+            bool hasValue = newValue != after.end();
+            if (hadValue != hasValue || (hadValue && *oldValue != *newValue))
+            {
+                indexes[i]->remove(id, before);
+                indexes[i]->add(id, after);
+            }
+        }
+    }
+
+    // The indexed and columnar fields of a segment record, which is all the indexes and columns need to
+    // add or remove it.
+    json indexedFields(size_t record) const
+    {
+        vector<string> names = columns.getFields();
+        for (size_t i = 0; i < indexes.size(); i++)
+        {
+            names.push_back(indexes[i]->getField());
+        }
+
+        json fields = json::object();
+        segment->extractFields(record, names, fields);
+        return fields;
+    }
+
+    DocumentPtr materialize(size_t record) const
+    {
+        return make_shared<const Document>(segment->materialize(record), segment->id(record));
+    }
+
+    // Maps the segment file and registers its records. Only the ids and the indexed fields are read;
+    // documents stay encoded in the mapping.
+    void openSegment(bool addToIndexes)
+    {
+        segment = make_unique<SegmentReader>(segmentPath);
+        segmentSlots = make_unique<ChainHashTable<string, size_t>>();
+        segmentLive.assign(segment->size(), 1);
+
+        for (size_t i = 0; i < segment->size(); i++)
+        {
+            string id = segment->id(i);
+            segmentSlots->insert(storageKey(id), i);
+            if (addToIndexes && (indexes.size() > 0 || !columns.empty()))
+            {
+                json fields = indexedFields(i);
+                for (size_t j = 0; j < indexes.size(); j++)
+                {
+                    indexes[j]->add(id, fields);
+                }
+                columns.put(id, fields);
+            }
+        }
+        documentCount += segment->size();
+        memoryBytes += segment->bytes();
+    }
+
+    // Documents written since the segment live in the documents table and hide the segment record with
+    // the same id, which is marked dead.
+    void applyInsert(const DocumentPtr& doc)
+    {
+        string key = storageKey(doc->getId());
+        if (documents.contains(key))
+        {
+            DocumentPtr& previous = resident[documents.search(key)];
+            reindex(doc->getId(), previous->getData(), doc->getData());
+            memoryBytes -= min(memoryBytes.load(), estimateSize(*previous));
+            previous = doc;
+            memoryBytes += estimateSize(*doc);
+            return;
+        }
+
+        if (segmentSlots->contains(key))
+        {
+            size_t record = segmentSlots->search(key);
+            reindex(doc->getId(), indexedFields(record), doc->getData());
+            segmentLive[record] = 0;
+            segmentSlots->remove(key);
+        }
+        else
+        {
+            for (size_t i = 0; i < indexes.size(); i++)
+            {
+                indexes[i]->add(doc->getId(), doc->getData());
+            }
+            columns.put(doc->getId(), doc->getData());
+            documentCount++;
+        }
+
+        documents.insert(key, resident.size());
+        resident.push_back(doc);
+        memoryBytes += estimateSize(*doc);
+    }
+
+    // Moves the last resident document into the removed one's place.
+    void removeResident(const string& key)
+    {
+        size_t position = documents.search(key);
+        documents.remove(key);
+        if (position + 1 < resident.size())
+        {
+            resident[position] = move(resident.back());
+            string movedKey = storageKey(resident[position]->getId());
+            documents.remove(movedKey);
+            documents.insert(movedKey, position);
+        }
+        resident.pop_back();
+    }
+
+    bool applyRemove(const string& id)
+    {
+        string key = storageKey(id);
+        if (documents.contains(key))
+        {
+            DocumentPtr doc = resident[documents.search(key)];
+            for (size_t i = 0; i < indexes.size(); i++)
+            {
+                indexes[i]->remove(id, doc->getData());
+            }
+            removeResident(key);
+            memoryBytes -= min(memoryBytes.load(), estimateSize(*doc));
+        }
+        else if (segmentSlots->contains(key))
+        {
+            size_t record = segmentSlots->search(key);
+            json fields = indexedFields(record);
+            for (size_t i = 0; i < indexes.size(); i++)
+            {
+                indexes[i]->remove(id, fields);
+            }
+            segmentLive[record] = 0;
+            segmentSlots->remove(key);
+        }
+        else
+        {
+            return false;
+        }
+
+        columns.remove(id);
+        documentCount--;
+        return true;
+    }
+
+public:
+    Collection(const string& collectionName, const string& directory, size_t commitDelayMicros = 0)
+        : name(collectionName), filePath(directory + "/" + collectionName + ".json"),
+          segmentPath(directory + "/" + collectionName + ".seg"), walPath(directory + "/" + collectionName + ".wal"),
+          indexPath(directory + "/" + collectionName + ".indexes.json"), groupCommitDelayMicros(commitDelayMicros),
+          segmentSlots(make_unique<ChainHashTable<string, size_t>>()),
+          documentCount(0), memoryBytes(0), pendingWrites(0),
+          lastAccess(chrono::steady_clock::now().time_since_epoch().count()), loaded(false), evicted(false)
+    {
+    }
+
+    // Readers hold this shared and writers exclusively; Collection does not lock on its own.
+    shared_mutex& getMutex()
+    {
+        return collectionMutex;
+    }
+
+    bool isEvicted() const
+    {
+        return evicted;
+    }
+
+    void markEvicted()
+    {
+        evicted = true;
+    }
+
+    void ensureLoaded()
+    {
+        if (loaded.load(memory_order_acquire))
+        {
+            return;
+        }
+
+        unique_lock<shared_mutex> lock(collectionMutex);
+        if (!loaded.load(memory_order_relaxed))
+        {
+            try
+            {
+                load();
+            }
+            catch (...)
+            {
+                unload();
+                throw;
+            }
+            loaded.store(true, memory_order_release);
+        }
+    }
+
+    const string& getName() const
+    {
+        return name;
+    }
+
+    size_t size() const
+    {
+        return documentCount;
+    }
+
+    size_t getMemoryBytes() const
+    {
+        return memoryBytes;
+    }
+
+    size_t getPendingWrites() const
+    {
+        return pendingWrites;
+    }
+
+    size_t getWalBytes() const
+    {
+        return wal ? wal->size() : 0;
+    }
+
+    bool isDirty() const
+    {
+        return pendingWrites > 0;
+    }
+
+    chrono::steady_clock::time_point getLastAccess() const
+    {
+        return chrono::steady_clock::time_point(chrono::steady_clock::duration(lastAccess.load()));
+    }
+
+    void touch()
+    {
+        lastAccess = chrono::steady_clock::now().time_since_epoch().count();
+    }
+
+    void load()
+    {
+        loadIndexDefinitions();
+
+        if (filesystem::exists(segmentPath))
+        {
+            openSegment(true);
+        }
+        else if (filesystem::exists(filePath))
+        {
+            ifstream file(filePath);
+            if (!file.is_open())
+            {
+                throw runtime_error("Cannot open collection file: " + name);
+            }
+
+            json collectionData;
+            file >> collectionData;
+            file.close();
+
+            for (auto& [key, value] : collectionData.items())
+            {
+                applyInsert(make_shared<const Document>(value));
+            }
+        }
+
+        pendingWrites = WriteAheadLog::replay(walPath, [this](walRecordType type, const string& id, const json& data)
+        {
+            if (type == WAL_INSERT)
+            {
+                applyInsert(make_shared<const Document>(data));
+            }
+            else
+            {
+                applyRemove(id);
+            }
+        });
+
+        wal = make_unique<WriteAheadLog>(walPath, groupCommitDelayMicros);
+    }
+
+    // Drops whatever a failed load() built, so that the next attempt starts from an empty collection
+    // instead of loading on top of it.
+    void unload()
+    {
+        wal.reset();
+        for (const DocumentPtr& doc : resident)
+        {
+            documents.remove(storageKey(doc->getId()));
+        }
+        resident.clear();
+        segment.reset();
+        segmentSlots = make_unique<ChainHashTable<string, size_t>>();
+        segmentLive.clear();
+        indexes = myVector<shared_ptr<SecondaryIndex>>();
+        columns = ColumnStore();
+        planCache.clear();
+        documentCount = 0;
+        memoryBytes = 0;
+        pendingWrites = 0;
+    }
+
+    // Writes a fresh segment from the live records of the old one, copied byte for byte, and the
+    // documents written since, then maps it in place of the old one. A JSON snapshot left by older
+    // versions is removed once the segment is durable.
+    void save()
+    {
+        SegmentBuilder builder;
+        if (segment)
+        {
+            for (size_t i = 0; i < segment->size(); i++)
+            {
+                if (segmentLive[i])
+                {
+                    size_t length = 0;
+                    const uint8_t* data = segment->document(i, length);
+                    builder.add(segment->id(i), data, length);
+                }
+            }
+        }
+
+        for (const DocumentPtr& doc : resident)
+        {
+            builder.add(doc->getId(), doc->getData());
+        }
+
+        writeFileAtomically(segmentPath, builder.finish());
+        if (filesystem::exists(filePath))
+        {
+            filesystem::remove(filePath);
+        }
+
+        if (wal)
+        {
+            wal->reset();
+        }
+        pendingWrites = 0;
+
+        for (const DocumentPtr& doc : resident)
+        {
+            documents.remove(storageKey(doc->getId()));
+        }
+        resident.clear();
+        documentCount = 0;
+        memoryBytes = 0;
+        openSegment(false);
+    }
+
+    uint64_t insert(const DocumentPtr& doc)
+    {
+        string record;
+        WriteAheadLog::encodeInsert(record, doc->getId(), doc->getData());
+        uint64_t lsn = wal->append(record);
+
+        applyInsert(doc);
+        pendingWrites++;
+        return lsn;
+    }
+
+    // All records of the batch go to the log in a single append and share one lsn. Documents whose id is
+    // already stored replace it, which is how updates are logged: as the full new image.
+    uint64_t insertMany(const myVector<DocumentPtr>& docs)
+    {
+        string records;
+        for (size_t i = 0; i < docs.size(); i++)
+        {
+            WriteAheadLog::encodeInsert(records, docs[i]->getId(), docs[i]->getData());
+        }
+        uint64_t lsn = wal->append(records);
+
+        for (size_t i = 0; i < docs.size(); i++)
+        {
+            applyInsert(docs[i]);
+        }
+        pendingWrites += docs.size();
+        return lsn;
+    }
+
+    uint64_t remove(const myVector<string>& ids)
+    {
+        string records;
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            WriteAheadLog::encodeDelete(records, ids[i]);
+        }
+        uint64_t lsn = wal->append(records);
+
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            applyRemove(ids[i]);
+        }
+        pendingWrites += ids.size();
+        return lsn;
+    }
+
+    void waitDurable(uint64_t lsn, const Deadline& deadline = Deadline())
+    {
+        wal->sync(lsn, deadline);
+    }
+
+    // Documents written since the segment, in no particular order. Read it under the collection lock;
+    // documents are never modified after insertion, so pointers taken from it stay valid afterwards.
+    const vector<DocumentPtr>& getResident() const
+    {
+        return resident;
+    }
+
+    // Records in the mapped segment, dead ones included.
+    size_t segmentSize() const
+    {
+        return segment ? segment->size() : 0;
+    }
+
+    // Evaluates the query on the encoded segment record, decoding only the fields it reads.
+    bool segmentMatches(size_t record, const CompiledQuery& query) const
+    {
+        if (!segmentLive[record])
+        {
+            return false;
+        }
+
+        json fields = json::object();
+        if (!query.getFields().empty() && !segment->extractFields(record, query.getFields(), fields))
+        {
+            return false;
+        }
+        return query.matches(fields);
+    }
+
+    // segmentMatches, materializing only a matching record into doc.
+    bool matchSegment(size_t record, const CompiledQuery& query, DocumentPtr& doc) const
+    {
+        if (!segmentMatches(record, query))
+        {
+            return false;
+        }
+        doc = materialize(record);
+        return true;
+    }
+
+    string segmentId(size_t record) const
+    {
+        return segment->id(record);
+    }
+
+    // get followed by Document::matches, except that a segment record is decoded only when it matches.
+    bool matchId(const string& id, const CompiledQuery& query, DocumentPtr& doc) const
+    {
+        string key = storageKey(id);
+        if (documents.contains(key))
+        {
+            doc = resident[documents.search(key)];
+            return doc->matches(query);
+        }
+        if (segmentSlots->contains(key))
+        {
+            return matchSegment(segmentSlots->search(key), query, doc);
+        }
+        return false;
+    }
+
+    // matchId without materializing the document.
+    bool matchId(const string& id, const CompiledQuery& query) const
+    {
+        string key = storageKey(id);
+        if (documents.contains(key))
+        {
+            return resident[documents.search(key)]->matches(query);
+        }
+        return segmentSlots->contains(key) && segmentMatches(segmentSlots->search(key), query);
+    }
+
+    DocumentPtr get(const string& id) const
+    {
+        string key = storageKey(id);
+        if (documents.contains(key))
+        {
+            return resident[documents.search(key)];
+        }
+        if (segmentSlots->contains(key))
+        {
+            return materialize(segmentSlots->search(key));
+        }
+        return nullptr;
+    }
+
+    SecondaryIndex* getIndex(const string& field) const
+    {
+        for (size_t i = 0; i < indexes.size(); i++)
+        {
+            if (indexes[i]->getField() == field)
+            {
+                return indexes[i].get();
+            }
+        }
+        return nullptr;
+    }
+
+    bool createIndex(const string& field, indexType type = INDEX_HASH)
+    {
+        if (getIndex(field) || columns.hasColumn(field))
+        {
+            return false;
+        }
+        if (type == INDEX_COLUMN)
+        {
+            createColumn(field);
+            return true;
+        }
+
+        shared_ptr<SecondaryIndex> index = makeIndex(field, type);
+        for (const DocumentPtr& doc : resident)
+        {
+            index->add(doc->getId(), doc->getData());
+        }
+        for (size_t i = 0; i < segmentSize(); i++)
+        {
+            if (segmentLive[i])
+            {
+                json fields = json::object();
+                segment->extractFields(i, {field}, fields);
+                index->add(segment->id(i), fields);
+            }
+        }
+
+        indexes.push_back(index);
+        saveIndexDefinitions();
+        planCache.clear();
+        return true;
+    }
+
+    void createColumn(const string& field)
+    {
+        columns.addColumn(field);
+        for (const DocumentPtr& doc : resident)
+        {
+            columns.put(doc->getId(), doc->getData());
+        }
+        for (size_t i = 0; i < segmentSize(); i++)
+        {
+            if (segmentLive[i])
+            {
+                columns.put(segment->id(i), indexedFields(i));
+            }
+        }
+        saveIndexDefinitions();
+        planCache.clear();
+    }
+
+    // Visits the ids of documents that have the field in ascending order of its value, through the
+    // field's ordered index and narrowed to the query's $gt/$lt range on it. Returns false when the
+    // field has no ordered index.
+    template <typename Visitor>
+    bool scanIndexOrder(const string& field, const json& query, Visitor visit) const
+    {
+        SecondaryIndex* index = getIndex(field);
+        if (!index || index->getType() != INDEX_ORDERED)
+        {
+            return false;
+        }
+
+        RangeBound lower;
+        RangeBound upper;
+        auto condition = query.find(field);
+        if (condition != query.end())
+        {
+            rangeBounds(*condition, lower, upper);
+        }
+        static_cast<OrderedIndex*>(index)->forEachInRange(lower, upper, visit);
+        return true;
+    }
+
+    // Picks the most selective equality, $in or $gt/$lt predicate served by the primary key or a
+    // secondary index, or else the columns, or else a full scan. The estimate is the number of
+    // documents the chosen path examines.
+    QueryPlan planAccess(const json& query) const
+    {
+        QueryPlan plan;
+        plan.estimate = documentCount;
+        plan.plannedSize = documentCount;
+        if (!query.is_object() || query.contains("$or"))
+        {
+            return plan;
+        }
+
+        bool found = false;
+        bool columnar = false;
+        for (auto it = query.begin(); it != query.end(); ++it)
+        {
+            json values;
+            RangeBound lower;
+            RangeBound upper;
+            size_t cost = 0;
+            accessPath access = ACCESS_COLLECTION_SCAN;
+            columnar = columnar || columns.hasColumn(it.key());
+
+            if (equalityValues(it.value(), values))
+            {
+                if (it.key() == "_id")
+                {
+                    cost = values.size();
+                    access = ACCESS_ID_LOOKUP;
+                }
+                else if (SecondaryIndex* index = getIndex(it.key()))
+                {
+                    for (const auto& value : values)
+                    {
+                        cost += index->count(value);
+                    }
+                    access = ACCESS_INDEX_EQUALITY;
+                }
+                else
+                {
+                    continue;
+                }
+            }
+            else if (rangeBounds(it.value(), lower, upper))
+            {
+                SecondaryIndex* index = getIndex(it.key());
+                if (!index || index->getType() != INDEX_ORDERED)
+                {
+                    continue;
+                }
+                size_t limit = found ? plan.estimate : documentCount;
+                cost = static_cast<OrderedIndex*>(index)->countRange(lower, upper, limit);
+                access = ACCESS_INDEX_RANGE;
+            }
+            else
+            {
+                continue;
+            }
+
+            if (!found || cost < plan.estimate)
+            {
+                found = true;
+                plan.access = access;
+                plan.field = it.key();
+                plan.estimate = cost;
+            }
+        }
+
+        if (!found && columnar)
+        {
+            plan.access = ACCESS_COLUMN_FILTER;
+        }
+        return plan;
+    }
+
+    // Candidate ids for the query through the plan's access path, taking the values from this query.
+    // Returns false when the path is a full scan or cannot serve these values, and the caller has to
+    // scan. Candidates from an ordered index come back in index order.
+    bool fetchCandidates(const QueryPlan& plan, const json& query, myVector<string>& ids) const
+    {
+        if (plan.access == ACCESS_COLLECTION_SCAN || !query.is_object())
+        {
+            return false;
+        }
+        if (plan.access == ACCESS_COLUMN_FILTER)
+        {
+            return columns.select(query, ids);
+        }
+
+        auto condition = query.find(plan.field);
+        SecondaryIndex* index = plan.access == ACCESS_ID_LOOKUP ? nullptr : getIndex(plan.field);
+        if (condition == query.end() || (plan.access != ACCESS_ID_LOOKUP && !index))
+        {
+            return false;
+        }
+
+        if (plan.access == ACCESS_INDEX_RANGE)
+        {
+            RangeBound lower;
+            RangeBound upper;
+            if (index->getType() != INDEX_ORDERED || !rangeBounds(*condition, lower, upper))
+            {
+                return false;
+            }
+            static_cast<OrderedIndex*>(index)->range(lower, upper, ids);
+            return true;
+        }
+
+        json values;
+        if (!equalityValues(*condition, values))
+        {
+            return false;
+        }
+        unordered_set<string> seenKeys;
+        for (const auto& value : values)
+        {
+            if (!seenKeys.insert(jsonValueKey(value)).second)
+            {
+                continue;
+            }
+
+            if (plan.access == ACCESS_ID_LOOKUP)
+            {
+                string key = value.is_string() ? storageKey(value.get<string>()) : string();
+                if (value.is_string() && (documents.contains(key) || segmentSlots->contains(key)))
+                {
+                    ids.push_back(value.get<string>());
+                }
+            }
+            else
+            {
+                index->lookup(value, ids);
+            }
+        }
+        return true;
+    }
+
+    bool hasOrderedIndex(const string& field) const
+    {
+        SecondaryIndex* index = getIndex(field);
+        return index && index->getType() == INDEX_ORDERED;
+    }
+
+    PlanCache& getPlanCache() const
+    {
+        return planCache;
+    }
+};
+
+#endif
@@ -0,0 +1,459 @@
+#ifndef COLUMN_STORE_HPP
+#define COLUMN_STORE_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <unordered_map>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "../../Containers/Go/vector.h"
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+#define NO_STRING_CODE UINT32_MAX
+
+// Largest integer magnitude a double holds exactly; bigger integers are left to the documents.
+#define EXACT_DOUBLE_LIMIT (int64_t(1) << 53)
+
+// Whether a double holds the number exactly, so that comparing doubles agrees with comparing the json values.
+inline bool exactAsDouble(const json& value)
+{
+    if (value.is_number_float())
+    {
+        return true;
+    }
+    if (value.is_number_unsigned())
+    {
+        return value.get<uint64_t>() <= uint64_t(EXACT_DOUBLE_LIMIT);
+    }
+    if (value.is_number_integer())
+    {
+        int64_t integer = value.get<int64_t>();
+        return integer <= EXACT_DOUBLE_LIMIT && integer >= -EXACT_DOUBLE_LIMIT;
+    }
+    return false;
+}
+
+inline void setBit(vector<uint64_t>& bits, size_t row, bool value)
+{
+    if (value)
+    {
+        bits[row >> 6] |= uint64_t(1) << (row & 63);
+    }
+    else
+    {
+        bits[row >> 6] &= ~(uint64_t(1) << (row & 63));
+    }
+}
+
+inline bool getBit(const vector<uint64_t>& bits, size_t row)
+{
+    return (bits[row >> 6] >> (row & 63)) & 1;
+}
+
+// Sets bit i of out when lower < values[i] < upper. NaN, used for rows without a number, never passes.
+inline void selectBetween(const double* values, size_t count, double lower, double upper, uint64_t* out)
+{
+    size_t i = 0;
+#if defined(__AVX__)
+    __m256d low = _mm256_set1_pd(lower);
+    __m256d high = _mm256_set1_pd(upper);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d value = _mm256_loadu_pd(values + i);
+        __m256d inside = _mm256_and_pd(_mm256_cmp_pd(value, low, _CMP_GT_OQ), _mm256_cmp_pd(value, high, _CMP_LT_OQ));
+        out[i >> 6] |= uint64_t(_mm256_movemask_pd(inside)) << (i & 63);
+    }
+#elif defined(__SSE2__)
+    __m128d low = _mm_set1_pd(lower);
+    __m128d high = _mm_set1_pd(upper);
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128d value = _mm_loadu_pd(values + i);
+        __m128d inside = _mm_and_pd(_mm_cmpgt_pd(value, low), _mm_cmplt_pd(value, high));
+        out[i >> 6] |= uint64_t(_mm_movemask_pd(inside)) << (i & 63);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i >> 6] |= uint64_t(values[i] > lower && values[i] < upper) << (i & 63);
+    }
+}
+
+inline void selectEqual(const double* values, size_t count, double target, uint64_t* out)
+{
+    size_t i = 0;
+#if defined(__AVX__)
+    __m256d wanted = _mm256_set1_pd(target);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d equal = _mm256_cmp_pd(_mm256_loadu_pd(values + i), wanted, _CMP_EQ_OQ);
+        out[i >> 6] |= uint64_t(_mm256_movemask_pd(equal)) << (i & 63);
+    }
+#elif defined(__SSE2__)
+    __m128d wanted = _mm_set1_pd(target);
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128d equal = _mm_cmpeq_pd(_mm_loadu_pd(values + i), wanted);
+        out[i >> 6] |= uint64_t(_mm_movemask_pd(equal)) << (i & 63);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i >> 6] |= uint64_t(values[i] == target) << (i & 63);
+    }
+}
+
+inline void selectCode(const uint32_t* codes, size_t count, uint32_t target, uint64_t* out)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i wanted = _mm_set1_epi32(static_cast<int>(target));
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + i)), wanted);
+        out[i >> 6] |= uint64_t(_mm_movemask_ps(_mm_castsi128_ps(equal))) << (i & 63);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i >> 6] |= uint64_t(codes[i] == target) << (i & 63);
+    }
+}
+
+// One field of the column store. Numbers are kept as doubles (NaN when the row has none), strings as
+// dictionary codes. Rows whose value is anything else, or an integer too large for a double, are
+// marked in other and left to the documents.
+struct Column
+{
+    string field;
+    vector<double> numbers;
+    vector<uint32_t> codes;
+    vector<uint64_t> present;
+    vector<uint64_t> other;
+    unordered_map<string, uint32_t> dictionary;
+
+    explicit Column(const string& fieldName) : field(fieldName)
+    {
+    }
+
+    void resize(size_t rows)
+    {
+        numbers.resize(rows, numeric_limits<double>::quiet_NaN());
+        codes.resize(rows, NO_STRING_CODE);
+        present.resize((rows + 63) / 64, 0);
+        other.resize((rows + 63) / 64, 0);
+    }
+
+    void set(size_t row, const json& doc)
+    {
+        numbers[row] = numeric_limits<double>::quiet_NaN();
+        codes[row] = NO_STRING_CODE;
+        setBit(other, row, false);
+
+        auto value = doc.find(field);
+        setBit(present, row, value != doc.end());
+        if (value == doc.end())
+        {
+            return;
+        }
+
+        if (exactAsDouble(*value))
+        {
+            numbers[row] = value->get<double>();
+            return;
+        }
+        setBit(other, row, true);
+        if (value->is_string())
+        {
+            auto code = dictionary.emplace(value->get_ref<const string&>(), static_cast<uint32_t>(dictionary.size()));
+            codes[row] = code.first->second;
+        }
+    }
+
+    void moveRow(size_t from, size_t to)
+    {
+        numbers[to] = numbers[from];
+        codes[to] = codes[from];
+        setBit(present, to, getBit(present, from));
+        setBit(other, to, getBit(other, from));
+    }
+
+    void clearRow(size_t row)
+    {
+        setBit(present, row, false);
+        setBit(other, row, false);
+    }
+
+    // Adds the rows that may equal value to out. Exact for numbers and strings; every row of another
+    // type is included when value itself is of another type.
+    void selectValue(const json& value, vector<uint64_t>& out) const
+    {
+        if (exactAsDouble(value))
+        {
+            selectEqual(numbers.data(), numbers.size(), value.get<double>(), out.data());
+        }
+        else if (value.is_string())
+        {
+            auto code = dictionary.find(value.get_ref<const string&>());
+            if (code != dictionary.end())
+            {
+                selectCode(codes.data(), codes.size(), code->second, out.data());
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < out.size(); i++)
+            {
+                out[i] |= other[i];
+            }
+        }
+    }
+
+    // Candidate rows for a condition on this field, a superset of the matches that the query itself
+    // still has to confirm. Returns false for conditions the column cannot narrow ($like, or a bound
+    // that is not a number).
+    bool select(const json& condition, vector<uint64_t>& out) const
+    {
+        out.assign(present.size(), 0);
+        if (condition.is_object() && condition.empty())
+        {
+            out = present;
+            return true;
+        }
+        if (!condition.is_object())
+        {
+            selectValue(condition, out);
+            return true;
+        }
+
+        double lower = -numeric_limits<double>::infinity();
+        double upper = numeric_limits<double>::infinity();
+        bool ranged = false;
+        vector<const json*> values;
+        for (auto it = condition.begin(); it != condition.end(); ++it)
+        {
+            if ((it.key() == "$gt" || it.key() == "$lt") && exactAsDouble(it.value()))
+            {
+                double bound = it.value().get<double>();
+                if (it.key() == "$gt")
+                {
+                    lower = max(lower, bound);
+                }
+                else
+                {
+                    upper = min(upper, bound);
+                }
+                ranged = true;
+            }
+            else if (it.key() == "$eq")
+            {
+                values.push_back(&it.value());
+            }
+            else if (it.key() == "$in" && it.value().is_array())
+            {
+                for (const auto& item : it.value())
+                {
+                    values.push_back(&item);
+                }
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        if (ranged)
+        {
+            // Values of other types (strings above all) compare by type order, so they stay candidates.
+            selectBetween(numbers.data(), numbers.size(), lower, upper, out.data());
+            for (size_t i = 0; i < out.size(); i++)
+            {
+                out[i] |= other[i];
+            }
+        }
+        if (!values.empty())
+        {
+            vector<uint64_t> equal(present.size(), 0);
+            for (const json* value : values)
+            {
+                selectValue(*value, equal);
+            }
+            for (size_t i = 0; i < out.size(); i++)
+            {
+                out[i] = ranged ? out[i] & equal[i] : equal[i];
+            }
+        }
+        return true;
+    }
+};
+
+// Columnar copies of chosen fields of a collection, one row per document. Rows are dense: removing a
+// document moves the last row into its place.
+class ColumnStore
+{
+private:
+    vector<Column> columns;
+    vector<string> rowIds;
+    unordered_map<string, size_t> rows;
+
+    const Column* findColumn(const string& field) const
+    {
+        for (const Column& column : columns)
+        {
+            if (column.field == field)
+            {
+                return &column;
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    bool hasColumn(const string& field) const
+    {
+        return findColumn(field) != nullptr;
+    }
+
+    bool empty() const
+    {
+        return columns.empty();
+    }
+
+    vector<string> getFields() const
+    {
+        vector<string> fields;
+        for (const Column& column : columns)
+        {
+            fields.push_back(column.field);
+        }
+        return fields;
+    }
+
+    // Existing rows keep the new column empty until they are put again.
+    void addColumn(const string& field)
+    {
+        columns.push_back(Column(field));
+        columns.back().resize(rowIds.size());
+    }
+
+    // Inserts the document's row or refreshes it when the id already has one.
+    void put(const string& id, const json& doc)
+    {
+        if (columns.empty())
+        {
+            return;
+        }
+
+        auto it = rows.find(id);
+        size_t row = 0;
+        if (it != rows.end())
+        {
+            row = it->second;
+        }
+        else
+        {
+            row = rowIds.size();
+            rows.emplace(id, row);
+            rowIds.push_back(id);
+            for (Column& column : columns)
+            {
+                column.resize(rowIds.size());
+            }
+        }
+
+        for (Column& column : columns)
+        {
+            column.set(row, doc);
+        }
+    }
+
+    void remove(const string& id)
+    {
+        auto it = rows.find(id);
+        if (it == rows.end())
+        {
+            return;
+        }
+
+        size_t row = it->second;
+        size_t last = rowIds.size() - 1;
+        rows.erase(it);
+        if (row != last)
+        {
+            for (Column& column : columns)
+            {
+                column.moveRow(last, row);
+            }
+            rowIds[row] = move(rowIds[last]);
+            rows[rowIds[row]] = row;
+        }
+
+        rowIds.pop_back();
+        for (Column& column : columns)
+        {
+            column.clearRow(last);
+            column.resize(rowIds.size());
+        }
+    }
+
+    // Intersects the selections of every top-level condition that has a column and returns the ids of
+    // the selected rows. Returns false when no condition could use a column.
+    bool select(const json& query, myVector<string>& ids) const
+    {
+        if (columns.empty() || !query.is_object() || query.contains("$or"))
+        {
+            return false;
+        }
+
+        vector<uint64_t> selection;
+        vector<uint64_t> candidates;
+        bool used = false;
+        for (auto it = query.begin(); it != query.end(); ++it)
+        {
+            const Column* column = findColumn(it.key());
+            if (!column || !column->select(it.value(), candidates))
+            {
+                continue;
+            }
+
+            if (!used)
+            {
+                selection.swap(candidates);
+                used = true;
+            }
+            else
+            {
+                for (size_t i = 0; i < selection.size(); i++)
+                {
+                    selection[i] &= candidates[i];
+                }
+            }
+        }
+        if (!used)
+        {
+            return false;
+        }
+
+        for (size_t word = 0; word < selection.size(); word++)
+        {
+            uint64_t bits = selection[word];
+            while (bits != 0)
+            {
+                ids.push_back(rowIds[word * 64 + __builtin_ctzll(bits)]);
+                bits &= bits - 1;
+            }
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef COMPILED_QUERY_HPP
+#define COMPILED_QUERY_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <stdexcept>
+#include <algorithm>
+
+#include "jsonUtils.hpp"
+#include "likeMatcher.hpp"
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+enum queryOperator
+{
+    OP_EQ,
+    OP_GT,
+    OP_LT,
+    OP_LIKE,
+    OP_IN,
+    OP_INVALID
+};
+
+struct FieldCondition
+{
+    queryOperator op = OP_INVALID;
+    json value;
+    unordered_set<string> inKeys;
+    LikeMatcher like;
+};
+
+struct FieldPredicate
+{
+    string field;
+    bool isEquality = false;
+    json equalsValue;
+    vector<FieldCondition> conditions;
+};
+
+// Immutable predicate tree built once per find/delete. Mirrors QueryEvaluator semantics:
+// a top-level $or replaces the rest of the query, every other key is an AND-ed field predicate.
+class CompiledQuery
+{
+private:
+    json source;
+    bool isObject;
+    bool isOr;
+    vector<CompiledQuery> alternatives;
+    vector<FieldPredicate> predicates;
+    vector<string> fields;
+
+    void addField(const string& field)
+    {
+        if (find(fields.begin(), fields.end(), field) == fields.end())
+        {
+            fields.push_back(field);
+        }
+    }
+
+    static queryOperator parseOperator(const string& op)
+    {
+        if (op == "$eq")
+        {
+            return OP_EQ;
+        }
+        if (op == "$gt")
+        {
+            return OP_GT;
+        }
+        if (op == "$lt")
+        {
+            return OP_LT;
+        }
+        if (op == "$like")
+        {
+            return OP_LIKE;
+        }
+        if (op == "$in")
+        {
+            return OP_IN;
+        }
+        return OP_INVALID;
+    }
+
+    static FieldPredicate compileField(const string& field, const json& condition)
+    {
+        FieldPredicate predicate;
+        predicate.field = field;
+
+        if (!condition.is_object())
+        {
+            predicate.isEquality = true;
+            predicate.equalsValue = condition;
+            return predicate;
+        }
+
+        for (auto it = condition.begin(); it != condition.end(); ++it)
+        {
+            FieldCondition compiled;
+            compiled.op = parseOperator(it.key());
+            compiled.value = it.value();
+
+            if (compiled.op == OP_LIKE)
+            {
+                if (!it.value().is_string())
+                {
+                    throw invalid_argument("$like pattern for field '" + field + "' must be a string");
+                }
+                compiled.like = LikeMatcher(it.value().get<string>());
+            }
+            else if (compiled.op == OP_IN)
+            {
+                if (it.value().is_structured())
+                {
+                    for (const auto& item : it.value())
+                    {
+                        compiled.inKeys.insert(jsonValueKey(item));
+                    }
+                }
+                else
+                {
+                    compiled.inKeys.insert(jsonValueKey(it.value()));
+                }
+            }
+
+            predicate.conditions.push_back(move(compiled));
+        }
+        return predicate;
+    }
+
+    static bool matchesCondition(const json& fieldValue, const FieldCondition& condition)
+    {
+        switch (condition.op)
+        {
+            case OP_EQ:
+                return fieldValue == condition.value;
+            case OP_GT:
+                return !(fieldValue <= condition.value);
+            case OP_LT:
+                return !(fieldValue >= condition.value);
+            case OP_LIKE:
+                return fieldValue.is_string() && condition.like.matches(fieldValue.get_ref<const string&>());
+            case OP_IN:
+                return condition.inKeys.count(jsonValueKey(fieldValue)) > 0;
+            default:
+                return false;
+        }
+    }
+
+public:
+    explicit CompiledQuery(const json& query)
+        : source(query), isObject(query.is_object()), isOr(false)
+    {
+        if (!isObject)
+        {
+            return;
+        }
+
+        auto orIt = query.find("$or");
+        if (orIt != query.end())
+        {
+            isOr = true;
+            for (const auto& condition : *orIt)
+            {
+                alternatives.push_back(CompiledQuery(condition));
+                for (const string& field : alternatives.back().fields)
+                {
+                    addField(field);
+                }
+            }
+            return;
+        }
+
+        for (auto it = query.begin(); it != query.end(); ++it)
+        {
+            predicates.push_back(compileField(it.key(), it.value()));
+            addField(it.key());
+        }
+    }
+
+    const json& getSource() const
+    {
+        return source;
+    }
+
+    // Top-level fields the query reads. A document reduced to these fields matches exactly when the
+    // whole document does.
+    const vector<string>& getFields() const
+    {
+        return fields;
+    }
+
+    bool matches(const json& doc) const
+    {
+        if (!isObject)
+        {
+            return false;
+        }
+
+        if (isOr)
+        {
+            for (const CompiledQuery& alternative : alternatives)
+            {
+                if (alternative.matches(doc))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        for (const FieldPredicate& predicate : predicates)
+        {
+            auto it = doc.find(predicate.field);
+            if (it == doc.end())
+            {
+                return false;
+            }
+
+            if (predicate.isEquality)
+            {
+                if (*it != predicate.equalsValue)
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            for (const FieldCondition& condition : predicate.conditions)
+            {
+                if (!matchesCondition(*it, condition))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef COMPILED_UPDATE_HPP
+#define COMPILED_UPDATE_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+enum updateOperator
+{
+    UPDATE_SET,
+    UPDATE_INC,
+    UPDATE_UNSET,
+    UPDATE_PUSH
+};
+
+struct FieldUpdate
+{
+    updateOperator op;
+    vector<string> path;
+    json value;
+};
+
+// Field-level modifications built once per update: {"$set": {...}, "$inc": {...}, "$unset": {...},
+// "$push": {...}}. Dotted names ("address.city") reach into nested objects, which are created as needed.
+class CompiledUpdate
+{
+private:
+    vector<FieldUpdate> updates;
+
+    static bool parseOperator(const string& name, updateOperator& op)
+    {
+        if (name == "$set")
+        {
+            op = UPDATE_SET;
+        }
+        else if (name == "$inc")
+        {
+            op = UPDATE_INC;
+        }
+        else if (name == "$unset")
+        {
+            op = UPDATE_UNSET;
+        }
+        else if (name == "$push")
+        {
+            op = UPDATE_PUSH;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    static vector<string> splitPath(const string& field)
+    {
+        vector<string> path;
+        size_t begin = 0;
+        while (true)
+        {
+            size_t dot = field.find('.', begin);
+            path.push_back(field.substr(begin, dot == string::npos ? string::npos : dot - begin));
+            if (path.back().empty())
+            {
+                throw invalid_argument("invalid field name '" + field + "'");
+            }
+            if (dot == string::npos)
+            {
+                return path;
+            }
+            begin = dot + 1;
+        }
+    }
+
+    // Returns the object that holds the last path element, creating intermediate objects when create is set.
+    static json* parentOf(json& doc, const vector<string>& path, bool create)
+    {
+        json* current = &doc;
+        for (size_t i = 0; i + 1 < path.size(); i++)
+        {
+            auto it = current->find(path[i]);
+            if (it == current->end())
+            {
+                if (!create)
+                {
+                    return nullptr;
+                }
+                current = &(*current)[path[i]];
+                *current = json::object();
+            }
+            else if (it->is_object())
+            {
+                current = &*it;
+            }
+            else if (create)
+            {
+                throw invalid_argument("field '" + path[i] + "' is not an object");
+            }
+            else
+            {
+                return nullptr;
+            }
+        }
+        return current;
+    }
+
+    // Integers stay exact: the sum is stored as a signed integer when it fits, else as an unsigned one.
+    // A sum that fits neither is rejected rather than rounded, which fails the whole update.
+    static json increment(const json& current, const json& amount, const string& name)
+    {
+        if (!current.is_number_integer() || !amount.is_number_integer())
+        {
+            return current.get<double>() + amount.get<double>();
+        }
+
+        auto add = [&](auto a, auto b) -> json
+        {
+            int64_t signedSum = 0;
+            if (!__builtin_add_overflow(a, b, &signedSum))
+            {
+                return signedSum;
+            }
+            uint64_t unsignedSum = 0;
+            if (!__builtin_add_overflow(a, b, &unsignedSum))
+            {
+                return unsignedSum;
+            }
+            throw invalid_argument("$inc overflows integer field '" + name + "'");
+        };
+
+        if (current.is_number_unsigned())
+        {
+            return amount.is_number_unsigned() ? add(current.get<uint64_t>(), amount.get<uint64_t>())
+                                               : add(current.get<uint64_t>(), amount.get<int64_t>());
+        }
+        return amount.is_number_unsigned() ? add(current.get<int64_t>(), amount.get<uint64_t>())
+                                           : add(current.get<int64_t>(), amount.get<int64_t>());
+    }
+
+    static void applyField(json& doc, const FieldUpdate& update)
+    {
+        json* parent = parentOf(doc, update.path, update.op != UPDATE_UNSET);
+        if (parent == nullptr)
+        {
+            return;
+        }
+
+        const string& name = update.path.back();
+        auto it = parent->find(name);
+        switch (update.op)
+        {
+            case UPDATE_SET:
+                (*parent)[name] = update.value;
+                break;
+            case UPDATE_INC:
+                if (it == parent->end())
+                {
+                    (*parent)[name] = update.value;
+                }
+                else if (!it->is_number())
+                {
+                    throw invalid_argument("cannot $inc non-numeric field '" + name + "'");
+                }
+                else
+                {
+                    *it = increment(*it, update.value, name);
+                }
+                break;
+            case UPDATE_UNSET:
+                if (it != parent->end())
+                {
+                    parent->erase(it);
+                }
+                break;
+            case UPDATE_PUSH:
+                if (it == parent->end())
+                {
+                    (*parent)[name] = json::array({update.value});
+                }
+                else if (!it->is_array())
+                {
+                    throw invalid_argument("cannot $push to non-array field '" + name + "'");
+                }
+                else
+                {
+                    it->push_back(update.value);
+                }
+                break;
+        }
+    }
+
+public:
+    explicit CompiledUpdate(const json& update)
+    {
+        if (!update.is_object() || update.empty())
+        {
+            throw invalid_argument("update must be a non-empty object of operators");
+        }
+
+        unordered_set<string> touched;
+        for (auto op = update.begin(); op != update.end(); ++op)
+        {
+            FieldUpdate base;
+            if (!parseOperator(op.key(), base.op))
+            {
+                throw invalid_argument("unknown update operator '" + op.key() + "'");
+            }
+            if (!op.value().is_object())
+            {
+                throw invalid_argument(op.key() + " must be an object");
+            }
+
+            for (auto field = op.value().begin(); field != op.value().end(); ++field)
+            {
+                if (field.key() == "_id" || field.key().rfind("_id.", 0) == 0)
+                {
+                    throw invalid_argument("_id cannot be updated");
+                }
+                if (!touched.insert(field.key()).second)
+                {
+                    throw invalid_argument("field '" + field.key() + "' is updated more than once");
+                }
+                if (base.op == UPDATE_INC && !field.value().is_number())
+                {
+                    throw invalid_argument("$inc amount for field '" + field.key() + "' must be a number");
+                }
+
+                FieldUpdate fieldUpdate = base;
+                fieldUpdate.path = splitPath(field.key());
+                fieldUpdate.value = field.value();
+                updates.push_back(move(fieldUpdate));
+            }
+        }
+    }
+
+    // Returns the updated copy of doc; throws if an operator does not fit the current value.
+    json apply(const json& doc) const
+    {
+        json updated = doc;
+        for (const FieldUpdate& update : updates)
+        {
+            applyField(updated, update);
+        }
+        return updated;
+    }
+
+    // Document inserted by an upsert: the plain equality fields of the query with the update applied.
+    json upsertDocument(const json& query) const
+    {
+        json doc = json::object();
+        if (query.is_object())
+        {
+            for (auto it = query.begin(); it != query.end(); ++it)
+            {
+                if (it.key().empty() || it.key()[0] == '$')
+                {
+                    continue;
+                }
+                if (!it.value().is_object())
+                {
+                    doc[it.key()] = it.value();
+                }
+                else if (it.value().size() == 1 && it.value().contains("$eq"))
+                {
+                    doc[it.key()] = it.value()["$eq"];
+                }
+            }
+        }
+        return apply(doc);
+    }
+};
+
+#endif
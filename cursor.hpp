@@ -0,0 +1,188 @@
+#ifndef CURSOR_HPP
+#define CURSOR_HPP
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+#include "document.hpp"
+
+using namespace std;
+
+#define DEFAULT_CURSOR_TIMEOUT_SEC 600
+
+// Reads the stored documents with the given ids into batch, skipping those deleted since or changed so
+// that they no longer match.
+typedef function<void(const vector<string>& ids, vector<DocumentPtr>& batch)> DocumentFetcher;
+
+// The unread part of a result. A FIND cursor keeps only the ids still to send and reads each batch
+// from the collection, so a checkpointed segment record is decoded only when its batch is sent; an
+// unsorted FIND does not decode them before either. Later batches therefore show documents as they
+// are when read, and drop those deleted meanwhile or updated so that they no longer match the query.
+// Rows that cannot be read back, such as aggregation results, are held as they are.
+struct Cursor
+{
+    uint64_t owner = 0;
+    vector<DocumentPtr> results;
+    vector<string> ids;
+    DocumentFetcher fetch;
+    size_t position = 0;
+    chrono::steady_clock::time_point lastUsed;
+};
+
+// Open cursors of the server. A cursor belongs to the connection that opened it, is dropped with that
+// connection, and expires after idleTimeout without a GETMORE.
+class CursorManager
+{
+private:
+    mutex cursorsMutex;
+    map<uint64_t, Cursor> cursors;
+    uint64_t nextId;
+    chrono::seconds idleTimeout;
+
+public:
+    explicit CursorManager(chrono::seconds idle = chrono::seconds(DEFAULT_CURSOR_TIMEOUT_SEC))
+        : nextId(1), idleTimeout(idle)
+    {
+    }
+
+    void setIdleTimeout(chrono::seconds idle)
+    {
+        lock_guard<mutex> lock(cursorsMutex);
+        idleTimeout = idle;
+    }
+
+    uint64_t open(uint64_t owner, vector<DocumentPtr> results)
+    {
+        lock_guard<mutex> lock(cursorsMutex);
+        uint64_t id = nextId++;
+        Cursor& cursor = cursors[id];
+        cursor.owner = owner;
+        cursor.results = move(results);
+        cursor.lastUsed = chrono::steady_clock::now();
+        return id;
+    }
+
+    uint64_t open(uint64_t owner, vector<string> ids, DocumentFetcher fetch)
+    {
+        lock_guard<mutex> lock(cursorsMutex);
+        uint64_t id = nextId++;
+        Cursor& cursor = cursors[id];
+        cursor.owner = owner;
+        cursor.ids = move(ids);
+        cursor.fetch = move(fetch);
+        cursor.lastUsed = chrono::steady_clock::now();
+        return id;
+    }
+
+    // Moves up to batchSize documents into batch; fewer when some were dropped since the FIND. Returns
+    // false if the cursor does not exist or belongs to another connection; an exhausted cursor is
+    // closed and reported through exhausted. Documents are read after the cursors are unlocked.
+    bool next(uint64_t id, uint64_t owner, size_t batchSize, vector<DocumentPtr>& batch, bool& exhausted)
+    {
+        vector<string> ids;
+        DocumentFetcher fetch;
+        {
+            lock_guard<mutex> lock(cursorsMutex);
+            auto it = cursors.find(id);
+            if (it == cursors.end() || it->second.owner != owner)
+            {
+                return false;
+            }
+
+            Cursor& cursor = it->second;
+            size_t count = cursor.fetch ? cursor.ids.size() : cursor.results.size();
+            size_t end = min(count, cursor.position + max<size_t>(batchSize, 1));
+            for (size_t i = cursor.position; i < end; i++)
+            {
+                if (cursor.fetch)
+                {
+                    ids.push_back(move(cursor.ids[i]));
+                }
+                else
+                {
+                    batch.push_back(move(cursor.results[i]));
+                }
+            }
+            cursor.position = end;
+            cursor.lastUsed = chrono::steady_clock::now();
+            fetch = cursor.fetch;
+
+            exhausted = cursor.position == count;
+            if (exhausted)
+            {
+                cursors.erase(it);
+            }
+        }
+
+        if (fetch && !ids.empty())
+        {
+            fetch(ids, batch);
+        }
+        return true;
+    }
+
+    bool kill(uint64_t id, uint64_t owner)
+    {
+        lock_guard<mutex> lock(cursorsMutex);
+        auto it = cursors.find(id);
+        if (it == cursors.end() || it->second.owner != owner)
+        {
+            return false;
+        }
+        cursors.erase(it);
+        return true;
+    }
+
+    size_t killOwner(uint64_t owner)
+    {
+        lock_guard<mutex> lock(cursorsMutex);
+        size_t killed = 0;
+        for (auto it = cursors.begin(); it != cursors.end();)
+        {
+            if (it->second.owner == owner)
+            {
+                it = cursors.erase(it);
+                killed++;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return killed;
+    }
+
+    size_t expireIdle()
+    {
+        lock_guard<mutex> lock(cursorsMutex);
+        auto deadline = chrono::steady_clock::now() - idleTimeout;
+        size_t expired = 0;
+        for (auto it = cursors.begin(); it != cursors.end();)
+        {
+            if (it->second.lastUsed < deadline)
+            {
+                it = cursors.erase(it);
+                expired++;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return expired;
+    }
+
+    size_t size()
+    {
+        lock_guard<mutex> lock(cursorsMutex);
+        return cursors.size();
+    }
+};
+
+#endif
@@ -5,21 +5,75 @@
 
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <filesystem>
 #include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <limits>
+#include <algorithm>
 
 #include "../../Containers/hashtable.hpp"
 #include "document.hpp"
+#include "collection.hpp"
+#include "findOptions.hpp"
+#include "aggregation.hpp"
+#include "compiledUpdate.hpp"
+#include "threadPool.hpp"
+#include "metrics.hpp"
+#include "logger.hpp"
+#include "deadline.hpp"
+#include "queryPlan.hpp"
 #include "../../Containers/Go/vector.h"
+#include "poolAllocator.hpp"
 
-using nlohmann::json;
-
-mutex mtx;
-
+// TIMED_OUT: the deadline passed. A write whose scan timed out changed nothing; one that timed out
+// waiting for the log sync is applied but not yet confirmed durable.
 enum operationState
 {
     SUCCESS,
-    FAILED
+    FAILED,
+    TIMED_OUT
+};
+
+enum flushPolicy
+{
+    FLUSH_ON_WRITE,
+    FLUSH_BATCHED,
+    FLUSH_MANUAL
+};
+
+struct DatabaseOptions
+{
+    flushPolicy flush = FLUSH_BATCHED;
+    size_t flushEveryWrites = 100000;
+    size_t checkpointWalBytes = 64 * 1024 * 1024;
+    walSyncMode walSync = WAL_SYNC_COMMIT;
+    size_t groupCommitDelayMicros = 0;
+    size_t memoryBudgetBytes = 512 * 1024 * 1024;
+    size_t scanThreads = max(thread::hardware_concurrency(), 1u);
+    size_t scanChunkSize = 16 * 1024;
+    size_t parallelScanThreshold = 64 * 1024;
+};
+
+// Outcome of insertMany: failed documents are reported by their position in the input and do not
+// stop the rest of the batch. durabilityError is set when the documents were stored but the checkpoint
+// or sync that follows failed; they are in the collection and must not be inserted again.
+struct InsertManyResult
+{
+    size_t inserted = 0;
+    myVector<pair<size_t, string>> errors;
+    bool timedOut = false;
+    string durabilityError;
+};
+
+struct UpdateResult
+{
+    size_t matched = 0;
+    size_t modified = 0;
+    string upsertedId;
 };
 
 class Database 
@@ -27,11 +81,10 @@ class Database
 private:
     string dbName;
     string basePath;
-    
-    string getCollectionPath(const string& collectionName) 
-    {
-        return basePath + "/" + collectionName + ".json";
-    }
+    DatabaseOptions options;
+    shared_mutex catalogMutex;
+    ChainHashTable<string, shared_ptr<Collection>> collections;
+    myVector<string> collectionNames;
     
     void ensureDirectoryExists() 
     {
@@ -48,149 +101,1109 @@ private:
     }
 
 public:
-    Database(const string& name) : dbName(name), basePath("databases/" + name) 
+    Database(const string& name, const DatabaseOptions& databaseOptions = DatabaseOptions())
+        : dbName(name), basePath("databases/" + name), options(databaseOptions)
     {
         ensureDirectoryExists();
     }
+
+    ~Database()
+    {
+        try
+        {
+            flushAll();
+        }
+        catch (const exception& e)
+        {
+            LogLine(LOG_ERROR, "flush failed").field("database", dbName).field("error", e.what());
+        }
+    }
+
+    Database(const Database&) = delete;
+    Database& operator=(const Database&) = delete;
     
     operationState insert(const string& collectionName, const string& documentJson) 
     {
         string cleanJson = removeQuotes(documentJson);
 
-        mtx.lock();
         try 
         {
-            json docData = json::parse(cleanJson);
-            Document doc(docData);
-            
-            ChainHashTable<string, Document> collection;
-            loadCollection(collectionName, collection);
+            return insert(collectionName, make_shared<const Document>(json::parse(cleanJson)));
+        }
+        catch (const exception& e) 
+        {
+            LogLine(LOG_ERROR, "insert failed").field("collection", collectionName).field("error", e.what());
+            return operationState::FAILED;
+        }
+    }
 
-            collection.insert(doc.getId(), doc);
+    operationState insert(const string& collectionName, const Document& doc) 
+    {
+        return insert(collectionName, make_shared<const Document>(doc));
+    }
 
-            saveCollection(collectionName, collection);
+    operationState insert(const string& collectionName, const DocumentPtr& doc, const Deadline& deadline = Deadline()) 
+    {
+        try 
+        {
+            unique_lock<shared_mutex> lock;
+            shared_ptr<Collection> collection = acquireCollection(collectionName, lock);
+            uint64_t lsn = collection->insert(doc);
+            checkpointIfNeeded(*collection);
+            lock.unlock();
+
+            commit(*collection, lsn, deadline);
+            enforceMemoryBudget(collectionName);
             
-            cout << "Document inserted successfully." << endl;
-            mtx.unlock();
+            LogLine(LOG_DEBUG, "document inserted").field("collection", collectionName).field("id", doc->getId());
             return operationState::SUCCESS;
         }
+        catch (const DeadlineExceeded&)
+        {
+            LogLine(LOG_WARN, "insert timed out").field("collection", collectionName);
+            return operationState::TIMED_OUT;
+        }
         catch (const exception& e) 
         {
-            cerr << "Error inserting document: " << e.what() << endl;
-            mtx.unlock();
+            LogLine(LOG_ERROR, "insert failed").field("collection", collectionName).field("error", e.what());
             return operationState::FAILED;
         }
     }
     
+    // Accepts a JSON array of documents or NDJSON, one document per line.
+    InsertManyResult insertMany(const string& collectionName, const string& documentsText)
+    {
+        string cleanText = removeQuotes(documentsText);
+        size_t first = cleanText.find_first_not_of(" \t\r\n");
+        if (first != string::npos && cleanText[first] == '[')
+        {
+            try
+            {
+                return insertDocuments(collectionName, json::parse(cleanText));
+            }
+            catch (const json::parse_error& e)
+            {
+                InsertManyResult result;
+                result.errors.push_back(make_pair(size_t(0), string(e.what())));
+                LogLine(LOG_ERROR, "insert failed").field("collection", collectionName).field("error", e.what());
+                return result;
+            }
+        }
+
+        InsertManyResult result;
+        myVector<DocumentPtr> docs;
+        myVector<size_t> positions;
+        istringstream lines(cleanText);
+        string line;
+        size_t position = 0;
+        while (getline(lines, line))
+        {
+            if (line.find_first_not_of(" \t\r") == string::npos)
+            {
+                continue;
+            }
+            try
+            {
+                prepareDocument(json::parse(line), position, docs, positions, result);
+            }
+            catch (const json::parse_error& e)
+            {
+                result.errors.push_back(make_pair(position, string(e.what())));
+            }
+            position++;
+        }
+        insertPrepared(collectionName, docs, positions, result);
+        return result;
+    }
+
+    // Takes the array by value so that a parsed array hands its documents over without copies.
+    InsertManyResult insertDocuments(const string& collectionName, json documents, const Deadline& deadline = Deadline())
+    {
+        InsertManyResult result;
+        if (!documents.is_array())
+        {
+            result.errors.push_back(make_pair(size_t(0), string("documents must be an array")));
+            return result;
+        }
+
+        myVector<DocumentPtr> docs;
+        myVector<size_t> positions;
+        for (size_t i = 0; i < documents.size(); i++)
+        {
+            prepareDocument(move(documents[i]), i, docs, positions, result);
+        }
+        insertPrepared(collectionName, docs, positions, result, deadline);
+        return result;
+    }
+
     operationState remove(const string& collectionName, const string& queryJson) 
     {
         string cleanJson = removeQuotes(queryJson);
         
-        mtx.lock();
         try 
         {
-            json query = json::parse(cleanJson);
-            ChainHashTable<string, Document> collection;
-            loadCollection(collectionName, collection);
+            return remove(collectionName, CompiledQuery(json::parse(cleanJson)));
+        }
+        catch (const exception& e) 
+        {
+            LogLine(LOG_ERROR, "remove failed").field("collection", collectionName).field("error", e.what());
+            return operationState::FAILED;
+        }
+    }
+
+    operationState remove(const string& collectionName, const CompiledQuery& query, const Deadline& deadline = Deadline()) 
+    {
+        try 
+        {
+            unique_lock<shared_mutex> lock;
+            shared_ptr<Collection> collection = acquireCollection(collectionName, lock);
             
+            myVector<DocumentPtr> matched;
+            matchDocuments(*collection, query, planQuery(*collection, query, FindOptions()), matched, numeric_limits<size_t>::max(), deadline);
+
             myVector<string> idsToRemove;
-            auto allDocs = collection.getAll();
-            for (size_t i = 0; i < allDocs.size(); i++)
+            for (size_t i = 0; i < matched.size(); i++)
+            {
+                idsToRemove.push_back(matched[i]->getId());
+            }
+            
+            if (idsToRemove.size() > 0)
             {
-                if (allDocs[i].second.matches(query)) 
+                uint64_t lsn = collection->remove(idsToRemove);
+                checkpointIfNeeded(*collection);
+                lock.unlock();
+
+                commit(*collection, lsn, deadline);
+            }
+            LogLine(LOG_DEBUG, "documents removed").field("collection", collectionName).field("removed", idsToRemove.size());
+            return operationState::SUCCESS;
+        }
+        catch (const DeadlineExceeded&)
+        {
+            LogLine(LOG_WARN, "remove timed out").field("collection", collectionName);
+            return operationState::TIMED_OUT;
+        }
+        catch (const exception& e) 
+        {
+            LogLine(LOG_ERROR, "remove failed").field("collection", collectionName).field("error", e.what());
+            return operationState::FAILED;
+        }
+    }
+    
+    operationState update(const string& collectionName, const string& queryJson, const string& updateJson, bool upsert = false) 
+    {
+        try 
+        {
+            UpdateResult result;
+            return update(collectionName, CompiledQuery(json::parse(removeQuotes(queryJson))), 
+                CompiledUpdate(json::parse(removeQuotes(updateJson))), upsert, result);
+        }
+        catch (const exception& e) 
+        {
+            LogLine(LOG_ERROR, "update failed").field("collection", collectionName).field("error", e.what());
+            return operationState::FAILED;
+        }
+    }
+
+    // Every matching document is rewritten under the collection lock with its _id kept; a document the
+    // update does not change is not written. The new images are computed before anything is logged, so
+    // an operator that fails on one document leaves the whole collection untouched.
+    operationState update(const string& collectionName, const CompiledQuery& query, const CompiledUpdate& change, bool upsert, UpdateResult& result,
+                          const Deadline& deadline = Deadline()) 
+    {
+        try 
+        {
+            unique_lock<shared_mutex> lock;
+            shared_ptr<Collection> collection = acquireCollection(collectionName, lock);
+            
+            myVector<DocumentPtr> matched;
+            matchDocuments(*collection, query, planQuery(*collection, query, FindOptions()), matched, numeric_limits<size_t>::max(), deadline);
+            result.matched = matched.size();
+
+            myVector<DocumentPtr> updated;
+            for (size_t i = 0; i < matched.size(); i++)
+            {
+                deadline.poll(i + 1);
+                json data = change.apply(matched[i]->getData());
+                if (data != matched[i]->getData())
                 {
-                    idsToRemove.push_back(allDocs[i].first);
+                    updated.push_back(make_shared<const Document>(move(data), matched[i]->getId()));
                 }
             }
-            
-            for (size_t i = 0; i < idsToRemove.size(); i++) 
+
+            if (matched.size() == 0 && upsert)
             {
-                collection.remove(idsToRemove[i]);
+                updated.push_back(make_shared<const Document>(change.upsertDocument(query.getSource())));
+                result.upsertedId = updated[0]->getId();
             }
+            result.modified = result.upsertedId.empty() ? updated.size() : 0;
             
-            saveCollection(collectionName, collection);
-            cout << "Removed " << idsToRemove.size() << " document(s)." << endl;
-            mtx.unlock();
+            if (updated.size() > 0)
+            {
+                uint64_t lsn = collection->insertMany(updated);
+                checkpointIfNeeded(*collection);
+                lock.unlock();
+
+                commit(*collection, lsn, deadline);
+                enforceMemoryBudget(collectionName);
+            }
+
+            LogLine(LOG_DEBUG, "documents updated").field("collection", collectionName).field("matched", result.matched)
+                .field("modified", result.modified).field("upserted", result.upsertedId);
             return operationState::SUCCESS;
         }
+        catch (const DeadlineExceeded&)
+        {
+            LogLine(LOG_WARN, "update timed out").field("collection", collectionName);
+            return operationState::TIMED_OUT;
+        }
         catch (const exception& e) 
         {
-            cerr << "Error removing documents: " << e.what() << endl;
-            mtx.unlock();
+            LogLine(LOG_ERROR, "update failed").field("collection", collectionName).field("error", e.what());
             return operationState::FAILED;
         }
     }
     
-    myVector<Document> find(const string& collectionName, const string& queryJson) 
+    myVector<Document> find(const string& collectionName, const string& queryJson, const string& optionsJson = "") 
     {
         string cleanJson = removeQuotes(queryJson);
+        myVector<Document> results;
 
         try 
         {
-            json query = json::parse(cleanJson);
-            ChainHashTable<string, Document> collection;
-            loadCollection(collectionName, collection);
-            
-            myVector<Document> results;
-            auto allDocs = collection.getAll();
-            for (size_t i = 0; i < allDocs.size(); i++) 
+            FindOptions findOptions;
+            if (!optionsJson.empty())
+            {
+                findOptions = parseFindOptions(json::parse(removeQuotes(optionsJson)));
+            }
+
+            myVector<DocumentPtr> matched = findDocuments(collectionName, CompiledQuery(json::parse(cleanJson)), findOptions);
+            for (size_t i = 0; i < matched.size(); i++)
             {
-                if (allDocs[i].second.matches(query)) 
+                results.push_back(*matched[i]);
+            }
+        }
+        catch (const exception& e) 
+        {
+            LogLine(LOG_ERROR, "find failed").field("collection", collectionName).field("error", e.what());
+        }
+        return results;
+    }
+
+    // Shares the stored documents instead of copying them; callers that only serialize the results
+    // (the server) should prefer this over find. Projected results are new documents. Unlike other
+    // errors, DeadlineExceeded is thrown to the caller: an empty result would look like a valid answer.
+    myVector<DocumentPtr> findDocuments(const string& collectionName, const CompiledQuery& query, const FindOptions& findOptions = FindOptions(),
+                                        const Deadline& deadline = Deadline()) 
+    {
+        vector<string> restIds;
+        return findDocuments(collectionName, query, findOptions, numeric_limits<size_t>::max(), restIds, deadline);
+    }
+
+    // The first batchSize results as documents and the ids of the rest, in order, for a cursor to read
+    // back later with fetchDocuments. Without a sort, matches past the first batch are never decoded
+    // and cost only their ids; a sort still decodes every match to order it.
+    myVector<DocumentPtr> findDocuments(const string& collectionName, const CompiledQuery& query, const FindOptions& findOptions, size_t batchSize,
+                                        vector<string>& restIds, const Deadline& deadline = Deadline()) 
+    {
+        myVector<DocumentPtr> results;
+
+        try 
+        {
+            shared_lock<shared_mutex> lock;
+            shared_ptr<Collection> collection = acquireCollection(collectionName, lock);
+
+            size_t first = numeric_limits<size_t>::max();
+            if (findOptions.skip < first - batchSize)
+            {
+                first = findOptions.skip + batchSize;
+            }
+            myVector<DocumentPtr> matched;
+            vector<string> overflowIds;
+            selectDocuments(*collection, query, findOptions, planQuery(*collection, query, findOptions), matched, deadline, nullptr,
+                            first == numeric_limits<size_t>::max() ? nullptr : &overflowIds, first);
+            lock.unlock();
+
+            bool projected = !findOptions.projection.empty();
+            for (size_t i = findOptions.skip; i < matched.size(); i++)
+            {
+                if (i - findOptions.skip >= batchSize)
+                {
+                    restIds.push_back(matched[i]->getId());
+                }
+                else if (projected)
                 {
-                    results.push_back(allDocs[i].second);
+                    results.push_back(make_shared<const Document>(applyProjection(matched[i]->getData(), findOptions), matched[i]->getId()));
                 }
+                else
+                {
+                    results.push_back(matched[i]);
+                }
+            }
+            for (string& id : overflowIds)
+            {
+                restIds.push_back(move(id));
+            }
+            MetricsRegistry::global().documentsReturned.add(results.size() + restIds.size());
+        }
+        catch (const DeadlineExceeded&)
+        {
+            LogLine(LOG_WARN, "find timed out").field("collection", collectionName);
+            throw;
+        }
+        catch (const exception& e) 
+        {
+            LogLine(LOG_ERROR, "find failed").field("collection", collectionName).field("error", e.what());
+        }
+        return results;
+    }
+
+    // Reads the documents with these ids as findDocuments returns them, skipping ids that are no longer
+    // stored or no longer match the query.
+    void fetchDocuments(const string& collectionName, const vector<string>& ids, const CompiledQuery& query, const FindOptions& findOptions,
+                        vector<DocumentPtr>& results)
+    {
+        shared_lock<shared_mutex> lock;
+        shared_ptr<Collection> collection = acquireCollection(collectionName, lock);
+        for (const string& id : ids)
+        {
+            DocumentPtr doc;
+            if (!collection->matchId(id, query, doc))
+            {
+                continue;
+            }
+            if (findOptions.projection.empty())
+            {
+                results.push_back(doc);
+            }
+            else
+            {
+                results.push_back(make_shared<const Document>(applyProjection(doc->getData(), findOptions), doc->getId()));
+            }
+        }
+    }
+
+    json explain(const string& collectionName, const string& queryJson, const string& optionsJson = "") 
+    {
+        try 
+        {
+            FindOptions findOptions;
+            if (!optionsJson.empty())
+            {
+                findOptions = parseFindOptions(json::parse(removeQuotes(optionsJson)));
+            }
+            return explain(collectionName, CompiledQuery(json::parse(removeQuotes(queryJson))), findOptions);
+        }
+        catch (const exception& e) 
+        {
+            LogLine(LOG_ERROR, "explain failed").field("collection", collectionName).field("error", e.what());
+            return json::object();
+        }
+    }
+
+    // Runs the query like findDocuments and reports how: the plan, whether it came from the cache,
+    // the documents it was expected to examine and actually examined, and the time of each stage.
+    // Errors other than DeadlineExceeded are thrown to the caller as well.
+    json explain(const string& collectionName, const CompiledQuery& query, const FindOptions& findOptions = FindOptions(),
+                 const Deadline& deadline = Deadline()) 
+    {
+        auto started = chrono::steady_clock::now();
+        auto stageStart = started;
+        ExecutionStats stats;
+
+        shared_lock<shared_mutex> lock;
+        shared_ptr<Collection> collection = acquireCollection(collectionName, lock);
+        QueryPlan plan = planQuery(*collection, query, findOptions);
+        markStage(&stats, "plan", stageStart);
+
+        myVector<DocumentPtr> matched;
+        selectDocuments(*collection, query, findOptions, plan, matched, deadline, &stats);
+        lock.unlock();
+
+        size_t returned = 0;
+        for (size_t i = findOptions.skip; i < matched.size(); i++)
+        {
+            if (!findOptions.projection.empty())
+            {
+                applyProjection(matched[i]->getData(), findOptions);
             }
-            return results;
+            returned++;
+        }
+        if (!findOptions.projection.empty())
+        {
+            markStage(&stats, "project", stageStart);
+        }
+
+        json stages = json::array();
+        for (const auto& stage : stats.stages)
+        {
+            stages.push_back({{"stage", stage.first}, {"micros", stage.second}});
+        }
+
+        return {
+            {"collection", collectionName},
+            {"shape", queryShape(query.getSource(), findOptions)},
+            {"plan", {
+                {"access", accessPathName(plan.access)},
+                {"field", plan.field},
+                {"indexOrder", plan.indexOrder},
+                {"cached", plan.cached}
+            }},
+            {"access", accessPathName(stats.access)},
+            {"estimatedDocuments", plan.estimate},
+            {"documentsExamined", stats.examined},
+            {"documentsReturned", returned},
+            {"stages", stages},
+            {"totalMicros", chrono::duration<double, micro>(chrono::steady_clock::now() - started).count()}
+        };
+    }
+
+    myVector<json> aggregate(const string& collectionName, const string& pipelineJson) 
+    {
+        string cleanJson = removeQuotes(pipelineJson);
+
+        try 
+        {
+            return aggregate(collectionName, AggregationPipeline(json::parse(cleanJson)));
         }
         catch (const exception& e) 
         {
-            cerr << "Error finding documents: " << e.what() << endl;
+            LogLine(LOG_ERROR, "aggregate failed").field("collection", collectionName).field("error", e.what());
+            return myVector<json>();
         }
     }
+
+    // Throws DeadlineExceeded like findDocuments.
+    myVector<json> aggregate(const string& collectionName, const AggregationPipeline& pipeline, const Deadline& deadline = Deadline()) 
+    {
+        myVector<json> results;
+
+        try 
+        {
+            myVector<DocumentPtr> matched = findDocuments(collectionName, pipeline.getQuery(), pipeline.getFindOptions(), deadline);
+
+            vector<const json*> rows;
+            rows.reserve(matched.size());
+            for (size_t i = 0; i < matched.size(); i++)
+            {
+                rows.push_back(&matched[i]->getData());
+            }
+
+            AggregationSettings settings;
+            settings.threads = options.scanThreads;
+            settings.chunkSize = options.scanChunkSize;
+            settings.parallelThreshold = options.parallelScanThreshold;
+            settings.deadline = deadline;
+
+            vector<json> output = pipeline.run(move(rows), settings);
+            for (json& row : output)
+            {
+                results.push_back(move(row));
+            }
+        }
+        catch (const DeadlineExceeded&)
+        {
+            throw;
+        }
+        catch (const exception& e) 
+        {
+            LogLine(LOG_ERROR, "aggregate failed").field("collection", collectionName).field("error", e.what());
+        }
+        return results;
+    }
+
+    operationState createIndex(const string& collectionName, const string& field, indexType type = INDEX_HASH)
+    {
+        try
+        {
+            unique_lock<shared_mutex> lock;
+            shared_ptr<Collection> collection = acquireCollection(collectionName, lock);
+            if (!collection->createIndex(field, type))
+            {
+                LogLine(LOG_WARN, "index already exists").field("collection", collectionName).field("field", field);
+                return operationState::FAILED;
+            }
+
+            LogLine(LOG_INFO, "index created").field("collection", collectionName).field("field", field);
+            return operationState::SUCCESS;
+        }
+        catch (const exception& e)
+        {
+            LogLine(LOG_ERROR, "create index failed").field("collection", collectionName).field("error", e.what());
+            return operationState::FAILED;
+        }
+    }
+
+    void flush(const string& collectionName)
+    {
+        shared_ptr<Collection> collection = findLoadedCollection(collectionName);
+        if (collection)
+        {
+            saveIfDirty(*collection);
+        }
+    }
+
+    void flushAll()
+    {
+        myVector<shared_ptr<Collection>> snapshot = loadedCollections();
+        for (size_t i = 0; i < snapshot.size(); i++)
+        {
+            saveIfDirty(*snapshot[i]);
+        }
+    }
+
+    void evict(const string& collectionName)
+    {
+        shared_ptr<Collection> collection = findLoadedCollection(collectionName);
+        if (collection)
+        {
+            evictCollection(collection, true);
+        }
+    }
+
+    size_t getMemoryBytes()
+    {
+        myVector<shared_ptr<Collection>> snapshot = loadedCollections();
+        size_t total = 0;
+        for (size_t i = 0; i < snapshot.size(); i++)
+        {
+            total += snapshot[i]->getMemoryBytes();
+        }
+        return total;
+    }
     
 
 private:
-    void loadCollection(const string& collectionName, ChainHashTable<string, Document>& collection) 
+    shared_ptr<Collection> findLoadedCollection(const string& collectionName)
+    {
+        shared_lock<shared_mutex> catalogLock(catalogMutex);
+        return collections.contains(collectionName) ? collections.search(collectionName) : nullptr;
+    }
+
+    myVector<shared_ptr<Collection>> loadedCollections()
+    {
+        shared_lock<shared_mutex> catalogLock(catalogMutex);
+        myVector<shared_ptr<Collection>> snapshot;
+        for (size_t i = 0; i < collectionNames.size(); i++)
+        {
+            snapshot.push_back(collections.search(collectionNames[i]));
+        }
+        return snapshot;
+    }
+
+    shared_ptr<Collection> getCollection(const string& collectionName)
+    {
+        shared_ptr<Collection> collection = findLoadedCollection(collectionName);
+        bool created = false;
+
+        if (!collection)
+        {
+            unique_lock<shared_mutex> catalogLock(catalogMutex);
+            if (collections.contains(collectionName))
+            {
+                collection = collections.search(collectionName);
+            }
+            else
+            {
+                collection = make_shared<Collection>(collectionName, basePath, options.groupCommitDelayMicros);
+                collections.insert(collectionName, collection);
+                collectionNames.push_back(collectionName);
+                created = true;
+            }
+        }
+
+        collection->ensureLoaded();
+        collection->touch();
+
+        if (created)
+        {
+            enforceMemoryBudget(collectionName);
+        }
+        return collection;
+    }
+
+    // Returns the collection with its lock held in the requested mode. Retries when the collection
+    // was evicted between the catalog lookup and the lock acquisition. Time spent waiting for the lock
+    // is counted in the metrics.
+    template <typename LockType>
+    shared_ptr<Collection> acquireCollection(const string& collectionName, LockType& lock)
+    {
+        MetricsRegistry& metrics = MetricsRegistry::global();
+        while (true)
+        {
+            shared_ptr<Collection> collection = getCollection(collectionName);
+            auto waitStart = chrono::steady_clock::now();
+            LockType acquired(collection->getMutex());
+            metrics.lockAcquisitions.add();
+            metrics.lockWaitMicros.add(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - waitStart).count());
+            if (!collection->isEvicted())
+            {
+                lock = move(acquired);
+                return collection;
+            }
+        }
+    }
+
+    // The cached plan for the query's shape, or a new one that is then cached.
+    QueryPlan planQuery(const Collection& collection, const CompiledQuery& query, const FindOptions& findOptions)
+    {
+        MetricsRegistry& metrics = MetricsRegistry::global();
+        string shape = queryShape(query.getSource(), findOptions);
+        QueryPlan plan;
+        if (collection.getPlanCache().lookup(shape, collection.size(), plan))
+        {
+            metrics.planCacheHits.add();
+            return plan;
+        }
+
+        metrics.planCacheMisses.add();
+        plan = collection.planAccess(query.getSource());
+        plan.indexOrder = findOptions.sort.size() == 1 && indexOrderApplies(collection, query.getSource(), findOptions.sort[0]);
+        collection.getPlanCache().store(shape, plan);
+        return plan;
+    }
+
+    // Records the time since start as one stage of an explained query and restarts the clock.
+    static void markStage(ExecutionStats* stats, const char* stage, chrono::steady_clock::time_point& start)
+    {
+        if (stats)
+        {
+            auto now = chrono::steady_clock::now();
+            stats->stages.push_back(make_pair(string(stage), chrono::duration<double, micro>(now - start).count()));
+            start = now;
+        }
+    }
+
+    // Collects up to limit matches in no particular order, stopping the scan once limit is reached.
+    // Every scan polls the deadline and throws DeadlineExceeded when it passes. With overflowIds, only
+    // the first materializeLimit matches become documents; the ids of the later ones go to overflowIds
+    // and their records are never decoded.
+    void matchDocuments(const Collection& collection, const CompiledQuery& query, const QueryPlan& plan, myVector<DocumentPtr>& results,
+                        size_t limit = numeric_limits<size_t>::max(), const Deadline& deadline = Deadline(), ExecutionStats* stats = nullptr,
+                        vector<string>* overflowIds = nullptr, size_t materializeLimit = numeric_limits<size_t>::max())
     {
-        string filePath = getCollectionPath(collectionName);
+        deadline.check();
+        Counter& scanned = MetricsRegistry::global().documentsScanned;
+        auto found = [&]()
+        {
+            return results.size() + (overflowIds ? overflowIds->size() : 0);
+        };
+        auto spilling = [&]()
+        {
+            return overflowIds && results.size() >= materializeLimit;
+        };
 
-        if (!filesystem::exists(filePath)) 
+        myVector<string> candidateIds;
+        if (collection.fetchCandidates(plan, query.getSource(), candidateIds))
         {
+            size_t i = 0;
+            for (; i < candidateIds.size() && found() < limit; i++)
+            {
+                deadline.poll(i + 1);
+                DocumentPtr doc;
+                if (spilling())
+                {
+                    if (collection.matchId(candidateIds[i], query))
+                    {
+                        overflowIds->push_back(candidateIds[i]);
+                    }
+                }
+                else if (collection.matchId(candidateIds[i], query, doc))
+                {
+                    results.push_back(doc);
+                }
+            }
+            scanned.add(i);
+            if (stats)
+            {
+                stats->access = plan.access;
+                stats->examined += i;
+            }
             return;
         }
-        
-        ifstream file(filePath);
-        if (!file.is_open()) 
+
+        // Documents written since the last checkpoint come first, then the records of the mapped segment.
+        const vector<DocumentPtr>& resident = collection.getResident();
+        size_t residentCount = resident.size();
+        size_t count = residentCount + collection.segmentSize();
+        auto matchAt = [&](size_t i, DocumentPtr& doc)
+        {
+            if (i < residentCount)
+            {
+                doc = resident[i];
+                return doc->matches(query);
+            }
+            return collection.matchSegment(i - residentCount, query, doc);
+        };
+        auto matchesAt = [&](size_t i)
         {
-            throw runtime_error("Cannot open collection file: " + collectionName);
+            return i < residentCount ? resident[i]->matches(query) : collection.segmentMatches(i - residentCount, query);
+        };
+        auto idAt = [&](size_t i)
+        {
+            return i < residentCount ? resident[i]->getId() : collection.segmentId(i - residentCount);
+        };
+        if (stats)
+        {
+            stats->access = ACCESS_COLLECTION_SCAN;
         }
-        
-        json collectionData;
-        file >> collectionData;
-        file.close();
-        
-        for (auto& [key, value] : collectionData.items()) 
+
+        if (count < options.parallelScanThreshold || options.scanThreads <= 1)
         {
-            Document doc(value);
-            collection.insert(key, doc);
+            size_t i = 0;
+            for (; i < count && found() < limit; i++)
+            {
+                deadline.poll(i + 1);
+                DocumentPtr doc;
+                if (spilling())
+                {
+                    if (matchesAt(i))
+                    {
+                        overflowIds->push_back(idAt(i));
+                    }
+                }
+                else if (matchAt(i, doc))
+                {
+                    results.push_back(doc);
+                }
+            }
+            scanned.add(i);
+            if (stats)
+            {
+                stats->examined += i;
+            }
+            return;
+        }
+
+        // Chunks keep documents, or only positions when the matches past the first few stay encoded.
+        size_t chunkSize = max<size_t>(options.scanChunkSize, 1);
+        vector<vector<DocumentPtr>> chunkMatches((count + chunkSize - 1) / chunkSize);
+        vector<vector<size_t>> chunkPositions(chunkMatches.size());
+        atomic<size_t> matchedCount(0);
+        atomic<size_t> examined(0);
+
+        parallelFor(count, chunkSize, options.scanThreads, [&](size_t begin, size_t end, size_t chunk)
+        {
+            size_t i = begin;
+            for (; i < end && matchedCount.load(memory_order_relaxed) < limit; i++)
+            {
+                deadline.poll(i - begin);
+                DocumentPtr doc;
+                if (overflowIds ? matchesAt(i) : matchAt(i, doc))
+                {
+                    if (overflowIds)
+                    {
+                        chunkPositions[chunk].push_back(i);
+                    }
+                    else
+                    {
+                        chunkMatches[chunk].push_back(doc);
+                    }
+                    matchedCount.fetch_add(1, memory_order_relaxed);
+                }
+            }
+            scanned.add(i - begin);
+            examined.fetch_add(i - begin, memory_order_relaxed);
+        });
+        if (stats)
+        {
+            stats->examined += examined.load();
+        }
+
+        for (size_t chunk = 0; chunk < chunkMatches.size(); chunk++)
+        {
+            for (size_t i = 0; i < chunkMatches[chunk].size() && found() < limit; i++)
+            {
+                results.push_back(chunkMatches[chunk][i]);
+            }
+            for (size_t i = 0; i < chunkPositions[chunk].size() && found() < limit; i++)
+            {
+                size_t position = chunkPositions[chunk][i];
+                DocumentPtr doc;
+                if (spilling())
+                {
+                    overflowIds->push_back(idAt(position));
+                }
+                else if (matchAt(position, doc))
+                {
+                    results.push_back(doc);
+                }
+            }
         }
     }
-    
-    void saveCollection(const string& collectionName, ChainHashTable<string, Document>& collection) 
+
+    // Matches in the requested order, the first skip + limit of them when a limit is set.
+    // Without a sort, overflowIds and materializeLimit are passed on to matchDocuments.
+    void selectDocuments(const Collection& collection, const CompiledQuery& query, const FindOptions& findOptions, const QueryPlan& plan,
+                         myVector<DocumentPtr>& results, const Deadline& deadline = Deadline(), ExecutionStats* stats = nullptr,
+                         vector<string>* overflowIds = nullptr, size_t materializeLimit = numeric_limits<size_t>::max())
     {
-        string filePath = getCollectionPath(collectionName);
-        
-        json collectionData;
-        auto allDocs = collection.getAll();
+        auto stageStart = chrono::steady_clock::now();
+        size_t needed = numeric_limits<size_t>::max();
+        if (findOptions.limit > 0 && findOptions.skip < needed - findOptions.limit)
+        {
+            needed = findOptions.skip + findOptions.limit;
+        }
 
-        for (size_t i = 0; i < allDocs.size(); i++)
+        if (findOptions.sort.empty())
         {
-            collectionData[allDocs[i].first] = allDocs[i].second.getData();
+            matchDocuments(collection, query, plan, results, needed, deadline, stats, overflowIds, materializeLimit);
+            markStage(stats, "match", stageStart);
+            return;
+        }
+
+        if (plan.indexOrder && matchInIndexOrder(collection, query, findOptions.sort[0], needed, results, deadline, stats))
+        {
+            markStage(stats, "indexOrderMatch", stageStart);
+            return;
+        }
+
+        myVector<DocumentPtr> matched;
+        matchDocuments(collection, query, plan, matched, numeric_limits<size_t>::max(), deadline, stats);
+        deadline.check();
+        markStage(stats, "match", stageStart);
+
+        auto before = [&](const DocumentPtr& a, const DocumentPtr& b)
+        {
+            return compareDocuments(a->getData(), b->getData(), findOptions.sort) < 0;
+        };
+
+        vector<DocumentPtr> ordered;
+        for (size_t i = 0; i < matched.size(); i++)
+        {
+            ordered.push_back(matched[i]);
+        }
+        keepFirstSorted(ordered, needed, before);
+
+        for (const DocumentPtr& doc : ordered)
+        {
+            results.push_back(doc);
+        }
+        markStage(stats, "sort", stageStart);
+    }
+
+    // A single-key sort can be read from an ordered index on that field only when the query has an
+    // operator condition on the field: documents without it are not in the index but would sort first
+    // as nulls, and an equality condition is better answered by the other index paths.
+    static bool indexOrderApplies(const Collection& collection, const json& source, const SortKey& key)
+    {
+        if (!source.is_object() || source.contains("$or") || !source.contains(key.field))
+        {
+            return false;
+        }
+        const json& condition = source[key.field];
+        if (!condition.is_object() || condition.contains("$eq") || condition.contains("$in"))
+        {
+            return false;
+        }
+        return collection.hasOrderedIndex(key.field);
+    }
+
+    // Serves a single-key sort from the ordered index on that field, so nothing is sorted and an
+    // ascending scan stops after needed matches. The plan has checked indexOrderApplies.
+    bool matchInIndexOrder(const Collection& collection, const CompiledQuery& query, const SortKey& key, size_t needed,
+                           myVector<DocumentPtr>& results, const Deadline& deadline, ExecutionStats* stats)
+    {
+        const json& source = query.getSource();
+        Counter& scanned = MetricsRegistry::global().documentsScanned;
+        size_t visited = 0;
+        auto visit = [&](const string& id)
+        {
+            deadline.poll(visited++);
+            scanned.add();
+            DocumentPtr doc;
+            if (collection.matchId(id, query, doc))
+            {
+                results.push_back(doc);
+            }
+            return results.size() < needed;
+        };
+
+        bool indexed = false;
+        if (key.direction > 0)
+        {
+            indexed = collection.scanIndexOrder(key.field, source, visit);
+        }
+        else
+        {
+            myVector<string> ids;
+            indexed = collection.scanIndexOrder(key.field, source, [&](const string& id)
+            {
+                ids.push_back(id);
+                return true;
+            });
+            for (size_t i = ids.size(); i > 0; i--)
+            {
+                if (!visit(ids[i - 1]))
+                {
+                    break;
+                }
+            }
+        }
+
+        if (stats)
+        {
+            stats->access = ACCESS_INDEX_RANGE;
+            stats->examined += visited;
+        }
+        return indexed;
+    }
+
+    void prepareDocument(json&& data, size_t position, myVector<DocumentPtr>& docs, myVector<size_t>& positions, InsertManyResult& result)
+    {
+        if (!data.is_object())
+        {
+            result.errors.push_back(make_pair(position, string("document must be an object")));
+            return;
+        }
+        try
+        {
+            docs.push_back(make_shared<const Document>(move(data)));
+            positions.push_back(position);
+        }
+        catch (const exception& e)
+        {
+            result.errors.push_back(make_pair(position, string(e.what())));
+        }
+    }
+
+    // One lock acquisition and one log write for the whole batch; if that write fails every
+    // prepared document is reported as failed. A failure after the batch was applied is reported
+    // once as a durability error.
+    void insertPrepared(const string& collectionName, const myVector<DocumentPtr>& docs, const myVector<size_t>& positions, InsertManyResult& result,
+                        const Deadline& deadline = Deadline())
+    {
+        if (docs.size() > 0)
+        {
+            try
+            {
+                unique_lock<shared_mutex> lock;
+                shared_ptr<Collection> collection = acquireCollection(collectionName, lock);
+                uint64_t lsn = collection->insertMany(docs);
+                result.inserted = docs.size();
+                checkpointIfNeeded(*collection);
+                lock.unlock();
+
+                commit(*collection, lsn, deadline);
+                enforceMemoryBudget(collectionName);
+            }
+            catch (const DeadlineExceeded&)
+            {
+                result.timedOut = true;
+            }
+            catch (const exception& e)
+            {
+                if (result.inserted > 0)
+                {
+                    result.durabilityError = e.what();
+                    LogLine(LOG_ERROR, "inserted documents not durable").field("collection", collectionName).field("error", e.what());
+                    return;
+                }
+                for (size_t i = 0; i < positions.size(); i++)
+                {
+                    result.errors.push_back(make_pair(positions[i], string(e.what())));
+                }
+            }
+        }
+
+        LogLine(LOG_DEBUG, "documents inserted").field("collection", collectionName).field("inserted", result.inserted).field("failed", result.errors.size());
+    }
+
+    void checkpointIfNeeded(Collection& collection)
+    {
+        if (options.flush == FLUSH_ON_WRITE ||
+            (options.flush == FLUSH_BATCHED && (collection.getPendingWrites() >= options.flushEveryWrites ||
+                                                collection.getWalBytes() >= options.checkpointWalBytes)))
+        {
+            collection.save();
+        }
+    }
+
+    void commit(Collection& collection, uint64_t lsn, const Deadline& deadline = Deadline())
+    {
+        if (options.walSync == WAL_SYNC_COMMIT)
+        {
+            collection.waitDurable(lsn, deadline);
+        }
+    }
+
+    void saveIfDirty(Collection& collection)
+    {
+        unique_lock<shared_mutex> lock(collection.getMutex());
+        if (!collection.isEvicted() && collection.isDirty())
+        {
+            collection.save();
+        }
+    }
+
+    // Checkpoints the collection and drops it from the cache. With wait == false a collection that is
+    // in use is skipped instead of blocking, which keeps budget enforcement off the hot path.
+    bool evictCollection(const shared_ptr<Collection>& collection, bool wait)
+    {
+        unique_lock<shared_mutex> lock(collection->getMutex(), defer_lock);
+        if (wait)
+        {
+            lock.lock();
+        }
+        else if (!lock.try_lock())
+        {
+            return false;
+        }
+
+        if (collection->isEvicted())
+        {
+            return true;
+        }
+        if (collection->isDirty())
+        {
+            collection->save();
+        }
+        collection->markEvicted();
+
+        unique_lock<shared_mutex> catalogLock(catalogMutex);
+        const string& collectionName = collection->getName();
+        if (collections.contains(collectionName) && collections.search(collectionName) == collection)
+        {
+            collections.remove(collectionName);
+        }
+
+        myVector<string> remaining;
+        for (size_t i = 0; i < collectionNames.size(); i++)
+        {
+            if (collectionNames[i] != collectionName)
+            {
+                remaining.push_back(collectionNames[i]);
+            }
+        }
+        collectionNames = remaining;
+        return true;
+    }
+
+    void enforceMemoryBudget(const string& keepCollection)
+    {
+        while (true)
+        {
+            size_t total = 0;
+            shared_ptr<Collection> victim;
+            chrono::steady_clock::time_point oldest = chrono::steady_clock::time_point::max();
+
+            myVector<shared_ptr<Collection>> snapshot = loadedCollections();
+            for (size_t i = 0; i < snapshot.size(); i++)
+            {
+                total += snapshot[i]->getMemoryBytes();
+
+                if (snapshot[i]->getName() != keepCollection && snapshot[i]->getLastAccess() < oldest)
+                {
+                    oldest = snapshot[i]->getLastAccess();
+                    victim = snapshot[i];
+                }
+            }
+
+            if (total <= options.memoryBudgetBytes || !victim || !evictCollection(victim, false))
+            {
+                return;
+            }
         }
-        
-        ofstream file(filePath);
-        file << collectionData.dump(2);
-        file.close();
     }
 };
 
@@ -0,0 +1,76 @@
+#ifndef DEADLINE_HPP
+#define DEADLINE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+using namespace std;
+
+// Scans read the clock once per this many documents; must be a power of two.
+#define DEADLINE_CHECK_INTERVAL 1024
+
+class DeadlineExceeded : public runtime_error
+{
+public:
+    DeadlineExceeded() : runtime_error("operation deadline exceeded")
+    {
+    }
+};
+
+// The point in time by which an operation must finish. A default-constructed deadline never expires
+// and costs nothing to check. Long loops poll it and give up by throwing DeadlineExceeded, so a
+// request nobody will wait for stops holding locks and cores.
+class Deadline
+{
+private:
+    chrono::steady_clock::time_point expiry;
+
+public:
+    Deadline() : expiry(chrono::steady_clock::time_point::max())
+    {
+    }
+
+    explicit Deadline(chrono::steady_clock::time_point at) : expiry(at)
+    {
+    }
+
+    static Deadline after(chrono::milliseconds timeout)
+    {
+        return Deadline(chrono::steady_clock::now() + timeout);
+    }
+
+    bool isSet() const
+    {
+        return expiry != chrono::steady_clock::time_point::max();
+    }
+
+    chrono::steady_clock::time_point getExpiry() const
+    {
+        return expiry;
+    }
+
+    bool expired() const
+    {
+        return isSet() && chrono::steady_clock::now() >= expiry;
+    }
+
+    void check() const
+    {
+        if (expired())
+        {
+            throw DeadlineExceeded();
+        }
+    }
+
+    // Checks on every DEADLINE_CHECK_INTERVAL-th iteration of a loop, the first one included.
+    void poll(size_t iteration) const
+    {
+        if ((iteration & (DEADLINE_CHECK_INTERVAL - 1)) == 0)
+        {
+            check();
+        }
+    }
+};
+
+#endif
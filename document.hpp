@@ -6,11 +6,11 @@
 #include <string>
 #include <fstream>
 #include <memory>
-#include <ctime>
 
 #include "QueryEvaluator.hpp"
-
-using nlohmann::json;
+#include "compiledQuery.hpp"
+#include "documentId.hpp"
+#include "poolAllocator.hpp"
 
 class Document
 {
@@ -27,15 +27,22 @@ public:
     
     Document(const json& jsonData) : data(jsonData) 
     {
-        if (!jsonData.contains("_id")) 
-        {
-            id = generateId();
-            data["_id"] = id;
-        } 
-        else 
-        {
-            id = jsonData["_id"];
-        }
+        assignId();
+    }
+
+    // Takes over the parsed tree instead of copying it.
+    Document(json&& jsonData) : data(move(jsonData)) 
+    {
+        assignId();
+    }
+    
+    // Keeps the id of the source document even when data no longer carries _id (projections).
+    Document(const json& jsonData, const string& documentId) : data(jsonData), id(documentId) 
+    {
+    }
+
+    Document(json&& jsonData, const string& documentId) : data(move(jsonData)), id(documentId) 
+    {
     }
     
     const string& getId() const 
@@ -57,10 +64,30 @@ public:
         QueryEvaluator evaluator;
         return evaluator.evaluate(data, query);
     }
+
+    bool matches(const CompiledQuery& query) const 
+    {
+        return query.matches(data);
+    }
     
 private:
+    void assignId()
+    {
+        if (!data.contains("_id")) 
+        {
+            id = generateId();
+            data["_id"] = id;
+        } 
+        else 
+        {
+            id = data["_id"];
+        }
+    }
+
     string generateId() 
     {
-        return "doc_" + to_string(time(nullptr));
+        return DocumentId::generate().toString();
     }
-};
\ No newline at end of file
+};
+
+using DocumentPtr = shared_ptr<const Document>;
@@ -0,0 +1,212 @@
+#ifndef DOCUMENT_ID_HPP
+#define DOCUMENT_ID_HPP
+
+#include <string>
+#include <array>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <stdexcept>
+
+using namespace std;
+
+#define DOCUMENT_ID_BYTES 12
+#define DOCUMENT_ID_THREAD_SLOTS 65536
+
+// Generated document id: 48-bit unix milliseconds, 16-bit node id, 16-bit thread slot and a 16-bit
+// per-thread sequence, stored big-endian so that the bytes, the hex text and the creation time all sort
+// the same way. Every thread counts on its own, so generating an id takes no lock.
+// A thread that exits hands its slot, with its last timestamp and sequence, to the next thread that
+// starts, which carries on counting from there. At most DOCUMENT_ID_THREAD_SLOTS threads can generate
+// ids at the same time; one more throws instead of sharing a slot with a live thread.
+class DocumentId
+{
+private:
+    array<uint8_t, DOCUMENT_ID_BYTES> bytes;
+
+    struct SlotState
+    {
+        uint16_t slot = 0;
+        uint64_t lastMillis = 0;
+        uint16_t sequence = 0;
+    };
+
+    struct ThreadState : SlotState
+    {
+        ThreadState() : SlotState(acquireSlot())
+        {
+        }
+
+        ~ThreadState()
+        {
+            releaseSlot(*this);
+        }
+    };
+
+    struct SlotPool
+    {
+        mutex poolMutex;
+        uint32_t used = 0;
+        vector<SlotState> released;
+    };
+
+    // Never destroyed: threads may exit after static destructors have run.
+    static SlotPool& slotPool()
+    {
+        static SlotPool* pool = new SlotPool();
+        return *pool;
+    }
+
+    static atomic<uint16_t>& node()
+    {
+        static atomic<uint16_t> nodeId(static_cast<uint16_t>(random_device()()));
+        return nodeId;
+    }
+
+    static SlotState acquireSlot()
+    {
+        SlotPool& pool = slotPool();
+        lock_guard<mutex> lock(pool.poolMutex);
+        SlotState state;
+        if (!pool.released.empty())
+        {
+            state = pool.released.back();
+            pool.released.pop_back();
+        }
+        else if (pool.used < DOCUMENT_ID_THREAD_SLOTS)
+        {
+            state.slot = static_cast<uint16_t>(pool.used++);
+        }
+        else
+        {
+            throw runtime_error("more than " + to_string(DOCUMENT_ID_THREAD_SLOTS) + " threads generate document ids");
+        }
+        return state;
+    }
+
+    static void releaseSlot(const SlotState& state)
+    {
+        SlotPool& pool = slotPool();
+        lock_guard<mutex> lock(pool.poolMutex);
+        pool.released.push_back(state);
+    }
+
+    static int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        return -1;
+    }
+
+    void store(size_t offset, uint64_t value, size_t width)
+    {
+        for (size_t i = 0; i < width; i++)
+        {
+            bytes[offset + i] = static_cast<uint8_t>(value >> (8 * (width - 1 - i)));
+        }
+    }
+
+public:
+    DocumentId() : bytes{}
+    {
+    }
+
+    // Distinguishes processes that write to the same collections; random unless set at startup.
+    static void setNodeId(uint16_t nodeId)
+    {
+        node() = nodeId;
+    }
+
+    // Within a thread ids strictly increase. When the clock stalls or steps back the last timestamp is
+    // reused, and a sequence that wraps within one millisecond borrows the next one.
+    static DocumentId generate()
+    {
+        thread_local ThreadState state;
+
+        uint64_t now = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        if (now > state.lastMillis)
+        {
+            state.lastMillis = now;
+            state.sequence = 0;
+        }
+        else if (++state.sequence == 0)
+        {
+            state.lastMillis++;
+        }
+
+        DocumentId id;
+        id.store(0, state.lastMillis, 6);
+        id.store(6, node().load(memory_order_relaxed), 2);
+        id.store(8, state.slot, 2);
+        id.store(10, state.sequence, 2);
+        return id;
+    }
+
+    // Accepts exactly the 24 lowercase hex characters produced by toString.
+    static bool parse(const string& text, DocumentId& id)
+    {
+        if (text.size() != DOCUMENT_ID_BYTES * 2)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < DOCUMENT_ID_BYTES; i++)
+        {
+            int high = hexValue(text[2 * i]);
+            int low = hexValue(text[2 * i + 1]);
+            if (high < 0 || low < 0)
+            {
+                return false;
+            }
+            id.bytes[i] = static_cast<uint8_t>(high << 4 | low);
+        }
+        return true;
+    }
+
+    string toString() const
+    {
+        static const char digits[] = "0123456789abcdef";
+        string text(DOCUMENT_ID_BYTES * 2, '0');
+        for (size_t i = 0; i < DOCUMENT_ID_BYTES; i++)
+        {
+            text[2 * i] = digits[bytes[i] >> 4];
+            text[2 * i + 1] = digits[bytes[i] & 0x0F];
+        }
+        return text;
+    }
+
+    string toBinary() const
+    {
+        return string(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    }
+
+    uint64_t timestampMillis() const
+    {
+        uint64_t millis = 0;
+        for (size_t i = 0; i < 6; i++)
+        {
+            millis = millis << 8 | bytes[i];
+        }
+        return millis;
+    }
+
+    bool operator==(const DocumentId& other) const
+    {
+        return bytes == other.bytes;
+    }
+
+    bool operator<(const DocumentId& other) const
+    {
+        return bytes < other.bytes;
+    }
+};
+
+#endif
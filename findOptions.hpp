@@ -0,0 +1,207 @@
+#ifndef FIND_OPTIONS_HPP
+#define FIND_OPTIONS_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#include "jsonUtils.hpp"
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+struct SortKey
+{
+    string field;
+    int direction = 1;
+};
+
+// Result shaping for find. A limit of 0 means no limit. Projection is either inclusive
+// ({"name": 1, "age": 1}, _id kept unless {"_id": 0}) or exclusive ({"payload": 0}).
+struct FindOptions
+{
+    size_t limit = 0;
+    size_t skip = 0;
+    vector<SortKey> sort;
+    json projection = json::object();
+    bool inclusiveProjection = false;
+};
+
+inline int parseSortDirection(const string& field, const json& direction)
+{
+    if (!direction.is_number() || (direction != 1 && direction != -1))
+    {
+        throw invalid_argument("sort direction for field '" + field + "' must be 1 or -1");
+    }
+    return direction.get<int>();
+}
+
+inline size_t parseCount(const json& options, const string& name)
+{
+    auto it = options.find(name);
+    if (it == options.end())
+    {
+        return 0;
+    }
+    if (!it->is_number_integer() || *it < 0)
+    {
+        throw invalid_argument("'" + name + "' must be a non-negative integer");
+    }
+    return it->get<size_t>();
+}
+
+// {"projection": {...}, "sort": {"age": -1} or [{"age": -1}, {"name": 1}], "skip": n, "limit": n}.
+// Keys of a sort object are applied in alphabetical order; use the array form to choose the order.
+inline FindOptions parseFindOptions(const json& options)
+{
+    FindOptions result;
+    if (options.is_null())
+    {
+        return result;
+    }
+    if (!options.is_object())
+    {
+        throw invalid_argument("find options must be an object");
+    }
+
+    result.limit = parseCount(options, "limit");
+    result.skip = parseCount(options, "skip");
+
+    auto sort = options.find("sort");
+    if (sort != options.end())
+    {
+        json keys = sort->is_array() ? *sort : json::array({*sort});
+        for (const auto& key : keys)
+        {
+            if (!key.is_object())
+            {
+                throw invalid_argument("sort must be an object or an array of objects");
+            }
+            for (auto it = key.begin(); it != key.end(); ++it)
+            {
+                result.sort.push_back(SortKey{it.key(), parseSortDirection(it.key(), it.value())});
+            }
+        }
+    }
+
+    auto projection = options.find("projection");
+    if (projection != options.end() && !projection->is_null())
+    {
+        if (!projection->is_object())
+        {
+            throw invalid_argument("projection must be an object");
+        }
+
+        bool includes = false;
+        bool excludes = false;
+        for (auto it = projection->begin(); it != projection->end(); ++it)
+        {
+            if (!it.value().is_number() && !it.value().is_boolean())
+            {
+                throw invalid_argument("projection value for field '" + it.key() + "' must be 0 or 1");
+            }
+            bool included = it.value().is_boolean() ? it.value().get<bool>() : it.value() != 0;
+            if (it.key() != "_id" && included)
+            {
+                includes = true;
+            }
+            else if (it.key() != "_id")
+            {
+                excludes = true;
+            }
+            result.projection[it.key()] = included;
+        }
+
+        if (includes && excludes)
+        {
+            throw invalid_argument("projection cannot mix included and excluded fields");
+        }
+        result.inclusiveProjection = includes || (!excludes && result.projection.value("_id", false));
+    }
+    return result;
+}
+
+inline json applyProjection(const json& doc, const FindOptions& options)
+{
+    if (options.inclusiveProjection)
+    {
+        json projected = json::object();
+        auto keepId = options.projection.find("_id");
+        if ((keepId == options.projection.end() || keepId->get<bool>()) && doc.contains("_id"))
+        {
+            projected["_id"] = doc["_id"];
+        }
+        for (auto it = options.projection.begin(); it != options.projection.end(); ++it)
+        {
+            auto value = doc.find(it.key());
+            if (it.value().get<bool>() && value != doc.end())
+            {
+                projected[it.key()] = *value;
+            }
+        }
+        return projected;
+    }
+
+    json projected = doc;
+    for (auto it = options.projection.begin(); it != options.projection.end(); ++it)
+    {
+        if (!it.value().get<bool>())
+        {
+            projected.erase(it.key());
+        }
+    }
+    return projected;
+}
+
+// Orders documents by the sort keys; a missing field sorts like null.
+inline int compareDocuments(const json& a, const json& b, const vector<SortKey>& keys)
+{
+    static const json missing;
+    for (const SortKey& key : keys)
+    {
+        auto left = a.find(key.field);
+        auto right = b.find(key.field);
+        int order = compareJson(left == a.end() ? missing : *left, right == b.end() ? missing : *right);
+        if (order != 0)
+        {
+            return order * key.direction;
+        }
+    }
+    return 0;
+}
+
+// Sorts items by before and keeps the first k. When k is smaller than the input a bounded max-heap
+// holding the best k so far replaces the full sort; otherwise the sort is stable.
+template <typename T, typename Less>
+void keepFirstSorted(vector<T>& items, size_t k, Less before)
+{
+    if (k >= items.size())
+    {
+        stable_sort(items.begin(), items.end(), before);
+        return;
+    }
+
+    vector<T> best;
+    best.reserve(k);
+    for (T& item : items)
+    {
+        if (best.size() < k)
+        {
+            best.push_back(move(item));
+            push_heap(best.begin(), best.end(), before);
+        }
+        else if (k > 0 && before(item, best.front()))
+        {
+            pop_heap(best.begin(), best.end(), before);
+            best.back() = move(item);
+            push_heap(best.begin(), best.end(), before);
+        }
+    }
+    sort_heap(best.begin(), best.end(), before);
+    items.swap(best);
+}
+
+#endif
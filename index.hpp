@@ -0,0 +1,146 @@
+#ifndef INDEX_HPP
+#define INDEX_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <memory>
+#include <unordered_set>
+
+#include "../../Containers/hashtable.hpp"
+#include "../../Containers/Go/vector.h"
+#include "jsonUtils.hpp"
+#include "poolAllocator.hpp"
+
+enum indexType
+{
+    INDEX_HASH,
+    INDEX_ORDERED,
+    INDEX_COLUMN
+};
+
+inline bool parseIndexType(const string& name, indexType& type)
+{
+    if (name == "hash")
+    {
+        type = INDEX_HASH;
+    }
+    else if (name == "ordered")
+    {
+        type = INDEX_ORDERED;
+    }
+    else if (name == "column")
+    {
+        type = INDEX_COLUMN;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+inline string indexTypeName(indexType type)
+{
+    return type == INDEX_ORDERED ? "ordered" : type == INDEX_COLUMN ? "column" : "hash";
+}
+
+class SecondaryIndex
+{
+protected:
+    string field;
+
+public:
+    SecondaryIndex(const string& fieldName) : field(fieldName) 
+    {
+    }
+
+    virtual ~SecondaryIndex() = default;
+
+    const string& getField() const
+    {
+        return field;
+    }
+
+    virtual indexType getType() const = 0;
+    virtual void add(const string& id, const json& doc) = 0;
+    virtual void remove(const string& id, const json& doc) = 0;
+    virtual size_t count(const json& value) const = 0;
+    virtual void lookup(const json& value, myVector<string>& ids) const = 0;
+};
+
+class HashIndex : public SecondaryIndex
+{
+private:
+    ChainHashTable<string, shared_ptr<unordered_set<string>>> postings;
+
+public:
+    HashIndex(const string& fieldName) : SecondaryIndex(fieldName) 
+    {
+    }
+
+    indexType getType() const override
+    {
+        return INDEX_HASH;
+    }
+
+    void add(const string& id, const json& doc) override
+    {
+        auto it = doc.find(field);
+        if (it == doc.end())
+        {
+            return;
+        }
+
+        string key = jsonValueKey(*it);
+        if (!postings.contains(key))
+        {
+            postings.insert(key, make_shared<unordered_set<string>>());
+        }
+        postings.search(key)->insert(id);
+    }
+
+    void remove(const string& id, const json& doc) override
+    {
+        auto it = doc.find(field);
+        if (it == doc.end())
+        {
+            return;
+        }
+
+        string key = jsonValueKey(*it);
+        if (!postings.contains(key))
+        {
+            return;
+        }
+
+        shared_ptr<unordered_set<string>> ids = postings.search(key);
+        ids->erase(id);
+        if (ids->empty())
+        {
+            postings.remove(key);
+        }
+    }
+
+    size_t count(const json& value) const override
+    {
+        string key = jsonValueKey(value);
+        return postings.contains(key) ? postings.search(key)->size() : 0;
+    }
+
+    void lookup(const json& value, myVector<string>& ids) const override
+    {
+        string key = jsonValueKey(value);
+        if (!postings.contains(key))
+        {
+            return;
+        }
+
+        for (const string& id : *postings.search(key))
+        {
+            ids.push_back(id);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef JSON_UTILS_HPP
+#define JSON_UTILS_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <cmath>
+#include <cstdint>
+
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+// Hash key of a json value that agrees with json equality, so 25 and 25.0 share a key. Arrays and
+// objects are keyed element by element, with each element's key length-prefixed, so [1] and [1.0]
+// share one too.
+inline string jsonValueKey(const json& value)
+{
+    switch (value.type())
+    {
+        case json::value_t::null:
+            return "z";
+        case json::value_t::boolean:
+            return value.get<bool>() ? "b1" : "b0";
+        case json::value_t::number_integer:
+            return "n" + to_string(value.get<int64_t>());
+        case json::value_t::number_unsigned:
+            return "n" + to_string(value.get<uint64_t>());
+        case json::value_t::number_float:
+        {
+            double number = value.get<double>();
+            if (std::trunc(number) == number && std::fabs(number) < 9.2e18)
+            {
+                return "n" + to_string(static_cast<int64_t>(number));
+            }
+            return "d" + json(number).dump();
+        }
+        case json::value_t::string:
+            return "s" + value.get_ref<const string&>();
+        case json::value_t::array:
+        {
+            string key = "a";
+            for (const json& item : value)
+            {
+                string itemKey = jsonValueKey(item);
+                key += to_string(itemKey.size()) + ':' + itemKey;
+            }
+            return key;
+        }
+        case json::value_t::object:
+        {
+            string key = "o";
+            for (auto it = value.begin(); it != value.end(); ++it)
+            {
+                string itemKey = jsonValueKey(it.value());
+                key += to_string(it.key().size()) + ':' + it.key() + to_string(itemKey.size()) + ':' + itemKey;
+            }
+            return key;
+        }
+        default:
+            return "j" + value.dump();
+    }
+}
+
+// Total order used by ordered indexes. It is exactly the order nlohmann::json's own comparison
+// operators (and therefore $gt/$lt in QueryEvaluator) use: null < boolean < number < object <
+// array < string, numbers compare by value across integer and float, everything else by value.
+inline int compareJson(const json& a, const json& b)
+{
+    if (a < b)
+    {
+        return -1;
+    }
+    if (b < a)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef LIKE_MATCHER_HPP
+#define LIKE_MATCHER_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Position of needle in haystack at or after from, string::npos if absent. Compares the first and
+// last needle byte against a whole vector of candidate positions at once and only runs memcmp on
+// positions where both agree.
+inline size_t simdFind(const string& haystack, const string& needle, size_t from)
+{
+    size_t n = haystack.size();
+    size_t m = needle.size();
+    if (from > n || m > n - from)
+    {
+        return string::npos;
+    }
+    if (m == 0)
+    {
+        return from;
+    }
+
+    const char* text = haystack.data();
+    if (m == 1)
+    {
+        const void* hit = memchr(text + from, needle[0], n - from);
+        return hit ? static_cast<const char*>(hit) - text : string::npos;
+    }
+
+    size_t i = from;
+    size_t last = n - m;
+
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i tail = _mm256_set1_epi8(needle[m - 1]);
+    for (; i + 32 <= last + 1; i += 32)
+    {
+        __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        __m256i blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i + m - 1));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst), _mm256_cmpeq_epi8(tail, blockLast))));
+        while (mask)
+        {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (memcmp(text + i + bit + 1, needle.data() + 1, m - 2) == 0)
+            {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i tail = _mm_set1_epi8(needle[m - 1]);
+    for (; i + 16 <= last + 1; i += 16)
+    {
+        __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + m - 1));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(tail, blockLast))));
+        while (mask)
+        {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (memcmp(text + i + bit + 1, needle.data() + 1, m - 2) == 0)
+            {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    if (i > last)
+    {
+        return string::npos;
+    }
+    const void* hit = memmem(text + i, n - i, needle.data(), m);
+    return hit ? static_cast<const char*>(hit) - text : string::npos;
+}
+
+// $like pattern compiled once per query. '%' matches any run of bytes, '_' exactly one byte.
+// The pattern is split on '%' into segments; the first and last segments are anchored unless the
+// pattern starts or ends with '%', middle segments are matched greedily at their leftmost
+// occurrence, which is exact for this pattern language and never backtracks.
+class LikeMatcher
+{
+private:
+    enum matchKind
+    {
+        MATCH_EXACT,
+        MATCH_ANY,
+        MATCH_PREFIX,
+        MATCH_SUFFIX,
+        MATCH_CONTAINS,
+        MATCH_GENERAL
+    };
+
+    struct Segment
+    {
+        string text;
+        bool hasWildcard = false;
+    };
+
+    matchKind kind;
+    vector<Segment> segments;
+    bool anchoredStart;
+    bool anchoredEnd;
+    size_t minLength;
+
+    static bool segmentAt(const string& text, size_t pos, const Segment& segment)
+    {
+        if (!segment.hasWildcard)
+        {
+            return text.compare(pos, segment.text.size(), segment.text) == 0;
+        }
+
+        if (pos + segment.text.size() > text.size())
+        {
+            return false;
+        }
+        for (size_t k = 0; k < segment.text.size(); k++)
+        {
+            if (segment.text[k] != '_' && segment.text[k] != text[pos + k])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static size_t findSegment(const string& text, const Segment& segment, size_t from)
+    {
+        if (!segment.hasWildcard)
+        {
+            return simdFind(text, segment.text, from);
+        }
+
+        for (size_t pos = from; pos + segment.text.size() <= text.size(); pos++)
+        {
+            if (segmentAt(text, pos, segment))
+            {
+                return pos;
+            }
+        }
+        return string::npos;
+    }
+
+    bool matchGeneral(const string& text) const
+    {
+        size_t pos = 0;
+        size_t first = 0;
+        size_t end = segments.size();
+
+        if (anchoredStart)
+        {
+            if (!segmentAt(text, 0, segments[0]))
+            {
+                return false;
+            }
+            pos = segments[0].text.size();
+            first = 1;
+        }
+
+        size_t tailStart = text.size();
+        if (anchoredEnd)
+        {
+            const Segment& lastSegment = segments[end - 1];
+            if (text.size() < pos + lastSegment.text.size() ||
+                !segmentAt(text, text.size() - lastSegment.text.size(), lastSegment))
+            {
+                return false;
+            }
+            tailStart = text.size() - lastSegment.text.size();
+            end--;
+        }
+
+        for (size_t s = first; s < end; s++)
+        {
+            size_t found = findSegment(text, segments[s], pos);
+            if (found == string::npos || found + segments[s].text.size() > tailStart)
+            {
+                return false;
+            }
+            pos = found + segments[s].text.size();
+        }
+        return true;
+    }
+
+public:
+    LikeMatcher() : kind(MATCH_EXACT), anchoredStart(true), anchoredEnd(true), minLength(0)
+    {
+    }
+
+    explicit LikeMatcher(const string& pattern)
+        : anchoredStart(pattern.empty() || pattern.front() != '%'),
+          anchoredEnd(pattern.empty() || pattern.back() != '%'), minLength(0)
+    {
+        Segment current;
+        for (char c : pattern)
+        {
+            if (c == '%')
+            {
+                if (!current.text.empty())
+                {
+                    segments.push_back(current);
+                    current = Segment();
+                }
+                continue;
+            }
+
+            current.text += c;
+            current.hasWildcard = current.hasWildcard || c == '_';
+        }
+        if (!current.text.empty() || segments.empty())
+        {
+            segments.push_back(current);
+        }
+
+        for (const Segment& segment : segments)
+        {
+            minLength += segment.text.size();
+        }
+
+        bool hasPercent = pattern.find('%') != string::npos;
+        if (!hasPercent)
+        {
+            kind = MATCH_EXACT;
+        }
+        else if (minLength == 0)
+        {
+            kind = MATCH_ANY;
+        }
+        else if (segments.size() == 1 && anchoredStart)
+        {
+            kind = MATCH_PREFIX;
+        }
+        else if (segments.size() == 1 && anchoredEnd)
+        {
+            kind = MATCH_SUFFIX;
+        }
+        else if (segments.size() == 1)
+        {
+            kind = MATCH_CONTAINS;
+        }
+        else
+        {
+            kind = MATCH_GENERAL;
+        }
+    }
+
+    bool matches(const string& text) const
+    {
+        if (text.size() < minLength)
+        {
+            return false;
+        }
+
+        switch (kind)
+        {
+            case MATCH_EXACT:
+                return text.size() == minLength && segmentAt(text, 0, segments[0]);
+            case MATCH_ANY:
+                return true;
+            case MATCH_PREFIX:
+                return segmentAt(text, 0, segments[0]);
+            case MATCH_SUFFIX:
+                return segmentAt(text, text.size() - minLength, segments[0]);
+            case MATCH_CONTAINS:
+                return findSegment(text, segments[0], 0) != string::npos;
+            default:
+                return matchGeneral(text);
+        }
+    }
+};
+
+#endif
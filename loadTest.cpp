@@ -0,0 +1,369 @@
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <vector>
+#include "../protocol.hpp"
+#include "../benchmarkReport.hpp"
+
+using namespace std;
+
+#define LOAD_COLLECTION "loadtest_items"
+#define RESPONSE_TIMEOUT_SEC 10
+#define RECEIVE_BUFFER_BYTES 65536
+#define PRELOAD_BATCH 1000
+
+struct LoadConfig
+{
+    string host = "127.0.0.1";
+    int port = 8080;
+    string databaseName = "loadtest";
+    wireFormat format = WIRE_TEXT;
+    size_t connections = 8;
+    size_t requests = 10000;
+    size_t depth = 1;
+    size_t documents = 10000;
+    string workload = "mixed";
+    string outputPath = "loadtest_results.json";
+};
+
+// One client connection that sends requests and reads responses in order.
+class LoadConnection
+{
+private:
+    int socketFd;
+    wireFormat format;
+    FrameDecoder decoder;
+    vector<char> buffer;
+
+public:
+    LoadConnection(const LoadConfig& config) : socketFd(-1), format(config.format), buffer(RECEIVE_BUFFER_BYTES)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* address = nullptr;
+        string host = config.host == "localhost" ? "127.0.0.1" : config.host;
+        if (getaddrinfo(host.c_str(), to_string(config.port).c_str(), &hints, &address) != 0)
+        {
+            throw runtime_error("Cannot resolve " + config.host);
+        }
+
+        socketFd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        bool connected = socketFd >= 0 && connect(socketFd, address->ai_addr, address->ai_addrlen) == 0;
+        freeaddrinfo(address);
+        if (!connected)
+        {
+            if (socketFd >= 0)
+            {
+                close(socketFd);
+            }
+            throw runtime_error("Cannot connect to " + config.host + ":" + to_string(config.port));
+        }
+
+        struct timeval timeout = {RESPONSE_TIMEOUT_SEC, 0};
+        setsockopt(socketFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        string welcome;
+        if (!sendAll(socketFd, config.databaseName + " " + wireFormatName(format) + "\n") || !receive(welcome))
+        {
+            close(socketFd);
+            throw runtime_error("Handshake with the server failed");
+        }
+        if (format != WIRE_TEXT)
+        {
+            decoder.setFraming(FRAMING_LENGTH);
+        }
+    }
+
+    ~LoadConnection()
+    {
+        close(socketFd);
+    }
+
+    LoadConnection(const LoadConnection&) = delete;
+    LoadConnection& operator=(const LoadConnection&) = delete;
+
+    bool send(const string& data)
+    {
+        return sendAll(socketFd, data);
+    }
+
+    bool receive(string& message)
+    {
+        while (!decoder.next(message))
+        {
+            ssize_t received = recv(socketFd, buffer.data(), buffer.size(), 0);
+            if (received < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (received <= 0)
+            {
+                return false;
+            }
+            decoder.feed(buffer.data(), static_cast<size_t>(received));
+        }
+        return true;
+    }
+
+    // Reads one response and tells whether the server reported success.
+    bool receiveStatus(bool& succeeded)
+    {
+        string message;
+        if (!receive(message))
+        {
+            return false;
+        }
+        json response = decodeMessage(message, format);
+        string status = response.value("status", "");
+        succeeded = status != "error" && status != "timeout";
+        return true;
+    }
+};
+
+// Text clients send "OP collection {argument}", binary clients the request object itself.
+string encodeRequest(const json& request, wireFormat format)
+{
+    if (format != WIRE_TEXT)
+    {
+        return encodeMessage(request, format);
+    }
+
+    string command = request.at("op").get<string>() + " " + request.at("collection").get<string>() + " ";
+    if (request.contains("document"))
+    {
+        command += request["document"].dump();
+    }
+    else if (request.contains("documents"))
+    {
+        command += request["documents"].dump();
+    }
+    else
+    {
+        command += request["query"].dump();
+        if (request.contains("options"))
+        {
+            command += " " + request["options"].dump();
+        }
+    }
+    return command + "\n";
+}
+
+json preloadedDocument(size_t i)
+{
+    return {{"_id", "load_" + to_string(i)}, {"price", static_cast<int64_t>(i % 1000)}, {"name", "item" + to_string(i)}};
+}
+
+json makeRequest(const LoadConfig& config, size_t connection, size_t sequence, mt19937& random)
+{
+    bool insert = config.workload == "insert" || (config.workload == "mixed" && random() % 10 == 0);
+    if (insert)
+    {
+        json document = {{"connection", connection}, {"sequence", sequence}, {"price", static_cast<int64_t>(random() % 1000)}};
+        return {{"op", "INSERT"}, {"collection", LOAD_COLLECTION}, {"document", document}};
+    }
+
+    size_t target = random() % max<size_t>(config.documents, 1);
+    return {{"op", "FIND"}, {"collection", LOAD_COLLECTION}, {"query", {{"_id", "load_" + to_string(target)}}}};
+}
+
+// Replaces the collection's contents with config.documents known documents for the lookups to hit.
+void preload(const LoadConfig& config)
+{
+    LoadConnection connection(config);
+    bool succeeded = false;
+    json clear = {{"op", "DELETE"}, {"collection", LOAD_COLLECTION}, {"query", json::object()}};
+    if (!connection.send(encodeRequest(clear, config.format)) || !connection.receiveStatus(succeeded))
+    {
+        throw runtime_error("Clearing " LOAD_COLLECTION " failed");
+    }
+
+    for (size_t first = 0; first < config.documents; first += PRELOAD_BATCH)
+    {
+        json documents = json::array();
+        for (size_t i = first; i < min(config.documents, first + PRELOAD_BATCH); i++)
+        {
+            documents.push_back(preloadedDocument(i));
+        }
+        json request = {{"op", "INSERTMANY"}, {"collection", LOAD_COLLECTION}, {"documents", documents}};
+        if (!connection.send(encodeRequest(request, config.format)) || !connection.receiveStatus(succeeded) || !succeeded)
+        {
+            throw runtime_error("Preloading " LOAD_COLLECTION " failed");
+        }
+    }
+}
+
+// Keeps up to config.depth requests in flight and records the latency of every response.
+void runConnection(const LoadConfig& config, size_t index, vector<double>& latencies, atomic<size_t>& errors)
+{
+    try
+    {
+        LoadConnection connection(config);
+        mt19937 random(static_cast<unsigned>(index + 1));
+        deque<chrono::steady_clock::time_point> inFlight;
+        size_t sent = 0;
+        size_t received = 0;
+        latencies.reserve(config.requests);
+
+        while (received < config.requests)
+        {
+            string batch;
+            while (sent < config.requests && inFlight.size() < config.depth)
+            {
+                batch += encodeRequest(makeRequest(config, index, sent, random), config.format);
+                inFlight.push_back(chrono::steady_clock::now());
+                sent++;
+            }
+            if (!batch.empty() && !connection.send(batch))
+            {
+                throw runtime_error("send failed");
+            }
+
+            bool succeeded = false;
+            if (!connection.receiveStatus(succeeded))
+            {
+                throw runtime_error("connection lost after " + to_string(received) + " responses");
+            }
+            latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - inFlight.front()).count());
+            inFlight.pop_front();
+            received++;
+            if (!succeeded)
+            {
+                errors++;
+            }
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Connection " << index << ": " << e.what() << endl;
+        errors += config.requests - latencies.size();
+    }
+}
+
+void printUsage()
+{
+    cout << "Usage: ./loadTest [options]" << endl;
+    cout << "  --host <host>           server host (127.0.0.1)" << endl;
+    cout << "  --port <port>           server port (8080)" << endl;
+    cout << "  --database <name>       database to load (loadtest)" << endl;
+    cout << "  --format <format>       text, cbor or msgpack (text)" << endl;
+    cout << "  --connections <n>       concurrent connections (8)" << endl;
+    cout << "  --requests <n>          requests per connection (10000)" << endl;
+    cout << "  --depth <n>             requests in flight per connection (1)" << endl;
+    cout << "  --workload <name>       insert, find or mixed: 90% find by _id, 10% insert (mixed)" << endl;
+    cout << "  --documents <n>         documents preloaded for find (10000)" << endl;
+    cout << "  --output <file>         JSON results (loadtest_results.json)" << endl;
+}
+
+bool parseArguments(int argc, char* argv[], LoadConfig& config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string option = argv[i];
+        if (option == "--help" || i + 1 >= argc)
+        {
+            return false;
+        }
+
+        string value = argv[++i];
+        if (option == "--host") config.host = value;
+        else if (option == "--port") config.port = stoi(value);
+        else if (option == "--database") config.databaseName = value;
+        else if (option == "--format")
+        {
+            if (!parseWireFormat(value, config.format))
+            {
+                return false;
+            }
+        }
+        else if (option == "--connections") config.connections = stoul(value);
+        else if (option == "--requests") config.requests = stoul(value);
+        else if (option == "--depth") config.depth = max<size_t>(stoul(value), 1);
+        else if (option == "--workload") config.workload = value;
+        else if (option == "--documents") config.documents = stoul(value);
+        else if (option == "--output") config.outputPath = value;
+        else return false;
+    }
+    return config.workload == "insert" || config.workload == "find" || config.workload == "mixed";
+}
+
+int main(int argc, char* argv[])
+{
+    LoadConfig config;
+    try
+    {
+        if (!parseArguments(argc, argv, config))
+        {
+            printUsage();
+            return 1;
+        }
+        if (config.workload != "insert")
+        {
+            cout << "Preloading " << config.documents << " documents..." << endl;
+            preload(config);
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << "Load test setup failed: " << e.what() << endl;
+        return 1;
+    }
+
+    cout << "Running " << config.workload << " with " << config.connections << " connections x " << config.requests
+         << " requests, depth " << config.depth << ", " << wireFormatName(config.format) << "..." << endl;
+
+    vector<vector<double>> latencies(config.connections);
+    atomic<size_t> errors(0);
+    vector<thread> clients;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < config.connections; i++)
+    {
+        clients.emplace_back(runConnection, cref(config), i, ref(latencies[i]), ref(errors));
+    }
+    for (thread& client : clients)
+    {
+        client.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<double> all;
+    for (const vector<double>& connectionLatencies : latencies)
+    {
+        all.insert(all.end(), connectionLatencies.begin(), connectionLatencies.end());
+    }
+    LatencySummary summary = summarizeLatencies(all);
+    double opsPerSec = seconds > 0 ? summary.count / seconds : 0;
+
+    cout << "requests\terrors\tops/sec\tp50_us\tp99_us\tp999_us\tmax_us" << endl;
+    cout << summary.count << "\t\t" << errors.load() << "\t" << static_cast<size_t>(opsPerSec) << "\t" << summary.p50 << "\t"
+         << summary.p99 << "\t" << summary.p999 << "\t" << summary.max << endl;
+
+    json result = {
+        {"workload", config.workload}, {"format", wireFormatName(config.format)}, {"connections", config.connections},
+        {"requestsPerConnection", config.requests}, {"depth", config.depth}, {"documents", config.documents},
+        {"errors", errors.load()}, {"seconds", seconds}, {"opsPerSec", opsPerSec}
+    };
+    result.update(latencyJson(summary));
+
+    BenchmarkReport report("loadTest");
+    report.add(result);
+    try
+    {
+        report.write(config.outputPath);
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    cout << "Results written to " << config.outputPath << endl;
+    return errors.load() == 0 ? 0 : 2;
+}
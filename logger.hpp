@@ -0,0 +1,493 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <cctype>
+#include <ctime>
+#include <algorithm>
+#include <stdexcept>
+#include <charconv>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "metrics.hpp"
+
+using namespace std;
+
+// Records waiting for the writer thread; a full ring drops new records instead of blocking the caller.
+#define LOG_RING_CAPACITY 8192
+// A formatted record, message and fields together; longer records are cut and end with "...".
+#define LOG_RECORD_BYTES 480
+// String fields such as request payloads are cut to this many bytes by default.
+#define DEFAULT_LOG_PAYLOAD_BYTES 200
+#define LOG_DRAIN_INTERVAL_MS 5
+
+enum logLevel
+{
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR,
+    LOG_OFF
+};
+
+inline const char* logLevelName(logLevel level)
+{
+    switch (level)
+    {
+        case LOG_DEBUG: return "DEBUG";
+        case LOG_INFO: return "INFO";
+        case LOG_WARN: return "WARN";
+        case LOG_ERROR: return "ERROR";
+        default: return "OFF";
+    }
+}
+
+inline bool parseLogLevel(const string& name, logLevel& level)
+{
+    const logLevel levels[] = {LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_OFF};
+    for (logLevel candidate : levels)
+    {
+        string candidateName = logLevelName(candidate);
+        if (name.size() == candidateName.size() && equal(name.begin(), name.end(), candidateName.begin(),
+                                                          [](char a, char b) { return toupper(a) == b; }))
+        {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct LogRecord
+{
+    int64_t timeMicros;
+    logLevel level;
+    uint32_t length;
+    char text[LOG_RECORD_BYTES];
+};
+
+// Asynchronous logger. Callers format a record on their own stack and copy it into a bounded ring
+// (Vyukov's sequence-numbered queue, one CAS per record); a background thread turns batches of
+// records into lines and writes each batch with a single write call. Nothing on the calling side
+// allocates, locks or makes a syscall.
+class Logger
+{
+private:
+    struct alignas(64) Slot
+    {
+        atomic<size_t> sequence;
+        LogRecord record;
+    };
+
+    Slot* slots;
+    alignas(64) atomic<size_t> enqueuePosition{0};
+    alignas(64) size_t dequeuePosition = 0;
+    atomic<size_t> written{0};
+    atomic<uint64_t> dropped{0};
+    uint64_t droppedReported = 0;
+    int64_t cachedSecond = -1;
+    char cachedPrefix[64];
+    string pendingOut;
+    string pendingErrors;
+
+    atomic<int> level{LOG_INFO};
+    atomic<uint32_t> sampleEvery{1};
+    atomic<size_t> payloadBytes{DEFAULT_LOG_PAYLOAD_BYTES};
+    atomic<int> fileFd{-1};
+
+    mutex drainMutex;
+    once_flag writerStarted;
+
+    Logger() : slots(new Slot[LOG_RING_CAPACITY])
+    {
+        for (size_t i = 0; i < LOG_RING_CAPACITY; i++)
+        {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    // Only the writer thread formats times; the date and seconds are formatted once per second.
+    void appendTime(string& out, int64_t micros)
+    {
+        int64_t second = micros / 1000000;
+        if (second != cachedSecond)
+        {
+            time_t seconds = static_cast<time_t>(second);
+            tm parts;
+            gmtime_r(&seconds, &parts);
+            snprintf(cachedPrefix, sizeof(cachedPrefix), "%04d-%02d-%02dT%02d:%02d:%02d.", parts.tm_year + 1900,
+                     parts.tm_mon + 1, parts.tm_mday, parts.tm_hour, parts.tm_min, parts.tm_sec);
+            cachedSecond = second;
+        }
+        out += cachedPrefix;
+        char fraction[8] = {'0', '0', '0', '0', '0', '0', 'Z', ' '};
+        for (int i = 5, value = static_cast<int>(micros % 1000000); i >= 0; i--, value /= 10)
+        {
+            fraction[i] = static_cast<char>('0' + value % 10);
+        }
+        out.append(fraction, sizeof(fraction));
+    }
+
+    static void writeAll(int fd, const string& data)
+    {
+        size_t offset = 0;
+        while (offset < data.size())
+        {
+            ssize_t count = ::write(fd, data.data() + offset, data.size() - offset);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return;
+            }
+            offset += static_cast<size_t>(count);
+        }
+    }
+
+    // Moves every published record out of the ring. Console output goes to stdout, WARN and ERROR to stderr.
+    size_t drain()
+    {
+        lock_guard<mutex> lock(drainMutex);
+        string& out = pendingOut;
+        string& errors = pendingErrors;
+        out.clear();
+        errors.clear();
+        size_t count = 0;
+        while (true)
+        {
+            Slot& slot = slots[dequeuePosition & (LOG_RING_CAPACITY - 1)];
+            if (slot.sequence.load(memory_order_acquire) != dequeuePosition + 1)
+            {
+                break;
+            }
+
+            const LogRecord& record = slot.record;
+            string& target = record.level >= LOG_WARN && fileFd.load() < 0 ? errors : out;
+            appendTime(target, record.timeMicros);
+            target += logLevelName(record.level);
+            target += ' ';
+            target.append(record.text, record.length);
+            target += '\n';
+
+            slot.sequence.store(dequeuePosition + LOG_RING_CAPACITY, memory_order_release);
+            dequeuePosition++;
+            count++;
+        }
+
+        uint64_t lost = dropped.load(memory_order_relaxed);
+        if (lost != droppedReported)
+        {
+            string& target = fileFd.load() < 0 ? errors : out;
+            appendTime(target, chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count());
+            target += "WARN log ring full records_dropped=" + to_string(lost - droppedReported) + "\n";
+            droppedReported = lost;
+        }
+
+        int fd = fileFd.load();
+        writeAll(fd >= 0 ? fd : STDOUT_FILENO, out);
+        writeAll(STDERR_FILENO, errors);
+        written.fetch_add(count, memory_order_release);
+        return count;
+    }
+
+    void startWriter()
+    {
+        call_once(writerStarted, [this]()
+        {
+            thread([this]()
+            {
+                while (true)
+                {
+                    if (drain() == 0)
+                    {
+                        this_thread::sleep_for(chrono::milliseconds(LOG_DRAIN_INTERVAL_MS));
+                    }
+                }
+            }).detach();
+            atexit([]() { Logger::global().flush(); });
+        });
+    }
+
+public:
+    // Never destroyed, like the metrics registry: threads may log while the process exits.
+    static Logger& global()
+    {
+        static Logger* logger = new Logger();
+        return *logger;
+    }
+
+    bool enabled(logLevel recordLevel) const
+    {
+        return recordLevel >= level.load(memory_order_relaxed);
+    }
+
+    // True for one call in every sampleEvery on the calling thread.
+    bool sample() const
+    {
+        thread_local uint32_t calls = 0;
+        uint32_t every = sampleEvery.load(memory_order_relaxed);
+        return every <= 1 || calls++ % every == 0;
+    }
+
+    void setLevel(logLevel newLevel)
+    {
+        level.store(newLevel);
+    }
+
+    void setSampleEvery(uint32_t every)
+    {
+        sampleEvery.store(max<uint32_t>(every, 1));
+    }
+
+    void setPayloadBytes(size_t bytes)
+    {
+        payloadBytes.store(bytes);
+    }
+
+    size_t getPayloadBytes() const
+    {
+        return payloadBytes.load(memory_order_relaxed);
+    }
+
+    uint64_t getDropped() const
+    {
+        return dropped.load();
+    }
+
+    // Appends records to the file instead of the console; an empty path goes back to the console.
+    void setFile(const string& path)
+    {
+        int fd = path.empty() ? -1 : open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0 && !path.empty())
+        {
+            throw runtime_error("Cannot open log file " + path + ": " + strerror(errno));
+        }
+        flush();
+        int previous = fileFd.exchange(fd);
+        if (previous >= 0)
+        {
+            close(previous);
+        }
+    }
+
+    void publish(const LogRecord& record)
+    {
+        size_t position = enqueuePosition.load(memory_order_relaxed);
+        Slot* slot;
+        while (true)
+        {
+            slot = &slots[position & (LOG_RING_CAPACITY - 1)];
+            size_t sequence = slot->sequence.load(memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0)
+            {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                dropped.fetch_add(1, memory_order_relaxed);
+                MetricsRegistry::global().logRecordsDropped.add();
+                return;
+            }
+            else
+            {
+                position = enqueuePosition.load(memory_order_relaxed);
+            }
+        }
+
+        slot->record.timeMicros = record.timeMicros;
+        slot->record.level = record.level;
+        slot->record.length = record.length;
+        memcpy(slot->record.text, record.text, record.length);
+        slot->sequence.store(position + 1, memory_order_release);
+        startWriter();
+    }
+
+    // Returns once every record published before the call has been written.
+    void flush()
+    {
+        size_t target = enqueuePosition.load();
+        while (written.load(memory_order_acquire) < target)
+        {
+            if (drain() == 0)
+            {
+                this_thread::yield();
+            }
+        }
+    }
+};
+
+// One structured record: a message followed by key=value fields, published when the line goes out of
+// scope. A line below the logger's level, or skipped by sampling, does no work at all.
+//     LogLine(LOG_INFO, "request", true).field("connection", id).field("command", message);
+class LogLine
+{
+private:
+    LogRecord record;
+    bool active;
+
+    void append(const char* data, size_t length)
+    {
+        size_t room = LOG_RECORD_BYTES - record.length;
+        if (length > room)
+        {
+            length = room;
+        }
+        memcpy(record.text + record.length, data, length);
+        record.length += static_cast<uint32_t>(length);
+    }
+
+    void appendKey(const char* key)
+    {
+        append(" ", 1);
+        append(key, strlen(key));
+        append("=", 1);
+    }
+
+    // Quotes the value, escapes quotes and control characters and cuts it after limit bytes.
+    void appendQuoted(const char* data, size_t length, size_t limit)
+    {
+        append("\"", 1);
+        bool cut = length > limit;
+        size_t end = cut ? limit : length;
+        for (size_t i = 0; i < end; i++)
+        {
+            char c = data[i];
+            if (c == '"' || c == '\\')
+            {
+                char escaped[2] = {'\\', c};
+                append(escaped, 2);
+            }
+            else if (c == '\n')
+            {
+                append("\\n", 2);
+            }
+            else if (c == '\r')
+            {
+                append("\\r", 2);
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                append("?", 1);
+            }
+            else
+            {
+                append(&c, 1);
+            }
+        }
+        if (cut)
+        {
+            append("...", 3);
+        }
+        append("\"", 1);
+    }
+
+public:
+    LogLine(logLevel level, const char* message, bool sampled = false)
+    {
+        Logger& logger = Logger::global();
+        active = logger.enabled(level) && (!sampled || logger.sample());
+        if (!active)
+        {
+            return;
+        }
+
+        record.timeMicros = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        record.level = level;
+        record.length = 0;
+        append(message, strlen(message));
+    }
+
+    ~LogLine()
+    {
+        if (!active)
+        {
+            return;
+        }
+        if (record.length == LOG_RECORD_BYTES)
+        {
+            memcpy(record.text + LOG_RECORD_BYTES - 3, "...", 3);
+        }
+        Logger::global().publish(record);
+    }
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    bool isActive() const
+    {
+        return active;
+    }
+
+    LogLine& field(const char* key, const string& value)
+    {
+        if (active)
+        {
+            appendKey(key);
+            appendQuoted(value.data(), value.size(), Logger::global().getPayloadBytes());
+        }
+        return *this;
+    }
+
+    LogLine& field(const char* key, const char* value)
+    {
+        if (active)
+        {
+            appendKey(key);
+            appendQuoted(value, strlen(value), Logger::global().getPayloadBytes());
+        }
+        return *this;
+    }
+
+    template<typename T, typename = enable_if_t<is_integral<T>::value && !is_same<T, bool>::value>>
+    LogLine& field(const char* key, T value)
+    {
+        if (active)
+        {
+            appendKey(key);
+            char buffer[24];
+            to_chars_result result = to_chars(buffer, buffer + sizeof(buffer), value);
+            append(buffer, static_cast<size_t>(result.ptr - buffer));
+        }
+        return *this;
+    }
+
+    LogLine& field(const char* key, bool value)
+    {
+        if (active)
+        {
+            appendKey(key);
+            append(value ? "true" : "false", value ? 4 : 5);
+        }
+        return *this;
+    }
+
+    LogLine& field(const char* key, double value)
+    {
+        if (active)
+        {
+            appendKey(key);
+            char buffer[32];
+            int length = snprintf(buffer, sizeof(buffer), "%g", value);
+            append(buffer, static_cast<size_t>(length));
+        }
+        return *this;
+    }
+};
+
+#endif
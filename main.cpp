@@ -3,27 +3,39 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <iterator>
 
 #include "../../Containers/hashtable.hpp"
 #include "../../Containers/Go/vector.h"
 #include "database.hpp"
 
-using nlohmann::json;
-
 void printUsage() 
 {
     cout << "Usage:" << endl;
     cout << "  ./program <database> insert '<json_document>'" << endl;
-    cout << "  ./program <database> find '<json_query>'" << endl;
+    cout << "  ./program <database> insert_many '<json_array>' | - (NDJSON from stdin)" << endl;
+    cout << "  ./program <database> find '<json_query>' ['<json_options>']" << endl;
+    cout << "  ./program <database> explain '<json_query>' ['<json_options>']" << endl;
+    cout << "  ./program <database> update '<json_query>' '<json_update>' [upsert]" << endl;
     cout << "  ./program <database> delete '<json_query>'" << endl;
-    cout << "  ./program <database> create_index <field_name>" << endl;
+    cout << "  ./program <database> aggregate '<json_pipeline>'" << endl;
+    cout << "  ./program <database> create_index <field_name> [hash|ordered|column]" << endl;
     cout << endl;
     cout << "Examples:" << endl;
     cout << "  ./program mydb insert '{\"name\": \"Alice\", \"age\": 25}'" << endl;
+    cout << "  ./program mydb insert_many '[{\"name\": \"Bob\"}, {\"name\": \"Eve\"}]'" << endl;
+    cout << "  ./program mydb insert_many - < people.ndjson" << endl;
     cout << "  ./program mydb find '{\"age\": 25}'" << endl;
     cout << "  ./program mydb find '{\"age\": {\"$gt\": 20}}'" << endl;
+    cout << "  ./program mydb find '{}' '{\"sort\": {\"age\": -1}, \"limit\": 10, \"projection\": {\"name\": 1}}'" << endl;
+    cout << "  ./program mydb explain '{\"age\": {\"$gt\": 20}}' '{\"sort\": {\"age\": 1}}'" << endl;
+    cout << "  ./program mydb update '{\"name\": \"Alice\"}' '{\"$inc\": {\"visits\": 1}, \"$set\": {\"active\": true}}'" << endl;
+    cout << "  ./program mydb update '{\"name\": \"Carol\"}' '{\"$push\": {\"tags\": \"new\"}}' upsert" << endl;
     cout << "  ./program mydb delete '{\"name\": \"Alice\"}'" << endl;
+    cout << "  ./program mydb aggregate '[{\"$match\": {\"age\": {\"$gt\": 20}}}, {\"$group\": {\"_id\": \"$city\", \"n\": {\"$sum\": 1}}}]'" << endl;
     cout << "  ./program mydb create_index age" << endl;
+    cout << "  ./program mydb create_index created_at ordered" << endl;
+    cout << "  ./program mydb create_index price column" << endl;
 }
 
 int main(int argc, char *argv[])
@@ -51,16 +63,35 @@ int main(int argc, char *argv[])
         string command = argv[2];
         string argument = argv[3];
         
+        // The command line tool reports what each operation did, which the database logs at debug level.
+        Logger::global().setLevel(LOG_DEBUG);
         Database db(databaseName);
         
         if (command == "insert") 
         {
             db.insert(databaseName, argument);
         }
+        else if (command == "insert_many") 
+        {
+            if (argument == "-")
+            {
+                argument.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+            }
+
+            InsertManyResult result = db.insertMany(databaseName, argument);
+            for (size_t i = 0; i < result.errors.size(); i++)
+            {
+                cerr << "Document " << result.errors[i].first << ": " << result.errors[i].second << endl;
+            }
+            if (!result.durabilityError.empty())
+            {
+                cerr << "Inserted " << result.inserted << " document(s), but they may not be durable: " << result.durabilityError << endl;
+            }
+        }
         else if (command == "find") 
         {
             myVector<Document> docs;
-            docs = db.find(databaseName, argument);
+            docs = db.find(databaseName, argument, argc > 4 ? argv[4] : "");
             
             if (docs.size() > 0)
             {
@@ -76,10 +107,49 @@ int main(int argc, char *argv[])
                 cout << "documents not found" << endl;
             }
         }
+        else if (command == "explain") 
+        {
+            json plan = db.explain(databaseName, argument, argc > 4 ? argv[4] : "");
+            cout << plan.dump(2) << endl;
+        }
+        else if (command == "update") 
+        {
+            if (argc < 5)
+            {
+                cerr << "Error: update needs a query and an update document" << endl;
+                return 1;
+            }
+            bool upsert = argc > 5 && string(argv[5]) == "upsert";
+            db.update(databaseName, argument, argv[4], upsert);
+        }
         else if (command == "delete") 
         {
             db.remove(databaseName, argument);
         }
+        else if (command == "aggregate") 
+        {
+            myVector<json> rows = db.aggregate(databaseName, argument);
+            cout << "aggregated " << rows.size() << " row(s)" << endl;
+
+            for (size_t i = 0; i < rows.size(); i++)
+            {
+                cout << rows[i].dump(2) << endl;
+            }
+        }
+        else if (command == "create_index") 
+        {
+            indexType type = INDEX_HASH;
+            if (argc > 4)
+            {
+                string typeName = argv[4];
+                if (!parseIndexType(typeName, type))
+                {
+                    cerr << "Error: Unknown index type '" << typeName << "'" << endl;
+                    return 1;
+                }
+            }
+            db.createIndex(databaseName, argument, type);
+        }
         else 
         {
             cerr << "Error: Unknown command '" << command << "'" << endl;
@@ -95,6 +165,7 @@ int main(int argc, char *argv[])
     
     auto end = chrono::high_resolution_clock::now();
     auto duration = end - start;
+    Logger::global().flush();
 
     cout << endl << endl << "Operation was ended for " << chrono::duration_cast<chrono::microseconds>(duration).count()<< " microseconds" << endl;
 
@@ -0,0 +1,437 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+#include <cstdint>
+#include <unordered_map>
+
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+// Writers spread over this many shards, picked by thread, so concurrent updates rarely share a cache line.
+#define METRICS_SHARDS 16
+// Histogram buckets: every power of two is split into 16 linear sub-buckets, about 6% relative error.
+#define METRICS_SUB_BUCKET_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+// Largest recorded value is 2^40 microseconds, about 12 days; longer ones land in the last bucket.
+#define METRICS_MAX_EXPONENT 40
+#define METRICS_BUCKETS ((METRICS_MAX_EXPONENT - METRICS_SUB_BUCKET_BITS + 2) * METRICS_SUB_BUCKETS)
+// Operation and collection pairs beyond this share one series with collection "_other".
+#define METRICS_MAX_SERIES 1024
+
+inline size_t metricsShard()
+{
+    static atomic<size_t> nextSlot(0);
+    thread_local size_t slot = nextSlot++ % METRICS_SHARDS;
+    return slot;
+}
+
+inline size_t histogramBucket(uint64_t value)
+{
+    if (value < METRICS_SUB_BUCKETS)
+    {
+        return static_cast<size_t>(value);
+    }
+    size_t exponent = 63 - __builtin_clzll(value);
+    if (exponent > METRICS_MAX_EXPONENT)
+    {
+        return METRICS_BUCKETS - 1;
+    }
+    size_t subBucket = (value >> (exponent - METRICS_SUB_BUCKET_BITS)) & (METRICS_SUB_BUCKETS - 1);
+    return (exponent - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS + subBucket;
+}
+
+// Smallest value that falls into the bucket; bucket i holds [histogramLowerBound(i), histogramLowerBound(i + 1)).
+inline uint64_t histogramLowerBound(size_t bucket)
+{
+    if (bucket < METRICS_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    size_t exponent = bucket / METRICS_SUB_BUCKETS + METRICS_SUB_BUCKET_BITS - 1;
+    uint64_t subBucket = bucket % METRICS_SUB_BUCKETS;
+    return (METRICS_SUB_BUCKETS + subBucket) << (exponent - METRICS_SUB_BUCKET_BITS);
+}
+
+struct HistogramSnapshot
+{
+    vector<uint64_t> buckets = vector<uint64_t>(METRICS_BUCKETS, 0);
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    // Upper end of the bucket holding the value at the given rank, capped by the largest value seen.
+    uint64_t percentile(double fraction) const
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(fraction * count + 0.5), 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets.size(); i++)
+        {
+            seen += buckets[i];
+            if (seen >= rank)
+            {
+                return min(histogramLowerBound(i + 1) - 1, max);
+            }
+        }
+        return max;
+    }
+
+    // Values recorded that are at most limit, counting a bucket only when it lies entirely below it.
+    uint64_t countAtMost(uint64_t limit) const
+    {
+        uint64_t total = 0;
+        for (size_t i = 0; i < buckets.size() && histogramLowerBound(i + 1) - 1 <= limit; i++)
+        {
+            total += buckets[i];
+        }
+        return total;
+    }
+};
+
+// Log-linear latency histogram in the style of HdrHistogram. Recording is a few relaxed atomic
+// increments on the calling thread's shard; shards are created on first use.
+class LatencyHistogram
+{
+private:
+    struct alignas(64) Shard
+    {
+        atomic<uint64_t> buckets[METRICS_BUCKETS];
+        atomic<uint64_t> count;
+        atomic<uint64_t> sum;
+        atomic<uint64_t> max;
+    };
+
+    atomic<Shard*> shards[METRICS_SHARDS];
+
+public:
+    LatencyHistogram()
+    {
+        for (atomic<Shard*>& shard : shards)
+        {
+            shard.store(nullptr);
+        }
+    }
+
+    ~LatencyHistogram()
+    {
+        for (atomic<Shard*>& shard : shards)
+        {
+            delete shard.load();
+        }
+    }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void record(uint64_t value)
+    {
+        atomic<Shard*>& slot = shards[metricsShard()];
+        Shard* shard = slot.load(memory_order_acquire);
+        if (!shard)
+        {
+            Shard* created = new Shard();
+            if (slot.compare_exchange_strong(shard, created, memory_order_acq_rel))
+            {
+                shard = created;
+            }
+            else
+            {
+                delete created;
+            }
+        }
+
+        shard->buckets[histogramBucket(value)].fetch_add(1, memory_order_relaxed);
+        shard->count.fetch_add(1, memory_order_relaxed);
+        shard->sum.fetch_add(value, memory_order_relaxed);
+        uint64_t largest = shard->max.load(memory_order_relaxed);
+        while (value > largest && !shard->max.compare_exchange_weak(largest, value, memory_order_relaxed))
+        {
+        }
+    }
+
+    // Sums the shards. Values recorded meanwhile may be partly included.
+    HistogramSnapshot snapshot() const
+    {
+        HistogramSnapshot result;
+        for (const atomic<Shard*>& slot : shards)
+        {
+            const Shard* shard = slot.load(memory_order_acquire);
+            if (!shard)
+            {
+                continue;
+            }
+            for (size_t i = 0; i < METRICS_BUCKETS; i++)
+            {
+                result.buckets[i] += shard->buckets[i].load(memory_order_relaxed);
+            }
+            result.count += shard->count.load(memory_order_relaxed);
+            result.sum += shard->sum.load(memory_order_relaxed);
+            result.max = std::max(result.max, shard->max.load(memory_order_relaxed));
+        }
+        return result;
+    }
+};
+
+class Counter
+{
+private:
+    struct alignas(64) Cell
+    {
+        atomic<uint64_t> value{0};
+    };
+
+    Cell cells[METRICS_SHARDS];
+
+public:
+    void add(uint64_t amount = 1)
+    {
+        cells[metricsShard()].value.fetch_add(amount, memory_order_relaxed);
+    }
+
+    uint64_t value() const
+    {
+        uint64_t total = 0;
+        for (const Cell& cell : cells)
+        {
+            total += cell.value.load(memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+struct OperationSeries
+{
+    string operation;
+    string collection;
+    LatencyHistogram latency;
+    Counter errors;
+};
+
+// Process-wide metrics: request latency per operation and collection, and counters the database and
+// the server update as they work.
+class MetricsRegistry
+{
+private:
+    mutable mutex seriesMutex;
+    vector<unique_ptr<OperationSeries>> series;
+    map<string, OperationSeries*> seriesByKey;
+
+    MetricsRegistry()
+    {
+    }
+
+    // Each thread remembers the series it has used, so the registry lock is only taken the first time a
+    // thread records an operation on a collection. Keys folded into "_other" are not remembered, which
+    // keeps the cache as bounded as the series themselves; they take the lock every time.
+    OperationSeries* findSeries(const string& operation, const string& collection)
+    {
+        string key = operation + '\0' + collection;
+        thread_local unordered_map<string, OperationSeries*> cache;
+        auto cached = cache.find(key);
+        if (cached != cache.end())
+        {
+            return cached->second;
+        }
+
+        lock_guard<mutex> lock(seriesMutex);
+        auto it = seriesByKey.find(key);
+        if (it == seriesByKey.end())
+        {
+            if (series.size() >= METRICS_MAX_SERIES)
+            {
+                string other = operation + '\0' + "_other";
+                it = seriesByKey.find(other);
+                if (it != seriesByKey.end())
+                {
+                    return it->second;
+                }
+                key = other;
+            }
+            series.push_back(make_unique<OperationSeries>());
+            series.back()->operation = operation;
+            series.back()->collection = key.substr(operation.size() + 1);
+            it = seriesByKey.emplace(key, series.back().get()).first;
+        }
+        if (it->second->collection == collection)
+        {
+            cache.emplace(it->first, it->second);
+        }
+        return it->second;
+    }
+
+    static string escapeLabel(const string& value)
+    {
+        string escaped;
+        for (char c : value)
+        {
+            if (c == '\\' || c == '"')
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if (c == '\n')
+            {
+                escaped += "\\n";
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    vector<const OperationSeries*> listSeries() const
+    {
+        lock_guard<mutex> lock(seriesMutex);
+        vector<const OperationSeries*> result;
+        for (const auto& entry : seriesByKey)
+        {
+            result.push_back(entry.second);
+        }
+        return result;
+    }
+
+public:
+    Counter documentsScanned;
+    Counter documentsReturned;
+    Counter bytesReceived;
+    Counter bytesSent;
+    Counter connectionsAccepted;
+    Counter lockAcquisitions;
+    Counter lockWaitMicros;
+    Counter logRecordsDropped;
+    Counter requestsTimedOut;
+    Counter requestsShed;
+    Counter planCacheHits;
+    Counter planCacheMisses;
+    atomic<int64_t> activeConnections{0};
+
+    // Never destroyed: worker threads may still record while the process exits.
+    static MetricsRegistry& global()
+    {
+        static MetricsRegistry* registry = new MetricsRegistry();
+        return *registry;
+    }
+
+    void recordOperation(const string& operation, const string& collection, uint64_t micros, bool failed)
+    {
+        OperationSeries* entry = findSeries(operation, collection);
+        entry->latency.record(micros);
+        if (failed)
+        {
+            entry->errors.add();
+        }
+    }
+
+    json snapshot() const
+    {
+        json operations = json::array();
+        for (const OperationSeries* entry : listSeries())
+        {
+            HistogramSnapshot latency = entry->latency.snapshot();
+            operations.push_back({
+                {"operation", entry->operation},
+                {"collection", entry->collection},
+                {"count", latency.count},
+                {"errors", entry->errors.value()},
+                {"meanUs", latency.count > 0 ? static_cast<double>(latency.sum) / latency.count : 0.0},
+                {"p50Us", latency.percentile(0.50)},
+                {"p99Us", latency.percentile(0.99)},
+                {"p999Us", latency.percentile(0.999)},
+                {"maxUs", latency.max}
+            });
+        }
+
+        return {
+            {"operations", operations},
+            {"counters", {
+                {"documentsScanned", documentsScanned.value()},
+                {"documentsReturned", documentsReturned.value()},
+                {"bytesReceived", bytesReceived.value()},
+                {"bytesSent", bytesSent.value()},
+                {"connectionsAccepted", connectionsAccepted.value()},
+                {"lockAcquisitions", lockAcquisitions.value()},
+                {"lockWaitMicros", lockWaitMicros.value()},
+                {"logRecordsDropped", logRecordsDropped.value()},
+                {"requestsTimedOut", requestsTimedOut.value()},
+                {"requestsShed", requestsShed.value()},
+                {"planCacheHits", planCacheHits.value()},
+                {"planCacheMisses", planCacheMisses.value()}
+            }},
+            {"gauges", {{"activeConnections", activeConnections.load()}}}
+        };
+    }
+
+    // Prometheus text exposition format, version 0.0.4. Histogram buckets are coarsened to fixed
+    // boundaries from 10us to 10s.
+    string prometheusText() const
+    {
+        static const uint64_t boundaries[] = {10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+                                              100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+        ostringstream out;
+
+        out << "# HELP db_operation_duration_microseconds Time to execute a request, by operation and collection.\n";
+        out << "# TYPE db_operation_duration_microseconds histogram\n";
+        vector<const OperationSeries*> entries = listSeries();
+        for (const OperationSeries* entry : entries)
+        {
+            HistogramSnapshot latency = entry->latency.snapshot();
+            string labels = "operation=\"" + escapeLabel(entry->operation) + "\",collection=\"" + escapeLabel(entry->collection) + "\"";
+            for (uint64_t boundary : boundaries)
+            {
+                out << "db_operation_duration_microseconds_bucket{" << labels << ",le=\"" << boundary << "\"} " << latency.countAtMost(boundary) << "\n";
+            }
+            out << "db_operation_duration_microseconds_bucket{" << labels << ",le=\"+Inf\"} " << latency.count << "\n";
+            out << "db_operation_duration_microseconds_sum{" << labels << "} " << latency.sum << "\n";
+            out << "db_operation_duration_microseconds_count{" << labels << "} " << latency.count << "\n";
+        }
+
+        out << "# HELP db_operation_errors_total Requests that returned an error, by operation and collection.\n";
+        out << "# TYPE db_operation_errors_total counter\n";
+        for (const OperationSeries* entry : entries)
+        {
+            out << "db_operation_errors_total{operation=\"" << escapeLabel(entry->operation) << "\",collection=\""
+                << escapeLabel(entry->collection) << "\"} " << entry->errors.value() << "\n";
+        }
+
+        const pair<const char*, const Counter*> counters[] = {
+            {"db_documents_scanned_total", &documentsScanned},
+            {"db_documents_returned_total", &documentsReturned},
+            {"db_network_received_bytes_total", &bytesReceived},
+            {"db_network_sent_bytes_total", &bytesSent},
+            {"db_connections_accepted_total", &connectionsAccepted},
+            {"db_lock_acquisitions_total", &lockAcquisitions},
+            {"db_lock_wait_microseconds_total", &lockWaitMicros},
+            {"db_log_records_dropped_total", &logRecordsDropped},
+            {"db_requests_timed_out_total", &requestsTimedOut},
+            {"db_requests_shed_total", &requestsShed},
+            {"db_plan_cache_hits_total", &planCacheHits},
+            {"db_plan_cache_misses_total", &planCacheMisses}
+        };
+        for (const auto& counter : counters)
+        {
+            out << "# TYPE " << counter.first << " counter\n";
+            out << counter.first << " " << counter.second->value() << "\n";
+        }
+
+        out << "# TYPE db_active_connections gauge\n";
+        out << "db_active_connections " << activeConnections.load() << "\n";
+        return out.str();
+    }
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include <iostream>
+#include <string>
+#include <filesystem>
+
+#include "collection.hpp"
+
+using namespace std;
+
+// Converts the JSON snapshots of a database (databases/<database>/<collection>.json) into binary
+// segments. Pending log records are applied first, and the JSON file is removed once its segment is
+// durable. Collections are also converted on their first checkpoint, so running this is optional.
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        cerr << "Usage: ./migrate <database>" << endl;
+        return 1;
+    }
+
+    string directory = "databases/" + string(argv[1]);
+    if (!filesystem::is_directory(directory))
+    {
+        cerr << "Error: Database directory " << directory << " not found" << endl;
+        return 1;
+    }
+
+    int failed = 0;
+    for (const auto& entry : filesystem::directory_iterator(directory))
+    {
+        if (entry.path().extension() != ".json" || entry.path().stem().extension() == ".indexes")
+        {
+            continue;
+        }
+
+        string collectionName = entry.path().stem().string();
+        try
+        {
+            size_t jsonBytes = filesystem::file_size(entry.path());
+            Collection collection(collectionName, directory);
+            collection.ensureLoaded();
+            collection.save();
+
+            cout << collectionName << ": " << collection.size() << " document(s), " << jsonBytes << " -> "
+                 << filesystem::file_size(directory + "/" + collectionName + ".seg") << " bytes" << endl;
+        }
+        catch (const exception& e)
+        {
+            cerr << "Error migrating " << collectionName << ": " << e.what() << endl;
+            failed++;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+#ifndef MSGPACK_VIEW_HPP
+#define MSGPACK_VIEW_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+// Reading msgpack documents in place: values are skipped by their headers and only the requested
+// ones are decoded.
+
+inline uint64_t msgpackLength(const uint8_t* data, size_t width)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; i++)
+    {
+        value = value << 8 | data[i];
+    }
+    return value;
+}
+
+// Reads the header of the value at data: the bytes it takes besides nested values, and how many
+// nested values (array items, map keys and values) follow it. Returns false on an invalid header.
+inline bool msgpackHeader(const uint8_t* data, const uint8_t* end, uint64_t& bytes, uint64_t& children)
+{
+    if (data >= end)
+    {
+        return false;
+    }
+
+    uint8_t type = data[0];
+    size_t available = static_cast<size_t>(end - data);
+    children = 0;
+
+    if (type <= 0x7F || type >= 0xE0 || type == 0xC0 || type == 0xC2 || type == 0xC3)
+    {
+        bytes = 1;
+        return true;
+    }
+    if (type >= 0x80 && type <= 0x8F)
+    {
+        bytes = 1;
+        children = 2 * (type & 0x0F);
+        return true;
+    }
+    if (type >= 0x90 && type <= 0x9F)
+    {
+        bytes = 1;
+        children = type & 0x0F;
+        return true;
+    }
+    if (type >= 0xA0 && type <= 0xBF)
+    {
+        bytes = 1 + (type & 0x1F);
+        return true;
+    }
+
+    // Width of the length field, constant header bytes and whether the length counts items.
+    size_t width = 0;
+    size_t fixed = 1;
+    uint64_t multiplier = 0;
+    switch (type)
+    {
+        case 0xCC: case 0xD0: bytes = 2; return true;
+        case 0xCD: case 0xD1: bytes = 3; return true;
+        case 0xCA: case 0xCE: case 0xD2: bytes = 5; return true;
+        case 0xCB: case 0xCF: case 0xD3: bytes = 9; return true;
+        case 0xD4: bytes = 3; return true;
+        case 0xD5: bytes = 4; return true;
+        case 0xD6: bytes = 6; return true;
+        case 0xD7: bytes = 10; return true;
+        case 0xD8: bytes = 18; return true;
+        case 0xC4: case 0xD9: width = 1; break;
+        case 0xC5: case 0xDA: width = 2; break;
+        case 0xC6: case 0xDB: width = 4; break;
+        case 0xC7: width = 1; fixed = 2; break;
+        case 0xC8: width = 2; fixed = 2; break;
+        case 0xC9: width = 4; fixed = 2; break;
+        case 0xDC: width = 2; multiplier = 1; break;
+        case 0xDD: width = 4; multiplier = 1; break;
+        case 0xDE: width = 2; multiplier = 2; break;
+        case 0xDF: width = 4; multiplier = 2; break;
+        default: return false;
+    }
+
+    if (available < fixed + width)
+    {
+        return false;
+    }
+    uint64_t length = msgpackLength(data + 1, width);
+    if (multiplier > 0)
+    {
+        bytes = 1 + width;
+        children = length * multiplier;
+    }
+    else
+    {
+        bytes = fixed + width + length;
+    }
+    return true;
+}
+
+// Size of the complete value at data including nested values, or 0 when it is malformed or runs
+// past end.
+inline size_t msgpackValueSize(const uint8_t* data, const uint8_t* end)
+{
+    const uint8_t* position = data;
+    uint64_t remaining = 1;
+    while (remaining > 0)
+    {
+        uint64_t bytes = 0;
+        uint64_t children = 0;
+        if (!msgpackHeader(position, end, bytes, children) || bytes > static_cast<uint64_t>(end - position))
+        {
+            return 0;
+        }
+        position += bytes;
+        remaining = remaining - 1 + children;
+    }
+    return static_cast<size_t>(position - data);
+}
+
+// Decodes the listed top-level fields of the msgpack map at data into fields, leaving the rest of the
+// document untouched. Returns false when data is not a well-formed map.
+inline bool msgpackExtractFields(const uint8_t* data, size_t size, const vector<string>& names, json& fields)
+{
+    const uint8_t* end = data + size;
+    uint64_t bytes = 0;
+    uint64_t children = 0;
+    if (!msgpackHeader(data, end, bytes, children) || data[0] < 0x80 ||
+        (data[0] > 0x8F && data[0] != 0xDE && data[0] != 0xDF))
+    {
+        return false;
+    }
+
+    const uint8_t* position = data + bytes;
+    size_t found = 0;
+    for (uint64_t pair = 0; pair < children / 2 && found < names.size(); pair++)
+    {
+        size_t keySize = msgpackValueSize(position, end);
+        size_t valueSize = keySize == 0 ? 0 : msgpackValueSize(position + keySize, end);
+        if (valueSize == 0)
+        {
+            return false;
+        }
+
+        bool isString = (position[0] >= 0xA0 && position[0] <= 0xBF) || (position[0] >= 0xD9 && position[0] <= 0xDB);
+        if (isString)
+        {
+            size_t prefix = position[0] <= 0xBF ? 1 : 1 + (size_t(1) << (position[0] - 0xD9));
+            const char* key = reinterpret_cast<const char*>(position + prefix);
+            size_t keyLength = keySize - prefix;
+            for (const string& name : names)
+            {
+                if (name.size() == keyLength && memcmp(name.data(), key, keyLength) == 0)
+                {
+                    const uint8_t* value = position + keySize;
+                    fields[name] = json::from_msgpack(value, value + valueSize);
+                    found++;
+                    break;
+                }
+            }
+        }
+        position += keySize + valueSize;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,268 @@
+#ifndef ORDERED_INDEX_HPP
+#define ORDERED_INDEX_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <random>
+#include <unordered_set>
+
+#include "../../Containers/Go/vector.h"
+#include "index.hpp"
+#include "jsonUtils.hpp"
+#include "poolAllocator.hpp"
+
+struct RangeBound
+{
+    const json* value = nullptr;
+    bool inclusive = false;
+};
+
+// Skiplist keyed by field value in compareJson order, one node per distinct value.
+class OrderedIndex : public SecondaryIndex
+{
+private:
+    static const int MAX_LEVEL = 32;
+
+    struct Node
+    {
+        json key;
+        unordered_set<string> ids;
+        vector<Node*> next;
+
+        Node(const json& nodeKey, int levels) : key(nodeKey), next(levels, nullptr) 
+        {
+        }
+    };
+
+    Node* head;
+    int level;
+    size_t keyCount;
+    mt19937 random;
+
+    int randomLevel()
+    {
+        int nodeLevel = 1;
+        while (nodeLevel < MAX_LEVEL && (random() & 3) == 0)
+        {
+            nodeLevel++;
+        }
+        return nodeLevel;
+    }
+
+    // Last node on each level whose key is strictly less than the given key.
+    Node* findPredecessors(const json& key, Node** update) const
+    {
+        Node* current = head;
+        for (int i = level - 1; i >= 0; i--)
+        {
+            while (current->next[i] && compareJson(current->next[i]->key, key) < 0)
+            {
+                current = current->next[i];
+            }
+            if (update)
+            {
+                update[i] = current;
+            }
+        }
+        return current;
+    }
+
+    Node* findNode(const json& key) const
+    {
+        Node* candidate = findPredecessors(key, nullptr)->next[0];
+        if (candidate && compareJson(candidate->key, key) == 0)
+        {
+            return candidate;
+        }
+        return nullptr;
+    }
+
+    Node* firstInRange(const RangeBound& lower) const
+    {
+        if (!lower.value)
+        {
+            return head->next[0];
+        }
+
+        Node* node = findPredecessors(*lower.value, nullptr)->next[0];
+        if (node && !lower.inclusive && compareJson(node->key, *lower.value) == 0)
+        {
+            node = node->next[0];
+        }
+        return node;
+    }
+
+    static bool beyondUpper(const Node* node, const RangeBound& upper)
+    {
+        if (!upper.value)
+        {
+            return false;
+        }
+        int order = compareJson(node->key, *upper.value);
+        return upper.inclusive ? order > 0 : order >= 0;
+    }
+
+public:
+    OrderedIndex(const string& fieldName)
+        : SecondaryIndex(fieldName), head(new Node(json(), MAX_LEVEL)), level(1), keyCount(0), random(0x5eed)
+    {
+    }
+
+    ~OrderedIndex() override
+    {
+        Node* current = head;
+        while (current)
+        {
+            Node* next = current->next[0];
+            delete current;
+            current = next;
+        }
+    }
+
+    OrderedIndex(const OrderedIndex&) = delete;
+    OrderedIndex& operator=(const OrderedIndex&) = delete;
+
+    indexType getType() const override
+    {
+        return INDEX_ORDERED;
+    }
+
+    size_t getKeyCount() const
+    {
+        return keyCount;
+    }
+
+    void add(const string& id, const json& doc) override
+    {
+        auto it = doc.find(field);
+        if (it == doc.end())
+        {
+            return;
+        }
+
+        Node* update[MAX_LEVEL];
+        Node* candidate = findPredecessors(*it, update)->next[0];
+        if (candidate && compareJson(candidate->key, *it) == 0)
+        {
+            candidate->ids.insert(id);
+            return;
+        }
+
+        int nodeLevel = randomLevel();
+        for (int i = level; i < nodeLevel; i++)
+        {
+            update[i] = head;
+        }
+        level = max(level, nodeLevel);
+
+        Node* node = new Node(*it, nodeLevel);
+        node->ids.insert(id);
+        for (int i = 0; i < nodeLevel; i++)
+        {
+            node->next[i] = update[i]->next[i];
+            update[i]->next[i] = node;
+        }
+        keyCount++;
+    }
+
+    void remove(const string& id, const json& doc) override
+    {
+        auto it = doc.find(field);
+        if (it == doc.end())
+        {
+            return;
+        }
+
+        Node* update[MAX_LEVEL];
+        Node* node = findPredecessors(*it, update)->next[0];
+        if (!node || compareJson(node->key, *it) != 0)
+        {
+            return;
+        }
+
+        node->ids.erase(id);
+        if (!node->ids.empty())
+        {
+            return;
+        }
+
+        for (int i = 0; i < level; i++)
+        {
+            if (update[i]->next[i] == node)
+            {
+                update[i]->next[i] = node->next[i];
+            }
+        }
+        while (level > 1 && !head->next[level - 1])
+        {
+            level--;
+        }
+        delete node;
+        keyCount--;
+    }
+
+    size_t count(const json& value) const override
+    {
+        Node* node = findNode(value);
+        return node ? node->ids.size() : 0;
+    }
+
+    void lookup(const json& value, myVector<string>& ids) const override
+    {
+        Node* node = findNode(value);
+        if (!node)
+        {
+            return;
+        }
+
+        for (const string& id : node->ids)
+        {
+            ids.push_back(id);
+        }
+    }
+
+    // Number of ids in the range, counting stops once it exceeds the limit.
+    size_t countRange(const RangeBound& lower, const RangeBound& upper, size_t limit) const
+    {
+        size_t total = 0;
+        for (Node* node = firstInRange(lower); node && !beyondUpper(node, upper); node = node->next[0])
+        {
+            total += node->ids.size();
+            if (total > limit)
+            {
+                break;
+            }
+        }
+        return total;
+    }
+
+    // Ids in ascending key order.
+    void range(const RangeBound& lower, const RangeBound& upper, myVector<string>& ids) const
+    {
+        forEachInRange(lower, upper, [&](const string& id)
+        {
+            ids.push_back(id);
+            return true;
+        });
+    }
+
+    // Calls visit(id) in ascending key order until it returns false.
+    template <typename Visitor>
+    void forEachInRange(const RangeBound& lower, const RangeBound& upper, Visitor visit) const
+    {
+        for (Node* node = firstInRange(lower); node && !beyondUpper(node, upper); node = node->next[0])
+        {
+            for (const string& id : node->ids)
+            {
+                if (!visit(id))
+                {
+                    return;
+                }
+            }
+        }
+    }
+};
+
+#endif
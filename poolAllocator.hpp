@@ -0,0 +1,297 @@
+#ifndef POOL_ALLOCATOR_HPP
+#define POOL_ALLOCATOR_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+#define POOL_MAX_BLOCK_BYTES 256
+#define POOL_BLOCK_ALIGN 16
+#define POOL_SIZE_CLASSES (POOL_MAX_BLOCK_BYTES / POOL_BLOCK_ALIGN)
+#define POOL_CHUNK_BYTES (64 * 1024)
+// Blocks a thread hands to or takes from the shared depot at a time.
+#define POOL_BATCH_BLOCKS 256
+
+// Small blocks in 16-byte size classes. Every thread allocates from and frees to its own free lists
+// without a lock; a thread that frees more than it allocates (one that drops documents another thread
+// parsed) returns whole batches to a shared depot, where a thread that runs dry picks them up. Memory
+// stays with the pool for reuse and is never given back to the system.
+class BlockPool
+{
+private:
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct Batch
+    {
+        FreeBlock* head;
+        size_t count;
+    };
+
+    struct Depot
+    {
+        mutex lock;
+        vector<Batch> batches[POOL_SIZE_CLASSES];
+        char* chunk = nullptr;
+        size_t chunkLeft = 0;
+    };
+
+    // Trivially destructible, so frees that come after the thread has flushed it (destructors of static
+    // objects on the main thread) can still see that it is retired.
+    struct ThreadCache
+    {
+        FreeBlock* lists[POOL_SIZE_CLASSES];
+        size_t counts[POOL_SIZE_CLASSES];
+        char* chunk;
+        size_t chunkLeft;
+        bool retired;
+    };
+
+    struct Flusher
+    {
+        ~Flusher()
+        {
+            flush(cache());
+        }
+    };
+
+    // Never destroyed: threads and static objects may free blocks during shutdown.
+    static Depot& depot()
+    {
+        static Depot* shared = new Depot();
+        return *shared;
+    }
+
+    static ThreadCache& cache()
+    {
+        thread_local ThreadCache local = {};
+        return local;
+    }
+
+    // Makes sure the cached blocks go back to the depot when the thread exits.
+    static void watchThreadExit()
+    {
+        thread_local Flusher flusher;
+        (void)flusher;
+    }
+
+    static size_t blockSize(size_t sizeClass)
+    {
+        return (sizeClass + 1) * POOL_BLOCK_ALIGN;
+    }
+
+    static char* newChunk()
+    {
+        return static_cast<char*>(::operator new(POOL_CHUNK_BYTES));
+    }
+
+    static void* carve(char*& chunk, size_t& chunkLeft, size_t size)
+    {
+        if (chunkLeft < size)
+        {
+            chunk = newChunk();
+            chunkLeft = POOL_CHUNK_BYTES;
+        }
+        void* block = chunk;
+        chunk += size;
+        chunkLeft -= size;
+        return block;
+    }
+
+    static void pushBatch(FreeBlock* head, size_t count, size_t sizeClass)
+    {
+        Depot& shared = depot();
+        lock_guard<mutex> guard(shared.lock);
+        shared.batches[sizeClass].push_back({head, count});
+    }
+
+    static void flush(ThreadCache& local)
+    {
+        for (size_t sizeClass = 0; sizeClass < POOL_SIZE_CLASSES; sizeClass++)
+        {
+            if (local.lists[sizeClass])
+            {
+                pushBatch(local.lists[sizeClass], local.counts[sizeClass], sizeClass);
+                local.lists[sizeClass] = nullptr;
+                local.counts[sizeClass] = 0;
+            }
+        }
+        local.retired = true;
+    }
+
+    // Slow paths for a thread that has already flushed its cache.
+    static void* allocateShared(size_t sizeClass)
+    {
+        Depot& shared = depot();
+        lock_guard<mutex> guard(shared.lock);
+        vector<Batch>& batches = shared.batches[sizeClass];
+        if (!batches.empty())
+        {
+            Batch& batch = batches.back();
+            FreeBlock* block = batch.head;
+            batch.head = block->next;
+            if (--batch.count == 0)
+            {
+                batches.pop_back();
+            }
+            return block;
+        }
+        return carve(shared.chunk, shared.chunkLeft, blockSize(sizeClass));
+    }
+
+    static void deallocateShared(void* pointer, size_t sizeClass)
+    {
+        FreeBlock* block = static_cast<FreeBlock*>(pointer);
+        block->next = nullptr;
+        pushBatch(block, 1, sizeClass);
+    }
+
+public:
+    static bool pooled(size_t bytes)
+    {
+        return bytes > 0 && bytes <= POOL_MAX_BLOCK_BYTES;
+    }
+
+    static void* allocate(size_t bytes)
+    {
+        size_t sizeClass = (bytes - 1) / POOL_BLOCK_ALIGN;
+        ThreadCache& local = cache();
+        if (local.retired)
+        {
+            return allocateShared(sizeClass);
+        }
+
+        FreeBlock* block = local.lists[sizeClass];
+        if (block)
+        {
+            local.lists[sizeClass] = block->next;
+            local.counts[sizeClass]--;
+            return block;
+        }
+
+        watchThreadExit();
+        Depot& shared = depot();
+        {
+            lock_guard<mutex> guard(shared.lock);
+            vector<Batch>& batches = shared.batches[sizeClass];
+            if (!batches.empty())
+            {
+                Batch batch = batches.back();
+                batches.pop_back();
+                local.lists[sizeClass] = batch.head->next;
+                local.counts[sizeClass] = batch.count - 1;
+                return batch.head;
+            }
+        }
+        return carve(local.chunk, local.chunkLeft, blockSize(sizeClass));
+    }
+
+    static void deallocate(void* pointer, size_t bytes)
+    {
+        size_t sizeClass = (bytes - 1) / POOL_BLOCK_ALIGN;
+        ThreadCache& local = cache();
+        if (local.retired)
+        {
+            deallocateShared(pointer, sizeClass);
+            return;
+        }
+
+        FreeBlock* block = static_cast<FreeBlock*>(pointer);
+        if (!local.lists[sizeClass])
+        {
+            watchThreadExit();
+        }
+        block->next = local.lists[sizeClass];
+        local.lists[sizeClass] = block;
+        if (++local.counts[sizeClass] < 2 * POOL_BATCH_BLOCKS)
+        {
+            return;
+        }
+
+        // Keep one batch for this thread and hand the older blocks to the depot.
+        FreeBlock* last = block;
+        for (size_t i = 1; i < POOL_BATCH_BLOCKS; i++)
+        {
+            last = last->next;
+        }
+        FreeBlock* rest = last->next;
+        last->next = nullptr;
+        pushBatch(rest, local.counts[sizeClass] - POOL_BATCH_BLOCKS, sizeClass);
+        local.counts[sizeClass] = POOL_BATCH_BLOCKS;
+    }
+};
+
+// Standard allocator over BlockPool. Requests too large for a size class, or aligned beyond 16 bytes,
+// go to operator new.
+template<typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept
+    {
+    }
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        size_t bytes = n * sizeof(T);
+        if (alignof(T) <= POOL_BLOCK_ALIGN && BlockPool::pooled(bytes) && n <= POOL_MAX_BLOCK_BYTES)
+        {
+            return static_cast<T*>(BlockPool::allocate(bytes));
+        }
+        if (n > SIZE_MAX / sizeof(T))
+        {
+            throw bad_array_new_length();
+        }
+        return static_cast<T*>(::operator new(bytes));
+    }
+
+    void deallocate(T* pointer, size_t n) noexcept
+    {
+        size_t bytes = n * sizeof(T);
+        if (alignof(T) <= POOL_BLOCK_ALIGN && BlockPool::pooled(bytes) && n <= POOL_MAX_BLOCK_BYTES)
+        {
+            BlockPool::deallocate(pointer, bytes);
+            return;
+        }
+        ::operator delete(pointer);
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept
+    {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept
+    {
+        return false;
+    }
+};
+
+// The json type used throughout the database. Its nodes, object trees and small arrays come from the
+// pool; build with -DDB_SYSTEM_ALLOCATOR to compare against plain nlohmann::json.
+#ifdef DB_SYSTEM_ALLOCATOR
+using json = nlohmann::json;
+#else
+using json = nlohmann::basic_json<map, vector, string, bool, int64_t, uint64_t, double, PoolAllocator>;
+#endif
+
+#endif
@@ -0,0 +1,521 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+#define DEFAULT_MAX_FRAME_BYTES (256 * 1024 * 1024)
+#define FRAME_HEADER_BYTES 4
+
+// Encoding of requests and responses after the handshake. The handshake line itself is always text:
+// "<database> [text|cbor|msgpack]".
+enum wireFormat
+{
+    WIRE_TEXT,
+    WIRE_CBOR,
+    WIRE_MSGPACK
+};
+
+enum framing
+{
+    FRAMING_LINE,
+    FRAMING_LENGTH
+};
+
+inline bool parseWireFormat(const string& name, wireFormat& format)
+{
+    if (name.empty() || name == "text")
+    {
+        format = WIRE_TEXT;
+    }
+    else if (name == "cbor")
+    {
+        format = WIRE_CBOR;
+    }
+    else if (name == "msgpack")
+    {
+        format = WIRE_MSGPACK;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+inline const char* wireFormatName(wireFormat format)
+{
+    switch (format)
+    {
+        case WIRE_CBOR:
+            return "cbor";
+        case WIRE_MSGPACK:
+            return "msgpack";
+        default:
+            return "text";
+    }
+}
+
+// Incremental parser for both framings: '\n'-terminated lines for the text protocol and a 4-byte
+// big-endian length followed by the payload for binary formats. Bytes are fed as they arrive and
+// complete messages are taken out one at a time; the framing can change between messages without
+// losing bytes that already arrived. Only bytes after the last scan are searched for the next '\n',
+// so a large line arriving in many pieces is scanned once.
+class FrameDecoder
+{
+private:
+    string buffer;
+    size_t start;
+    size_t scanned;
+    size_t maxMessageBytes;
+    framing mode;
+    bool overflowed;
+
+    void consume(size_t end)
+    {
+        start = end;
+        scanned = start;
+        if (start == buffer.size())
+        {
+            buffer.clear();
+            start = 0;
+            scanned = 0;
+        }
+    }
+
+    bool nextLine(string& line)
+    {
+        size_t newline = buffer.find('\n', scanned);
+        if (newline == string::npos)
+        {
+            scanned = buffer.size();
+            overflowed = buffer.size() - start > maxMessageBytes;
+            return false;
+        }
+
+        size_t end = newline;
+        if (end > start && buffer[end - 1] == '\r')
+        {
+            end--;
+        }
+        line.assign(buffer, start, end - start);
+        consume(newline + 1);
+        return true;
+    }
+
+    bool nextFrame(string& payload)
+    {
+        if (buffer.size() - start < FRAME_HEADER_BYTES)
+        {
+            return false;
+        }
+
+        const unsigned char* header = reinterpret_cast<const unsigned char*>(buffer.data() + start);
+        size_t length = (static_cast<size_t>(header[0]) << 24) | (static_cast<size_t>(header[1]) << 16) |
+                        (static_cast<size_t>(header[2]) << 8) | static_cast<size_t>(header[3]);
+        if (length > maxMessageBytes)
+        {
+            overflowed = true;
+            return false;
+        }
+        if (buffer.size() - start - FRAME_HEADER_BYTES < length)
+        {
+            return false;
+        }
+
+        payload.assign(buffer, start + FRAME_HEADER_BYTES, length);
+        consume(start + FRAME_HEADER_BYTES + length);
+        return true;
+    }
+
+public:
+    explicit FrameDecoder(size_t maxMessage = DEFAULT_MAX_FRAME_BYTES)
+        : start(0), scanned(0), maxMessageBytes(maxMessage), mode(FRAMING_LINE), overflowed(false)
+    {
+    }
+
+    void setFraming(framing newMode)
+    {
+        mode = newMode;
+        scanned = start;
+    }
+
+    void feed(const char* data, size_t length)
+    {
+        if (start > 0 && start * 2 >= buffer.size())
+        {
+            buffer.erase(0, start);
+            scanned -= start;
+            start = 0;
+        }
+        buffer.append(data, length);
+    }
+
+    bool next(string& message)
+    {
+        return mode == FRAMING_LINE ? nextLine(message) : nextFrame(message);
+    }
+
+    // True once a message grew, or announced a length, past the limit.
+    bool overflow() const
+    {
+        return overflowed;
+    }
+
+    size_t pendingBytes() const
+    {
+        return buffer.size() - start;
+    }
+};
+
+inline void appendBigEndian(string& out, uint64_t value, int bytes)
+{
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+    {
+        out.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+}
+
+// Fills the length placeholder at the start of a binary frame.
+inline void writeFrameLength(string& frame)
+{
+    string header;
+    appendBigEndian(header, frame.size() - FRAME_HEADER_BYTES, FRAME_HEADER_BYTES);
+    frame.replace(0, FRAME_HEADER_BYTES, header);
+}
+
+// Serializes one message with the framing its format uses.
+inline string encodeMessage(const json& message, wireFormat format)
+{
+    if (format == WIRE_TEXT)
+    {
+        return message.dump() + "\n";
+    }
+
+    string frame(FRAME_HEADER_BYTES, '\0');
+    if (format == WIRE_CBOR)
+    {
+        json::to_cbor(message, frame);
+    }
+    else
+    {
+        json::to_msgpack(message, frame);
+    }
+
+    writeFrameLength(frame);
+    return frame;
+}
+
+inline json decodeMessage(const string& payload, wireFormat format)
+{
+    switch (format)
+    {
+        case WIRE_CBOR:
+            return json::from_cbor(payload.begin(), payload.end());
+        case WIRE_MSGPACK:
+            return json::from_msgpack(payload.begin(), payload.end());
+        default:
+            return json::parse(payload);
+    }
+}
+
+inline void appendEncoded(string& out, const json& value, wireFormat format)
+{
+    if (format == WIRE_CBOR)
+    {
+        json::to_cbor(value, out);
+    }
+    else if (format == WIRE_MSGPACK)
+    {
+        json::to_msgpack(value, out);
+    }
+    else
+    {
+        out += value.dump();
+    }
+}
+
+// Encodes a response whose "data" array is written document by document straight into the output,
+// so a batch is never first collected into a json array. Produces the same bytes a client would get
+// from encodeMessage on the equivalent object, apart from key order.
+inline string encodeResponse(const json& fields, const vector<const json*>& documents, wireFormat format)
+{
+    if (documents.empty())
+    {
+        return encodeMessage(fields, format);
+    }
+
+    string out;
+    size_t entries = fields.size() + (fields.contains("data") ? 0 : 1);
+
+    if (format == WIRE_TEXT)
+    {
+        out += '{';
+    }
+    else
+    {
+        out.append(FRAME_HEADER_BYTES, '\0');
+        if (format == WIRE_CBOR)
+        {
+            out.push_back(static_cast<char>(0xB9));
+            appendBigEndian(out, entries, 2);
+        }
+        else
+        {
+            out.push_back(static_cast<char>(0xDE));
+            appendBigEndian(out, entries, 2);
+        }
+    }
+
+    for (auto it = fields.begin(); it != fields.end(); ++it)
+    {
+        if (it.key() == "data")
+        {
+            continue;
+        }
+        appendEncoded(out, json(it.key()), format);
+        if (format == WIRE_TEXT)
+        {
+            out += ':';
+        }
+        appendEncoded(out, it.value(), format);
+        if (format == WIRE_TEXT)
+        {
+            out += ',';
+        }
+    }
+
+    appendEncoded(out, json("data"), format);
+    if (format == WIRE_TEXT)
+    {
+        out += ":[";
+    }
+    else if (format == WIRE_CBOR)
+    {
+        out.push_back(static_cast<char>(0x9A));
+        appendBigEndian(out, documents.size(), 4);
+    }
+    else
+    {
+        out.push_back(static_cast<char>(0xDD));
+        appendBigEndian(out, documents.size(), 4);
+    }
+
+    for (size_t i = 0; i < documents.size(); i++)
+    {
+        if (format == WIRE_TEXT && i > 0)
+        {
+            out += ',';
+        }
+        appendEncoded(out, *documents[i], format);
+    }
+
+    if (format == WIRE_TEXT)
+    {
+        out += "]}\n";
+        return out;
+    }
+
+    writeFrameLength(out);
+    return out;
+}
+
+// Parses a JSON command argument; the CLI lets it be wrapped in single quotes.
+inline json parseArgument(const string& argument)
+{
+    if (argument.length() >= 2 && argument[0] == '\'' && argument[argument.length() - 1] == '\'')
+    {
+        return json::parse(argument.substr(1, argument.length() - 2));
+    }
+    return json::parse(argument);
+}
+
+// Splits "{...} {...}" into its top-level JSON values. A value may be wrapped in single quotes, as
+// the CLI allows, or be a bare token such as a number.
+inline vector<string> splitJsonArguments(const string& text)
+{
+    vector<string> values;
+    size_t i = 0;
+    while (i < text.size())
+    {
+        if (isspace(static_cast<unsigned char>(text[i])))
+        {
+            i++;
+            continue;
+        }
+
+        size_t begin = i;
+        if (text[i] == '\'')
+        {
+            size_t close = text.find('\'', i + 1);
+            i = close == string::npos ? text.size() : close + 1;
+        }
+        else if (text[i] == '{' || text[i] == '[')
+        {
+            int depth = 0;
+            bool inString = false;
+            for (; i < text.size(); i++)
+            {
+                char c = text[i];
+                if (inString)
+                {
+                    if (c == '\\')
+                    {
+                        i++;
+                    }
+                    else if (c == '"')
+                    {
+                        inString = false;
+                    }
+                }
+                else if (c == '"')
+                {
+                    inString = true;
+                }
+                else if (c == '{' || c == '[')
+                {
+                    depth++;
+                }
+                else if ((c == '}' || c == ']') && --depth == 0)
+                {
+                    i++;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            while (i < text.size() && !isspace(static_cast<unsigned char>(text[i])))
+            {
+                i++;
+            }
+        }
+        values.push_back(text.substr(begin, min(i, text.size()) - begin));
+    }
+    return values;
+}
+
+// A trailing options object of a text command may carry "timeoutMs", which belongs to the request.
+inline void takeTimeout(json& request, json& options)
+{
+    if (options.is_object() && options.contains("timeoutMs"))
+    {
+        request["timeoutMs"] = options["timeoutMs"];
+        options.erase("timeoutMs");
+    }
+}
+
+// Turns a text command ("FIND users {query} [{options}]", "EXPLAIN users {query} [{options}]",
+// "UPDATE users {query} {update} [{\"upsert\": true}]", "DELETE users {query} [{\"timeoutMs\": 100}]",
+// "GETMORE <cursor> [batchSize]", "STATS") into the request object binary clients send:
+// {"op": "FIND", "collection": "users", "query": {...}}. Throws on a malformed argument.
+inline json parseTextCommand(const string& commandStr)
+{
+    stringstream ss(commandStr);
+    string operation, collectionName, rest;
+
+    getline(ss, operation, ' ');
+    getline(ss, collectionName, ' ');
+    getline(ss, rest);
+
+    if (operation == "GETMORE" || operation == "KILLCURSOR")
+    {
+        json request = {{"op", operation}, {"cursor", stoull(collectionName)}};
+        if (operation == "GETMORE" && !rest.empty())
+        {
+            request["batchSize"] = stoul(rest);
+        }
+        return request;
+    }
+
+    json request = {{"op", operation}, {"collection", collectionName}};
+    if (operation == "INSERT")
+    {
+        request["document"] = parseArgument(rest);
+    }
+    else if (operation == "INSERTMANY")
+    {
+        request["documents"] = parseArgument(rest);
+    }
+    else if (operation == "FIND" || operation == "EXPLAIN")
+    {
+        vector<string> arguments = splitJsonArguments(rest);
+        request["query"] = parseArgument(arguments.empty() ? rest : arguments[0]);
+        if (arguments.size() > 1)
+        {
+            json options = parseArgument(arguments[1]);
+            takeTimeout(request, options);
+            request["options"] = options;
+        }
+    }
+    else if (operation == "UPDATE")
+    {
+        vector<string> arguments = splitJsonArguments(rest);
+        if (arguments.size() < 2)
+        {
+            throw invalid_argument("UPDATE needs a query and an update");
+        }
+        request["query"] = parseArgument(arguments[0]);
+        request["update"] = parseArgument(arguments[1]);
+        if (arguments.size() > 2)
+        {
+            json options = parseArgument(arguments[2]);
+            takeTimeout(request, options);
+            request["upsert"] = options.value("upsert", false);
+        }
+    }
+    else if (operation == "DELETE" || operation == "AGGREGATE")
+    {
+        vector<string> arguments = splitJsonArguments(rest);
+        request[operation == "DELETE" ? "query" : "pipeline"] = parseArgument(arguments.empty() ? rest : arguments[0]);
+        if (arguments.size() > 1)
+        {
+            json options = parseArgument(arguments[1]);
+            takeTimeout(request, options);
+        }
+    }
+    else if (operation == "CREATE_INDEX")
+    {
+        stringstream args(rest);
+        string field, typeName;
+        args >> field >> typeName;
+        request["field"] = field;
+        request["type"] = typeName.empty() ? "hash" : typeName;
+    }
+    return request;
+}
+
+inline bool sendAll(int socket, const string& data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+#endif
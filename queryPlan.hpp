@@ -0,0 +1,190 @@
+#ifndef QUERY_PLAN_HPP
+#define QUERY_PLAN_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <algorithm>
+
+#include "findOptions.hpp"
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+// Plans kept per collection; a full cache is emptied and refilled by the queries that follow.
+#define PLAN_CACHE_CAPACITY 256
+// A cached plan is replanned once the collection has grown or shrunk past twice its size at planning
+// time, with this much slack so that small collections are not replanned all the time.
+#define PLAN_CACHE_REPLAN_SLACK 1000
+
+enum accessPath
+{
+    ACCESS_COLLECTION_SCAN,
+    ACCESS_ID_LOOKUP,
+    ACCESS_INDEX_EQUALITY,
+    ACCESS_INDEX_RANGE,
+    ACCESS_COLUMN_FILTER
+};
+
+inline const char* accessPathName(accessPath path)
+{
+    switch (path)
+    {
+        case ACCESS_ID_LOOKUP: return "ID_LOOKUP";
+        case ACCESS_INDEX_EQUALITY: return "INDEX_EQUALITY";
+        case ACCESS_INDEX_RANGE: return "INDEX_RANGE";
+        case ACCESS_COLUMN_FILTER: return "COLUMN_FILTER";
+        default: return "COLLECTION_SCAN";
+    }
+}
+
+// How a query reads a collection: the access path that yields candidate documents, the field whose
+// index serves it, and whether a single-key sort is read in order from the ordered index on the sort
+// field instead. The plan depends only on the shape of the query, so it can be reused for other
+// values; estimate is the number of documents the path was expected to examine when it was chosen.
+struct QueryPlan
+{
+    accessPath access = ACCESS_COLLECTION_SCAN;
+    string field;
+    bool indexOrder = false;
+    size_t estimate = 0;
+    size_t plannedSize = 0;
+    bool cached = false;
+};
+
+// What an explained query did. The access path may differ from the plan's when the plan cannot serve
+// the values of this query, such as a column filter on a non-numeric bound.
+struct ExecutionStats
+{
+    accessPath access = ACCESS_COLLECTION_SCAN;
+    size_t examined = 0;
+    vector<pair<string, double>> stages;
+};
+
+// Appends the shape of a condition: operators are kept, values become "?".
+inline void appendConditionShape(const json& condition, string& out)
+{
+    if (condition.is_object() && !condition.empty() && condition.begin().key()[0] == '$')
+    {
+        out += '{';
+        for (auto it = condition.begin(); it != condition.end(); ++it)
+        {
+            out += it.key();
+            out += ',';
+        }
+        out += '}';
+    }
+    else if (condition.is_object())
+    {
+        out += "{?}";
+    }
+    else
+    {
+        out += '?';
+    }
+}
+
+inline void appendQueryShape(const json& query, string& out)
+{
+    if (!query.is_object())
+    {
+        out += '?';
+        return;
+    }
+
+    out += '{';
+    for (auto it = query.begin(); it != query.end(); ++it)
+    {
+        out += it.key();
+        out += ':';
+        if (it.key() == "$or" && it.value().is_array())
+        {
+            out += '[';
+            for (const auto& alternative : it.value())
+            {
+                appendQueryShape(alternative, out);
+                out += ',';
+            }
+            out += ']';
+        }
+        else
+        {
+            appendConditionShape(it.value(), out);
+        }
+        out += ',';
+    }
+    out += '}';
+}
+
+// Key of the plan cache: the query with its literal values stripped, and the sort.
+// {"age": {"$gt": 30}} and {"age": {"$gt": 40}} sorted by name share one plan.
+inline string queryShape(const json& query, const FindOptions& findOptions)
+{
+    string shape;
+    appendQueryShape(query, shape);
+    for (const SortKey& key : findOptions.sort)
+    {
+        shape += key.direction > 0 ? " +" : " -";
+        shape += key.field;
+    }
+    return shape;
+}
+
+// Plans by query shape for one collection. Readers share the lock; the collection empties the cache
+// whenever its indexes or columns change.
+class PlanCache
+{
+private:
+    mutable shared_mutex cacheMutex;
+    unordered_map<string, QueryPlan> plans;
+
+public:
+    bool lookup(const string& shape, size_t collectionSize, QueryPlan& plan) const
+    {
+        shared_lock<shared_mutex> lock(cacheMutex);
+        auto it = plans.find(shape);
+        if (it == plans.end())
+        {
+            return false;
+        }
+
+        size_t smaller = min(collectionSize, it->second.plannedSize);
+        size_t larger = max(collectionSize, it->second.plannedSize);
+        if (larger > 2 * smaller + PLAN_CACHE_REPLAN_SLACK)
+        {
+            return false;
+        }
+        plan = it->second;
+        plan.cached = true;
+        return true;
+    }
+
+    void store(const string& shape, const QueryPlan& plan)
+    {
+        unique_lock<shared_mutex> lock(cacheMutex);
+        if (plans.size() >= PLAN_CACHE_CAPACITY && plans.find(shape) == plans.end())
+        {
+            plans.clear();
+        }
+        plans[shape] = plan;
+    }
+
+    void clear()
+    {
+        unique_lock<shared_mutex> lock(cacheMutex);
+        plans.clear();
+    }
+
+    size_t size() const
+    {
+        shared_lock<shared_mutex> lock(cacheMutex);
+        return plans.size();
+    }
+};
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef SEGMENT_HPP
+#define SEGMENT_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "msgpackView.hpp"
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+#define SEGMENT_MAGIC "DBSEG001"
+#define SEGMENT_HEADER_BYTES 24
+
+// Collection snapshot file, little-endian:
+// [8-byte magic][u64 record count][u64 offset of the record table]
+// records: [u32 id length][id][u32 document length][msgpack document]
+// record table: u64 offset of every record, in record order.
+class SegmentBuilder
+{
+private:
+    string out;
+    vector<uint64_t> offsets;
+
+    static void putU32(string& target, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            target.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+    static void putU64(string& target, uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            target.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+public:
+    SegmentBuilder()
+    {
+        out.append(SEGMENT_MAGIC, 8);
+        out.append(SEGMENT_HEADER_BYTES - 8, '\0');
+    }
+
+    void add(const string& id, const uint8_t* document, size_t length)
+    {
+        offsets.push_back(out.size());
+        putU32(out, static_cast<uint32_t>(id.size()));
+        out += id;
+        putU32(out, static_cast<uint32_t>(length));
+        out.append(reinterpret_cast<const char*>(document), length);
+    }
+
+    void add(const string& id, const json& document)
+    {
+        vector<uint8_t> packed = json::to_msgpack(document);
+        add(id, packed.data(), packed.size());
+    }
+
+    const string& finish()
+    {
+        uint64_t tableOffset = out.size();
+        for (uint64_t offset : offsets)
+        {
+            putU64(out, offset);
+        }
+
+        string header;
+        putU64(header, offsets.size());
+        putU64(header, tableOffset);
+        out.replace(8, header.size(), header);
+        return out;
+    }
+};
+
+// Read-only mapping of a segment file. Records are read straight from the mapped pages; a document
+// is only decoded when it is materialized or its fields are extracted.
+class SegmentReader
+{
+private:
+    int fd;
+    const uint8_t* base;
+    size_t length;
+    size_t count;
+    const uint8_t* table;
+
+    static uint64_t getU64(const uint8_t* data)
+    {
+        uint64_t value = 0;
+        for (int i = 7; i >= 0; i--)
+        {
+            value = value << 8 | data[i];
+        }
+        return value;
+    }
+
+    static uint32_t getU32(const uint8_t* data)
+    {
+        return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+               (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    const uint8_t* record(size_t index) const
+    {
+        return base + getU64(table + 8 * index);
+    }
+
+    // Checks the header, the table and every record against the file size so later reads need no checks.
+    void validate(const string& path) const
+    {
+        if (length < SEGMENT_HEADER_BYTES || memcmp(base, SEGMENT_MAGIC, 8) != 0)
+        {
+            throw runtime_error("Not a segment file: " + path);
+        }
+
+        uint64_t tableOffset = getU64(base + 16);
+        if (tableOffset < SEGMENT_HEADER_BYTES || tableOffset > length || (length - tableOffset) / 8 < count)
+        {
+            throw runtime_error("Corrupted segment table: " + path);
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t offset = getU64(table + 8 * i);
+            if (offset < SEGMENT_HEADER_BYTES || offset > tableOffset || tableOffset - offset < 8)
+            {
+                throw runtime_error("Corrupted segment record in " + path);
+            }
+            uint64_t idLength = getU32(base + offset);
+            if (tableOffset - offset - 8 < idLength)
+            {
+                throw runtime_error("Corrupted segment record in " + path);
+            }
+            uint64_t documentLength = getU32(base + offset + 4 + idLength);
+            if (tableOffset - offset - 8 - idLength < documentLength)
+            {
+                throw runtime_error("Corrupted segment record in " + path);
+            }
+        }
+    }
+
+public:
+    explicit SegmentReader(const string& path) : fd(-1), base(nullptr), length(0), count(0), table(nullptr)
+    {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw runtime_error("Cannot open segment " + path + ": " + strerror(errno));
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < SEGMENT_HEADER_BYTES)
+        {
+            ::close(fd);
+            throw runtime_error("Not a segment file: " + path);
+        }
+        length = static_cast<size_t>(info.st_size);
+
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            ::close(fd);
+            throw runtime_error("Cannot map segment " + path + ": " + strerror(errno));
+        }
+        base = static_cast<const uint8_t*>(mapped);
+
+        try
+        {
+            count = getU64(base + 8);
+            table = base + min<uint64_t>(getU64(base + 16), length);
+            validate(path);
+        }
+        catch (...)
+        {
+            munmap(const_cast<uint8_t*>(base), length);
+            ::close(fd);
+            throw;
+        }
+    }
+
+    ~SegmentReader()
+    {
+        munmap(const_cast<uint8_t*>(base), length);
+        ::close(fd);
+    }
+
+    SegmentReader(const SegmentReader&) = delete;
+    SegmentReader& operator=(const SegmentReader&) = delete;
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    size_t bytes() const
+    {
+        return length;
+    }
+
+    string id(size_t index) const
+    {
+        const uint8_t* data = record(index);
+        return string(reinterpret_cast<const char*>(data + 4), getU32(data));
+    }
+
+    const uint8_t* document(size_t index, size_t& documentLength) const
+    {
+        const uint8_t* data = record(index);
+        uint32_t idLength = getU32(data);
+        documentLength = getU32(data + 4 + idLength);
+        return data + 8 + idLength;
+    }
+
+    json materialize(size_t index) const
+    {
+        size_t documentLength = 0;
+        const uint8_t* data = document(index, documentLength);
+        return json::from_msgpack(data, data + documentLength);
+    }
+
+    bool extractFields(size_t index, const vector<string>& names, json& fields) const
+    {
+        size_t documentLength = 0;
+        const uint8_t* data = document(index, documentLength);
+        return msgpackExtractFields(data, documentLength, names, fields);
+    }
+};
+
+#endif
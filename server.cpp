@@ -1,18 +1,38 @@
 #define DEFAULT_PORT 8080
-#define DB_OPERATION_TIMEOUT_SEC 5
+#define DEFAULT_BACKLOG 1024
+#define DEFAULT_MAX_CONNECTIONS 10000
+#define DEFAULT_QUEUE_CAPACITY 1024
+#define DB_OPERATION_TIMEOUT_MS 5000
+#define MAX_OPERATION_TIMEOUT_MS (30LL * 24 * 60 * 60 * 1000)
+#define DEFAULT_BATCH_SIZE 1000
+#define DEFAULT_MAX_BUFFERED_BYTES (16 * 1024 * 1024)
+#define CURSOR_SWEEP_INTERVAL_MS 1000
+#define DEFAULT_METRICS_PORT 9464
+#define METRICS_REQUEST_BYTES 8192
 
 #include <iostream>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <thread>
 #include <mutex>
 #include <map>
+#include <deque>
+#include <memory>
 #include <sstream>
 #include <cstring>
 #include <signal.h>
 #include <chrono>
 #include "../database.hpp"
+#include "../threadPool.hpp"
+#include "../protocol.hpp"
+#include "../cursor.hpp"
+#include "../metrics.hpp"
+#include "../logger.hpp"
+#include "../deadline.hpp"
 #include "../../../Containers/hashtable.hpp"
 
 using namespace std;
@@ -20,6 +40,26 @@ using namespace std;
 myVector<pair<string, Database*>> databases;
 int serverSocket = 0;
 mutex dbMutex;
+CursorManager cursors;
+
+struct ServerConfig
+{
+    int port = DEFAULT_PORT;
+    int backlog = DEFAULT_BACKLOG;
+    size_t maxConnections = DEFAULT_MAX_CONNECTIONS;
+    size_t workerThreads = max(thread::hardware_concurrency(), 1u);
+    size_t queueCapacity = DEFAULT_QUEUE_CAPACITY;
+    size_t maxRequestBytes = DEFAULT_MAX_FRAME_BYTES;
+    size_t maxBufferedBytes = DEFAULT_MAX_BUFFERED_BYTES;
+    size_t batchSize = DEFAULT_BATCH_SIZE;
+    int cursorTimeoutSec = DEFAULT_CURSOR_TIMEOUT_SEC;
+    int metricsPort = DEFAULT_METRICS_PORT;
+    int64_t operationTimeoutMs = DB_OPERATION_TIMEOUT_MS;
+    logLevel logThreshold = LOG_INFO;
+    uint32_t logSampleEvery = 1;
+    size_t logPayloadBytes = DEFAULT_LOG_PAYLOAD_BYTES;
+    string logFile;
+};
 
 json createResponse(const string& status, const string& message, const json& data = json::array(), int count = 0) 
 {
@@ -48,32 +88,94 @@ Database* getOrCreateDatabase(const string& dbName)
     return newDb;
 }
 
-json proccessRequest(Database* db, const string& commandStr, const string& databaseName) 
+// Puts the first batch of results into batch and leaves the rest behind a cursor.
+json batchResponse(const string& message, const myVector<DocumentPtr>& results, uint64_t connectionId, size_t batchSize, vector<DocumentPtr>& batch)
 {
-    stringstream ss(commandStr);
-    string operation, collectionName, rest;
+    size_t first = min(batchSize, results.size());
+    vector<DocumentPtr> rest;
+    for (size_t i = 0; i < results.size(); i++) 
+    {
+        if (i < first)
+        {
+            batch.push_back(results[i]);
+        }
+        else
+        {
+            rest.push_back(results[i]);
+        }
+    }
+    uint64_t cursorId = rest.empty() ? 0 : cursors.open(connectionId, move(rest));
     
-    getline(ss, operation, ' ');
-    getline(ss, collectionName, ' ');
-    getline(ss, rest);
+    json response = createResponse("success", message, json::array(), batch.size());
+    response["total"] = results.size();
+    response["cursor"] = cursorId;
+    return response;
+}
+
+// A FIND answers with its first batch and leaves the ids of the rest behind a cursor, which reads
+// them back batch by batch and drops those that no longer match.
+json findResponse(Database* db, const string& collectionName, const CompiledQuery& query, const FindOptions& findOptions, uint64_t connectionId,
+                  size_t batchSize, const Deadline& deadline, vector<DocumentPtr>& batch)
+{
+    vector<string> restIds;
+    myVector<DocumentPtr> results = db->findDocuments(collectionName, query, findOptions, max<size_t>(batchSize, 1), restIds, deadline);
+    for (size_t i = 0; i < results.size(); i++) 
+    {
+        batch.push_back(results[i]);
+    }
+
+    size_t total = batch.size() + restIds.size();
+    uint64_t cursorId = 0;
+    if (!restIds.empty())
+    {
+        cursorId = cursors.open(connectionId, move(restIds), [db, collectionName, query, findOptions](const vector<string>& ids, vector<DocumentPtr>& out)
+        {
+            db->fetchDocuments(collectionName, ids, query, findOptions, out);
+        });
+    }
+
+    json response = createResponse("success", "Found " + to_string(total) + " documents", json::array(), batch.size());
+    response["total"] = total;
+    response["cursor"] = cursorId;
+    return response;
+}
+
+// What the reactor knows about a request when it hands it to a worker.
+struct RequestContext
+{
+    uint64_t connectionId = 0;
+    size_t batchSize = DEFAULT_BATCH_SIZE;
+    chrono::steady_clock::time_point receivedAt;
+    int64_t timeoutMs = DB_OPERATION_TIMEOUT_MS;
+};
+
+// Status "timeout" tells the client that nothing waited for the operation to finish; see TIMED_OUT
+// for what a timed out write has changed.
+json timeoutResponse(const string& operation, const RequestContext& context)
+{
+    MetricsRegistry::global().requestsTimedOut.add();
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - context.receivedAt);
+    return createResponse("timeout", operation + " timed out after " + to_string(elapsed.count()) + " ms");
+}
+
+json runRequest(Database* db, json& request, const RequestContext& context, const Deadline& deadline, vector<DocumentPtr>& batch) 
+{
+    string operation = request.value("op", "");
+    string collectionName = request.value("collection", "");
+    size_t batchSize = max<size_t>(request.value("batchSize", context.batchSize), 1);
+    uint64_t connectionId = context.connectionId;
     
-    auto startTime = chrono::steady_clock::now();
     try 
     {
         if (operation == "INSERT") 
         {
-            lock_guard<mutex> lock(dbMutex);
-
-            if (db->insert(collectionName, rest) == SUCCESS) 
+            operationState state = db->insert(collectionName, make_shared<const Document>(move(request.at("document"))), deadline);
+            if (state == TIMED_OUT)
+            {
+                return timeoutResponse("Insert", context);
+            }
+            if (state == SUCCESS) 
             {
-                auto endTime = chrono::steady_clock::now();
-                auto duration = chrono::duration_cast<chrono::seconds>(endTime - startTime);
-                
-                if (duration.count() > DB_OPERATION_TIMEOUT_SEC) 
-                {
-                    return createResponse("error", "Insert operation timed out after " + to_string(duration.count()) + " seconds");
-                }
-                
                 return createResponse("success", "Document inserted successfully");
             } 
             else 
@@ -81,42 +183,111 @@ json proccessRequest(Database* db, const string& commandStr, const string& datab
                 return createResponse("error", "Failed to insert document");
             }
         }
+        else if (operation == "INSERTMANY") 
+        {
+            InsertManyResult result = db->insertDocuments(collectionName, move(request.at("documents")), deadline);
+            if (result.timedOut)
+            {
+                json response = timeoutResponse("Insert", context);
+                response["count"] = result.inserted;
+                return response;
+            }
+
+            json errors = json::array();
+            for (size_t i = 0; i < result.errors.size(); i++)
+            {
+                errors.push_back({{"index", result.errors[i].first}, {"error", result.errors[i].second}});
+            }
+
+            string status = errors.empty() ? "success" : (result.inserted > 0 ? "partial" : "error");
+            json response = createResponse(status, "Inserted " + to_string(result.inserted) + " documents, " + to_string(errors.size()) + " failed", json::array(), result.inserted);
+            response["errors"] = errors;
+            if (!result.durabilityError.empty())
+            {
+                // The documents are stored; a client must not retry them.
+                response["status"] = "error";
+                response["message"] = "Inserted " + to_string(result.inserted) + " documents, but they may not be durable: " + result.durabilityError;
+                response["durabilityError"] = result.durabilityError;
+            }
+            return response;
+        }
         else if (operation == "FIND") 
         {
-            myVector<Document> results = db->find(collectionName, rest);
-            
-            auto endTime = chrono::steady_clock::now();
-            auto duration = chrono::duration_cast<chrono::seconds>(endTime - startTime);
-            
-            if (duration.count() > DB_OPERATION_TIMEOUT_SEC) 
+            FindOptions findOptions = parseFindOptions(request.contains("options") ? request["options"] : json());
+            return findResponse(db, collectionName, CompiledQuery(request.at("query")), findOptions, connectionId, batchSize, deadline, batch);
+        }
+        else if (operation == "EXPLAIN") 
+        {
+            FindOptions findOptions = parseFindOptions(request.contains("options") ? request["options"] : json());
+            json response = createResponse("success", "Query plan");
+            response["explain"] = db->explain(collectionName, CompiledQuery(request.at("query")), findOptions, deadline);
+            return response;
+        }
+        else if (operation == "AGGREGATE") 
+        {
+            myVector<json> rows = db->aggregate(collectionName, AggregationPipeline(request.at("pipeline")), deadline);
+
+            myVector<DocumentPtr> results;
+            for (size_t i = 0; i < rows.size(); i++)
+            {
+                results.push_back(make_shared<const Document>(move(rows[i]), ""));
+            }
+            return batchResponse("Aggregated " + to_string(results.size()) + " rows", results, connectionId, batchSize, batch);
+        }
+        else if (operation == "GETMORE") 
+        {
+            uint64_t cursorId = request.at("cursor").get<uint64_t>();
+            bool exhausted = false;
+            if (!cursors.next(cursorId, connectionId, batchSize, batch, exhausted))
             {
-                return createResponse("error", "Find operation timed out after " + to_string(duration.count()) + " seconds");
+                return createResponse("error", "Cursor " + to_string(cursorId) + " not found");
             }
-            json resultArray = json::array();
 
-            for (size_t i = 0; i < results.size(); i++) 
+            json response = createResponse("success", "Returned " + to_string(batch.size()) + " documents", json::array(), batch.size());
+            response["cursor"] = exhausted ? 0 : cursorId;
+            return response;
+        }
+        else if (operation == "KILLCURSOR") 
+        {
+            uint64_t cursorId = request.at("cursor").get<uint64_t>();
+            if (!cursors.kill(cursorId, connectionId))
             {
-                resultArray.push_back(results[i].getData());
+                return createResponse("error", "Cursor " + to_string(cursorId) + " not found");
             }
-            
-            return createResponse("success", 
-                "Found " + to_string(results.size()) + " documents", 
-                resultArray, results.size());
+            return createResponse("success", "Cursor " + to_string(cursorId) + " closed");
         }
-        else if (operation == "DELETE") 
+        else if (operation == "UPDATE") 
         {
-            lock_guard<mutex> lock(dbMutex);
+            UpdateResult result;
+            operationState state = db->update(collectionName, CompiledQuery(request.at("query")), CompiledUpdate(request.at("update")),
+                                              request.value("upsert", false), result, deadline);
+            if (state == TIMED_OUT)
+            {
+                return timeoutResponse("Update", context);
+            }
+            if (state != SUCCESS) 
+            {
+                return createResponse("error", "Failed to update documents");
+            }
 
-            if (db->remove(collectionName, rest) == SUCCESS) 
+            json response = createResponse("success", "Updated " + to_string(result.modified) + " of " + to_string(result.matched) + " matched documents", json::array(), result.modified);
+            response["matched"] = result.matched;
+            if (!result.upsertedId.empty())
+            {
+                response["upsertedId"] = result.upsertedId;
+                response["message"] = "Inserted document " + result.upsertedId + " by upsert";
+            }
+            return response;
+        }
+        else if (operation == "DELETE") 
+        {
+            operationState state = db->remove(collectionName, CompiledQuery(request.at("query")), deadline);
+            if (state == TIMED_OUT)
+            {
+                return timeoutResponse("Delete", context);
+            }
+            if (state == SUCCESS) 
             {
-                auto endTime = chrono::steady_clock::now();
-                auto duration = chrono::duration_cast<chrono::seconds>(endTime - startTime);
-                
-                if (duration.count() > DB_OPERATION_TIMEOUT_SEC) 
-                {
-                    return createResponse("error", "Delete operation timed out after " + to_string(duration.count()) + " seconds");
-                }
-                
                 return createResponse("success", "Documents deleted successfully");
             } 
             else 
@@ -124,140 +295,938 @@ json proccessRequest(Database* db, const string& commandStr, const string& datab
                 return createResponse("error", "Failed to delete documents");
             }
         }
+        else if (operation == "STATS") 
+        {
+            json response = createResponse("success", "Server statistics");
+            response["stats"] = MetricsRegistry::global().snapshot();
+            return response;
+        }
+        else if (operation == "CREATE_INDEX") 
+        {
+            string field = request.value("field", "");
+            indexType type = INDEX_HASH;
+            if (!parseIndexType(request.value("type", "hash"), type))
+            {
+                return createResponse("error", "Unknown index type '" + request.value("type", "") + "'");
+            }
+
+            if (db->createIndex(collectionName, field, type) == SUCCESS) 
+            {
+                return createResponse("success", "Index on field '" + field + "' created");
+            } 
+            else 
+            {
+                return createResponse("error", "Failed to create index on field '" + field + "'");
+            }
+        }
         else 
         {
             return createResponse("error", "Unknown operation: " + operation);
         }
     } 
+    catch (const DeadlineExceeded&)
+    {
+        return timeoutResponse(operation, context);
+    }
     catch (const exception& e) 
     {
         return createResponse("error", "Operation failed: " + string(e.what()));
     }
 }
 
-void handleUser(int userSocket) 
+// Runs one request object, either sent by a binary client or parsed from a text command. FIND and
+// GETMORE put the documents of the batch into batch instead of the response's data array; the caller
+// serializes them straight into the output. Documents to insert are moved out of the request. The
+// time taken is recorded per operation and collection.
+// The deadline counts from when the request arrived. The server's timeout is a ceiling: "timeoutMs" in
+// the request can only shorten it, and a value of 0 or less leaves the server's. A server timeout of 0
+// disables the ceiling. Either is capped at MAX_OPERATION_TIMEOUT_MS so the deadline cannot overflow.
+// A request whose deadline passed while it waited for a worker is shed unrun.
+json executeRequest(Database* db, json& request, const RequestContext& context, vector<DocumentPtr>& batch) 
 {
-    Database* currentDb = nullptr;
-    string currentDatabaseName;
-    
+    static const char* const operations[] = {"INSERT", "INSERTMANY", "FIND", "EXPLAIN", "AGGREGATE", "GETMORE",
+                                             "KILLCURSOR", "UPDATE", "DELETE", "STATS", "CREATE_INDEX"};
+
+    int64_t timeoutMs = min<int64_t>(context.timeoutMs, MAX_OPERATION_TIMEOUT_MS);
+    auto requested = request.find("timeoutMs");
+    if (requested != request.end() && requested->is_number())
+    {
+        // Read as a double so that huge or fractional values compare without overflowing.
+        double clientMs = requested->get<double>();
+        if (clientMs >= 1 && (timeoutMs <= 0 || clientMs < timeoutMs))
+        {
+            timeoutMs = static_cast<int64_t>(min<double>(clientMs, MAX_OPERATION_TIMEOUT_MS));
+        }
+    }
+    Deadline deadline = timeoutMs > 0 ? Deadline(context.receivedAt + chrono::milliseconds(timeoutMs)) : Deadline();
+
+    auto startTime = chrono::steady_clock::now();
+    json response;
+    if (deadline.expired())
+    {
+        MetricsRegistry::global().requestsShed.add();
+        response = timeoutResponse(request.value("op", ""), context);
+        response["message"] = "Request expired after waiting " + to_string(chrono::duration_cast<chrono::milliseconds>(startTime - context.receivedAt).count()) +
+                              " ms for a worker";
+    }
+    else
+    {
+        response = runRequest(db, request, context, deadline, batch);
+    }
+    uint64_t micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime).count();
+
+    // Unknown operations share one series, and collections past METRICS_MAX_SERIES share "_other", so
+    // clients cannot create series, or the per-thread lookup cache, at will.
+    string operation = request.value("op", "");
+    string collectionName = request.value("collection", "");
+    if (find(begin(operations), end(operations), operation) == end(operations))
+    {
+        operation = "UNKNOWN";
+        collectionName.clear();
+    }
+    string status = response.value("status", "");
+    MetricsRegistry::global().recordOperation(operation, collectionName, micros, status == "error" || status == "timeout");
+    return response;
+}
+
+json proccessRequest(Database* db, const string& commandStr, const RequestContext& context, vector<DocumentPtr>& batch) 
+{
+    json request;
     try 
     {
-        char buffer[4096];
-        memset(buffer, 0, sizeof(buffer));
+        request = parseTextCommand(commandStr);
+    } 
+    catch (const exception& e) 
+    {
+        return createResponse("error", "Invalid request: " + string(e.what()));
+    }
+    return executeRequest(db, request, context, batch);
+}
+
+string encodeResponse(const json& response, const vector<DocumentPtr>& batch, wireFormat format)
+{
+    vector<const json*> documents;
+    documents.reserve(batch.size());
+    for (const DocumentPtr& doc : batch)
+    {
+        documents.push_back(&doc->getData());
+    }
+    return encodeResponse(response, documents, format);
+}
 
-        int receivedBytes = recv(userSocket, buffer, sizeof(buffer) - 1, 0);
-        
-        if (receivedBytes <= 0) 
+// One sampled line per request with the request cut to the payload limit: text commands as sent,
+// binary requests by size only.
+void logRequest(uint64_t connectionId, const string& message, wireFormat format, const json& response)
+{
+    LogLine line(LOG_INFO, "request", true);
+    if (!line.isActive())
+    {
+        return;
+    }
+
+    line.field("connection", connectionId);
+    if (format == WIRE_TEXT)
+    {
+        line.field("command", message);
+    }
+    else
+    {
+        line.field("format", wireFormatName(format)).field("bytes", message.size());
+    }
+    line.field("status", response.value("status", "")).field("message", response.value("message", ""));
+}
+
+enum connectionStage
+{
+    AWAITING_DATABASE,
+    READY
+};
+
+struct Connection
+{
+    int socket = -1;
+    uint64_t id = 0;
+    string address;
+    connectionStage stage = AWAITING_DATABASE;
+    Database* db = nullptr;
+    string databaseName;
+    wireFormat format = WIRE_TEXT;
+    FrameDecoder decoder;
+    string pendingMessage;
+    bool hasPendingMessage = false;
+    chrono::steady_clock::time_point pendingSince;
+    string outBuffer;
+    // Bytes of outBuffer already sent; the buffer is emptied once all of it is sent.
+    size_t outOffset = 0;
+    // Events currently registered with epoll, and whether the last read stopped before EAGAIN.
+    uint32_t events = 0;
+    bool readStalled = false;
+    bool busy = false;
+    bool paused = false;
+    bool peerClosed = false;
+    bool closeAfterFlush = false;
+};
+
+struct Completion
+{
+    uint64_t connectionId;
+    string response;
+    bool closeAfter;
+};
+
+// Single-threaded edge-triggered epoll loop that owns every socket. Parsed requests run on a bounded
+// worker pool; workers hand responses back through a queue and an eventfd. When the pool queue is
+// full, or a client's unsent responses or queued requests pass maxBufferedBytes, the connection
+// stops being read, so backpressure reaches the client through TCP.
+class Reactor
+{
+private:
+    ServerConfig config;
+    int epollFd;
+    int wakeFd;
+    ThreadPool workers;
+    map<uint64_t, shared_ptr<Connection>> connections;
+    map<int, uint64_t> socketToConnection;
+    deque<uint64_t> pausedConnections;
+    uint64_t nextConnectionId;
+
+    mutex completionMutex;
+    deque<Completion> completions;
+
+    static void setNonBlocking(int socket)
+    {
+        int flags = fcntl(socket, F_GETFL, 0);
+        fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    void watch(int socket, uint32_t events, int operation)
+    {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = events | EPOLLET;
+        event.data.fd = socket;
+        epoll_ctl(epollFd, operation, socket, &event);
+    }
+
+    void acceptConnections()
+    {
+        while (true)
         {
-            json errorResponse = createResponse("error", "Connection error");
-            string responseStr = errorResponse.dump() + "\n";
-            send(userSocket, responseStr.c_str(), responseStr.length(), 0);
-            close(userSocket);
-            return;
+            sockaddr_in clientAddress;
+            socklen_t clientLen = sizeof(clientAddress);
+            int clientSocket = accept(serverSocket, (struct sockaddr*)&clientAddress, &clientLen);
+
+            if (clientSocket < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    LogLine(LOG_ERROR, "accept failed").field("error", strerror(errno));
+                }
+                return;
+            }
+
+            string clientAddr = string(inet_ntoa(clientAddress.sin_addr)) + ":" + to_string(ntohs(clientAddress.sin_port));
+
+            if (connections.size() >= config.maxConnections)
+            {
+                string responseStr = createResponse("error", "Server connection limit reached").dump() + "\n";
+                send(clientSocket, responseStr.c_str(), responseStr.length(), MSG_NOSIGNAL);
+                close(clientSocket);
+                LogLine(LOG_WARN, "client rejected").field("address", clientAddr).field("reason", "connection limit reached");
+                continue;
+            }
+
+            setNonBlocking(clientSocket);
+
+            shared_ptr<Connection> connection = make_shared<Connection>();
+            connection->socket = clientSocket;
+            connection->id = nextConnectionId++;
+            connection->address = clientAddr;
+            connection->decoder = FrameDecoder(config.maxRequestBytes);
+            connections[connection->id] = connection;
+            socketToConnection[clientSocket] = connection->id;
+            MetricsRegistry::global().connectionsAccepted.add();
+            MetricsRegistry::global().activeConnections++;
+            connection->events = EPOLLIN | EPOLLRDHUP;
+            watch(clientSocket, connection->events, EPOLL_CTL_ADD);
+
+            LogLine(LOG_INFO, "client connected").field("connection", connection->id).field("address", clientAddr);
         }
-        
-        currentDatabaseName = string(buffer, receivedBytes);
-        
-        if (currentDatabaseName.empty()) 
+    }
+
+    void closeConnection(const shared_ptr<Connection>& connection)
+    {
+        if (connection->stage == READY)
         {
-            json errorResponse = createResponse("error", "Database name cannot be empty");
-            string responseStr = errorResponse.dump() + "\n";
+            LogLine(LOG_INFO, "connection closed").field("connection", connection->id).field("database", connection->databaseName);
+        }
 
-            if (send(userSocket, responseStr.c_str(), responseStr.length(), 0) < 0) 
+        cursors.killOwner(connection->id);
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->socket, nullptr);
+        close(connection->socket);
+        socketToConnection.erase(connection->socket);
+        connections.erase(connection->id);
+        MetricsRegistry::global().activeConnections--;
+    }
+
+    // A client that keeps sending without reading its responses, or pipelines requests faster than
+    // they run, is not read from until the backlog drains.
+    bool backlogged(const shared_ptr<Connection>& connection) const
+    {
+        return connection->outBuffer.size() - connection->outOffset >= config.maxBufferedBytes
+            || (connection->busy && connection->decoder.pendingBytes() >= config.maxBufferedBytes);
+    }
+
+    // Reads at most maxBufferedBytes per wakeup so the requests already buffered are dispatched
+    // before more are taken; a single message larger than that is still read across wakeups.
+    bool readAvailable(const shared_ptr<Connection>& connection)
+    {
+        char buffer[16 * 1024];
+        size_t readBytes = 0;
+        while (true)
+        {
+            if (backlogged(connection) || readBytes >= config.maxBufferedBytes)
             {
-                cerr << "Failed to send error response" << endl;
+                connection->readStalled = true;
+                return true;
             }
-            close(userSocket);
-            return;
+
+            ssize_t receivedBytes = recv(connection->socket, buffer, sizeof(buffer), 0);
+            if (receivedBytes > 0)
+            {
+                MetricsRegistry::global().bytesReceived.add(static_cast<size_t>(receivedBytes));
+                connection->decoder.feed(buffer, static_cast<size_t>(receivedBytes));
+                readBytes += static_cast<size_t>(receivedBytes);
+                continue;
+            }
+            if (receivedBytes == 0)
+            {
+                connection->peerClosed = true;
+                return true;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+
+            LogLine(LOG_WARN, "receive failed").field("connection", connection->id).field("error", strerror(errno));
+            return false;
+        }
+    }
+
+    // Sends as much buffered output as the socket takes and asks for EPOLLOUT if some is left.
+    bool flushOutput(const shared_ptr<Connection>& connection)
+    {
+        string& out = connection->outBuffer;
+        while (connection->outOffset < out.size())
+        {
+            ssize_t sentBytes = send(connection->socket, out.data() + connection->outOffset, out.size() - connection->outOffset, MSG_NOSIGNAL);
+            if (sentBytes > 0)
+            {
+                MetricsRegistry::global().bytesSent.add(static_cast<size_t>(sentBytes));
+                connection->outOffset += static_cast<size_t>(sentBytes);
+                if (connection->outOffset == out.size())
+                {
+                    out.clear();
+                    connection->outOffset = 0;
+                }
+                else if (connection->outOffset > out.size() / 2)
+                {
+                    // Moving the unsent tail only once it is the smaller half keeps a large response
+                    // linear in its size however many partial sends it takes.
+                    out.erase(0, connection->outOffset);
+                    connection->outOffset = 0;
+                }
+                continue;
+            }
+            if (sentBytes < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (sentBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+
+            LogLine(LOG_WARN, "send failed").field("connection", connection->id).field("error", strerror(errno));
+            return false;
+        }
+
+        updateInterest(connection);
+        return true;
+    }
+
+    // Drops EPOLLIN while the connection is backlogged. Re-registering a stalled socket makes epoll
+    // report the bytes still waiting in it, so reading picks up where it stopped.
+    void updateInterest(const shared_ptr<Connection>& connection)
+    {
+        uint32_t events = EPOLLRDHUP;
+        if (connection->outOffset < connection->outBuffer.size())
+        {
+            events |= EPOLLOUT;
+        }
+        bool reading = !backlogged(connection);
+        if (reading)
+        {
+            events |= EPOLLIN;
+        }
+
+        if (events != connection->events || (reading && connection->readStalled))
+        {
+            connection->events = events;
+            if (reading)
+            {
+                connection->readStalled = false;
+            }
+            watch(connection->socket, events, EPOLL_CTL_MOD);
+        }
+    }
+
+    // The handshake is one '\n'-terminated line; after it requests are lines or length-prefixed frames,
+    // depending on the negotiated format. Clients may pipeline any number of requests; they are
+    // answered one at a time in order.
+    bool takeMessage(const shared_ptr<Connection>& connection, string& message)
+    {
+        if (connection->hasPendingMessage)
+        {
+            message.swap(connection->pendingMessage);
+            connection->hasPendingMessage = false;
+            return true;
+        }
+
+        if (connection->decoder.next(message))
+        {
+            return true;
         }
 
-        currentDb = getOrCreateDatabase(currentDatabaseName);
+        if (connection->decoder.overflow())
+        {
+            connection->outBuffer += encodeMessage(createResponse("error", "Request exceeds " + to_string(config.maxRequestBytes) + " bytes"), connection->format);
+            connection->closeAfterFlush = true;
+        }
+        return false;
+    }
 
-        string welcomeMsg = "Connected to database: " + currentDatabaseName + "\n";
-        if (send(userSocket, welcomeMsg.c_str(), welcomeMsg.length(), 0) < 0) 
+    // "<database> [text|cbor|msgpack]". The reply is always a text line; binary framing starts after it.
+    void handshake(const shared_ptr<Connection>& connection, const string& message)
+    {
+        stringstream ss(message);
+        string databaseName, formatName;
+        ss >> databaseName >> formatName;
+
+        if (databaseName.empty())
+        {
+            connection->outBuffer += createResponse("error", "Database name cannot be empty").dump() + "\n";
+            connection->closeAfterFlush = true;
+            return;
+        }
+        if (!parseWireFormat(formatName, connection->format))
         {
-            cerr << "Failed to send welcome message" << endl;
-            close(userSocket);
+            connection->outBuffer += createResponse("error", "Unknown protocol format: " + formatName).dump() + "\n";
+            connection->closeAfterFlush = true;
             return;
         }
-        
-        cout << "Client connected to database: " << currentDatabaseName << endl;
 
-        while (true) 
+        connection->databaseName = databaseName;
+        connection->db = getOrCreateDatabase(databaseName);
+        connection->stage = READY;
+        if (connection->format == WIRE_TEXT)
+        {
+            connection->outBuffer += "Connected to database: " + databaseName + "\n";
+        }
+        else
         {
-            memset(buffer, 0, sizeof(buffer));
-            receivedBytes = recv(userSocket, buffer, sizeof(buffer) - 1, 0);
-            
-            if (receivedBytes <= 0) 
+            connection->decoder.setFraming(FRAMING_LENGTH);
+            connection->outBuffer += "Connected to database: " + databaseName + " (" + wireFormatName(connection->format) + ")\n";
+        }
+
+        LogLine(LOG_INFO, "database selected").field("connection", connection->id).field("database", databaseName)
+            .field("protocol", wireFormatName(connection->format));
+    }
+
+    // Starts the next buffered request unless one is already running for this connection or its
+    // unsent responses are backlogged.
+    void dispatch(const shared_ptr<Connection>& connection)
+    {
+        while (!connection->busy && !connection->closeAfterFlush && !backlogged(connection))
+        {
+            // A request sent back by a full queue keeps its arrival time, so its deadline keeps running.
+            auto receivedAt = connection->hasPendingMessage ? connection->pendingSince : chrono::steady_clock::now();
+            string message;
+            if (!takeMessage(connection, message))
+            {
+                return;
+            }
+
+            if (connection->stage == AWAITING_DATABASE)
+            {
+                handshake(connection, message);
+                continue;
+            }
+
+            if (connection->format == WIRE_TEXT && message == "EXIT")
+            {
+                connection->outBuffer += "Disconnected from database\n";
+                connection->closeAfterFlush = true;
+                return;
+            }
+
+            connection->busy = true;
+            uint64_t connectionId = connection->id;
+            Database* db = connection->db;
+            wireFormat format = connection->format;
+            RequestContext context;
+            context.connectionId = connectionId;
+            context.batchSize = config.batchSize;
+            context.receivedAt = receivedAt;
+            context.timeoutMs = config.operationTimeoutMs;
+
+            bool queued = workers.trySubmit([this, connectionId, db, message, format, context]()
             {
-                if (receivedBytes == 0) 
+                json response;
+                vector<DocumentPtr> batch;
+                bool closeAfter = false;
+                try 
                 {
-                    cout << "Client disconnected from database: " << currentDatabaseName << endl;
-                } else {
-                    cerr << "Receive error: " << strerror(errno) << endl;
+                    if (format == WIRE_TEXT)
+                    {
+                        response = proccessRequest(db, message, context, batch);
+                    }
+                    else
+                    {
+                        json request = decodeMessage(message, format);
+                        if (request.value("op", "") == "EXIT")
+                        {
+                            response = createResponse("success", "Disconnected from database");
+                            closeAfter = true;
+                        }
+                        else
+                        {
+                            response = executeRequest(db, request, context, batch);
+                        }
+                    }
+                } 
+                catch (const exception& e) 
+                {
+                    response = createResponse("error", "Request processing failed: " + string(e.what()));
+                    batch.clear();
                 }
+
+                logRequest(connectionId, message, format, response);
+                complete(Completion{connectionId, encodeResponse(response, batch, format), closeAfter});
+            });
+
+            if (!queued)
+            {
+                connection->busy = false;
+                connection->pendingMessage.swap(message);
+                connection->hasPendingMessage = true;
+                connection->pendingSince = receivedAt;
+                if (!connection->paused)
+                {
+                    connection->paused = true;
+                    pausedConnections.push_back(connection->id);
+                }
+                return;
+            }
+        }
+    }
+
+    void complete(Completion completion)
+    {
+        {
+            lock_guard<mutex> lock(completionMutex);
+            completions.push_back(move(completion));
+        }
+        uint64_t one = 1;
+        ssize_t written = write(wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+
+    // Reads, dispatches and writes for one connection; closes it when it is finished or broken.
+    void service(const shared_ptr<Connection>& connection, bool readable)
+    {
+        if (readable && !connection->paused && !readAvailable(connection))
+        {
+            closeConnection(connection);
+            return;
+        }
+
+        while (true)
+        {
+            if (!connection->paused)
+            {
+                dispatch(connection);
+            }
+
+            bool heldBack = backlogged(connection);
+            if (!flushOutput(connection))
+            {
+                closeConnection(connection);
+                return;
+            }
+            // Sending made room for the requests the backlog held back.
+            if (!heldBack || backlogged(connection) || connection->paused)
+            {
                 break;
             }
-            
-            string commandStr = string(buffer, receivedBytes);
+        }
+
+        bool drained = connection->outBuffer.empty();
+        if (drained && (connection->closeAfterFlush || (connection->peerClosed && !connection->busy && !connection->paused)))
+        {
+            if (connection->peerClosed && connection->stage == READY)
+            {
+                LogLine(LOG_INFO, "client disconnected").field("connection", connection->id).field("database", connection->databaseName);
+            }
+            closeConnection(connection);
+        }
+    }
+
+    void drainCompletions()
+    {
+        uint64_t counter;
+        ssize_t readBytes = read(wakeFd, &counter, sizeof(counter));
+        (void)readBytes;
 
-            cout << "Received command: " << commandStr << endl;
-            
-            if (commandStr == "EXIT") 
+        deque<Completion> ready;
+        {
+            lock_guard<mutex> lock(completionMutex);
+            ready.swap(completions);
+        }
+
+        for (Completion& completion : ready)
+        {
+            auto it = connections.find(completion.connectionId);
+            if (it == connections.end())
             {
-                string goodbyeMsg = "Disconnected from database\n";
-                
-                if (send(userSocket, goodbyeMsg.c_str(), goodbyeMsg.length(), 0) < 0)
+                // The connection closed while its request ran; drop any cursor the request opened.
+                cursors.killOwner(completion.connectionId);
+                continue;
+            }
+
+            shared_ptr<Connection> connection = it->second;
+            connection->busy = false;
+            connection->outBuffer += completion.response;
+            connection->closeAfterFlush = connection->closeAfterFlush || completion.closeAfter;
+            service(connection, false);
+        }
+
+        resumePaused();
+    }
+
+    void resumePaused()
+    {
+        size_t waiting = pausedConnections.size();
+        for (size_t i = 0; i < waiting; i++)
+        {
+            uint64_t connectionId = pausedConnections.front();
+            pausedConnections.pop_front();
+
+            auto it = connections.find(connectionId);
+            if (it == connections.end())
+            {
+                continue;
+            }
+
+            shared_ptr<Connection> connection = it->second;
+            connection->paused = false;
+            service(connection, true);
+        }
+    }
+
+public:
+    Reactor(const ServerConfig& serverConfig)
+        : config(serverConfig), epollFd(-1), wakeFd(-1), workers(serverConfig.workerThreads, serverConfig.queueCapacity),
+          nextConnectionId(1)
+    {
+    }
+
+    ~Reactor()
+    {
+        for (auto& entry : connections)
+        {
+            close(entry.second->socket);
+        }
+        if (wakeFd >= 0)
+        {
+            close(wakeFd);
+        }
+        if (epollFd >= 0)
+        {
+            close(epollFd);
+        }
+    }
+
+    int run()
+    {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0)
+        {
+            LogLine(LOG_ERROR, "cannot create epoll instance").field("error", strerror(errno));
+            return -1;
+        }
+
+        setNonBlocking(serverSocket);
+        watch(serverSocket, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+
+        const int maxEvents = 256;
+        epoll_event events[maxEvents];
+        auto lastSweep = chrono::steady_clock::now();
+
+        while (true)
+        {
+            int ready = epoll_wait(epollFd, events, maxEvents, CURSOR_SWEEP_INTERVAL_MS);
+            if (ready < 0)
+            {
+                if (errno == EINTR)
                 {
-                    cerr << "Failed to send goodbye message" << endl;
+                    continue;
                 }
-                break;
+                LogLine(LOG_ERROR, "epoll_wait failed").field("error", strerror(errno));
+                return -1;
             }
 
-            json response;
-            try 
+            auto now = chrono::steady_clock::now();
+            if (now - lastSweep >= chrono::milliseconds(CURSOR_SWEEP_INTERVAL_MS))
             {
-                response = proccessRequest(currentDb, commandStr, currentDatabaseName);
-            } 
-            catch (const exception& e) 
+                size_t expired = cursors.expireIdle();
+                if (expired > 0)
+                {
+                    LogLine(LOG_INFO, "idle cursors expired").field("count", expired);
+                }
+                lastSweep = now;
+            }
+
+            for (int i = 0; i < ready; i++)
             {
-                response = createResponse("error", "Request processing failed: " + string(e.what()));
+                int socket = events[i].data.fd;
+
+                if (socket == serverSocket)
+                {
+                    acceptConnections();
+                    continue;
+                }
+                if (socket == wakeFd)
+                {
+                    drainCompletions();
+                    continue;
+                }
+
+                auto it = socketToConnection.find(socket);
+                if (it == socketToConnection.end())
+                {
+                    continue;
+                }
+
+                shared_ptr<Connection> connection = connections[it->second];
+                if (events[i].events & EPOLLERR)
+                {
+                    closeConnection(connection);
+                    continue;
+                }
+                service(connection, (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) != 0);
             }
-            
-            string responseStr = response.dump() + "\n";
-            
-            if (send(userSocket, responseStr.c_str(), responseStr.length(), 0) < 0) 
+        }
+    }
+};
+
+// Answers "GET /metrics" on a loopback port with the Prometheus text format, one connection at a time.
+void serveMetrics(int listener)
+{
+    while (true)
+    {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LogLine(LOG_ERROR, "metrics endpoint stopped").field("error", strerror(errno));
+            return;
+        }
+
+        struct timeval timeout = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == string::npos && request.size() < METRICS_REQUEST_BYTES)
+        {
+            ssize_t receivedBytes = recv(client, buffer, sizeof(buffer), 0);
+            if (receivedBytes <= 0)
             {
-                cerr << "Failed to send response to client" << endl;
                 break;
             }
-            
-            cout << "Sent response: " << response["status"] << " - " << response["message"] << endl;
+            request.append(buffer, static_cast<size_t>(receivedBytes));
         }
+
+        string status = "200 OK";
+        string body;
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+        {
+            body = MetricsRegistry::global().prometheusText();
+        }
+        else
+        {
+            status = "404 Not Found";
+            body = "Only GET /metrics is served here\n";
+        }
+
+        string response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                          to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        sendAll(client, response);
+        close(client);
     }
-    catch(const exception& e) 
+}
+
+// Listens on 127.0.0.1 only: the metrics are not meant to leave the host.
+int openMetricsListener(int port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener < 0)
     {
-        cerr << "Error handling client: " << e.what() << endl;
+        return -1;
+    }
 
-        try 
-        {
-            json errorResponse = createResponse("error", "Server error: " + string(e.what()));
-            string responseStr = errorResponse.dump() + "\n";
-            send(userSocket, responseStr.c_str(), responseStr.length(), 0);
-        } 
-        catch (...) {   }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 16) < 0)
+    {
+        close(listener);
+        return -1;
     }
-    
-    if (currentDb) 
+    return listener;
+}
+
+void printUsage()
+{
+    cout << "Usage: ./server [--port <port>] [--backlog <n>] [--max-connections <n>] [--workers <n>] [--queue-size <n>] [--max-request-bytes <n>] [--max-buffered-bytes <n>] [--batch-size <n>] [--cursor-timeout <sec>] [--timeout-ms <ms>] [--metrics-port <port>] [--log-level <level>] [--log-sample <n>] [--log-payload-bytes <n>] [--log-file <path>]" << endl;
+    cout << "Example: ./server --port 8080 --workers 32 --max-connections 20000" << endl;
+    cout << "--metrics-port serves Prometheus metrics at http://127.0.0.1:<port>/metrics (default " << DEFAULT_METRICS_PORT << ", 0 disables)" << endl;
+    cout << "--max-buffered-bytes stops reading from a client whose unsent responses, or unread requests, reach it (default " << DEFAULT_MAX_BUFFERED_BYTES << ")" << endl;
+    cout << "--timeout-ms is the longest a request may run, counted from its arrival (default " << DB_OPERATION_TIMEOUT_MS << ", 0 disables); a client \"timeoutMs\" can only shorten it" << endl;
+    cout << "--log-level is debug, info, warn, error or off (default info); --log-sample <n> logs one request in n" << endl;
+}
+
+void parseArguments(int argc, char* argv[], ServerConfig& config)
+{
+    for (int i = 1; i < argc; i++)
     {
-        cout << "Connection closed for database: " << currentDatabaseName << endl;
+        string arg = argv[i];
+        if (i + 1 < argc)
+        {
+            if (arg == "--port")
+            {
+                config.port = stoi(argv[++i]);
+            }
+            else if (arg == "--backlog")
+            {
+                config.backlog = stoi(argv[++i]);
+            }
+            else if (arg == "--max-connections")
+            {
+                config.maxConnections = stoul(argv[++i]);
+            }
+            else if (arg == "--workers")
+            {
+                config.workerThreads = stoul(argv[++i]);
+            }
+            else if (arg == "--queue-size")
+            {
+                config.queueCapacity = stoul(argv[++i]);
+            }
+            else if (arg == "--max-request-bytes")
+            {
+                config.maxRequestBytes = stoul(argv[++i]);
+            }
+            else if (arg == "--max-buffered-bytes")
+            {
+                config.maxBufferedBytes = max<size_t>(stoul(argv[++i]), 1);
+            }
+            else if (arg == "--batch-size")
+            {
+                config.batchSize = max<size_t>(stoul(argv[++i]), 1);
+            }
+            else if (arg == "--cursor-timeout")
+            {
+                config.cursorTimeoutSec = stoi(argv[++i]);
+            }
+            else if (arg == "--timeout-ms")
+            {
+                config.operationTimeoutMs = stoll(argv[++i]);
+            }
+            else if (arg == "--metrics-port")
+            {
+                config.metricsPort = stoi(argv[++i]);
+            }
+            else if (arg == "--log-level")
+            {
+                string levelName = argv[++i];
+                if (!parseLogLevel(levelName, config.logThreshold))
+                {
+                    cerr << "Unknown log level '" << levelName << "', using info" << endl;
+                }
+            }
+            else if (arg == "--log-sample")
+            {
+                config.logSampleEvery = static_cast<uint32_t>(max<unsigned long>(stoul(argv[++i]), 1));
+            }
+            else if (arg == "--log-payload-bytes")
+            {
+                config.logPayloadBytes = stoul(argv[++i]);
+            }
+            else if (arg == "--log-file")
+            {
+                config.logFile = argv[++i];
+            }
+        }
     }
-    
-    close(userSocket);
 }
 
-int main() 
+int main(int argc, char* argv[]) 
 {
+    if (argc == 2 && string(argv[1]) == "--help")
+    {
+        printUsage();
+        return 0;
+    }
+
+    ServerConfig config;
+    parseArguments(argc, argv, config);
+    cursors.setIdleTimeout(chrono::seconds(config.cursorTimeoutSec));
+
+    Logger& logger = Logger::global();
+    logger.setLevel(config.logThreshold);
+    logger.setSampleEvery(config.logSampleEvery);
+    logger.setPayloadBytes(config.logPayloadBytes);
+    if (!config.logFile.empty())
+    {
+        try
+        {
+            logger.setFile(config.logFile);
+        }
+        catch (const exception& e)
+        {
+            cerr << e.what() << endl;
+            return -1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
     serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     
     if (serverSocket < 0) 
@@ -266,9 +1235,12 @@ int main()
         return -1;
     }
 
+    int reuse = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     sockaddr_in serverAddress;
     serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(DEFAULT_PORT);
+    serverAddress.sin_port = htons(config.port);
     serverAddress.sin_addr.s_addr = INADDR_ANY;
     
     if (bind(serverSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0)
@@ -280,39 +1252,38 @@ int main()
     
     cout << "Binding socket was successful" << endl;
     
-    if (listen(serverSocket, 10) < 0)
+    if (listen(serverSocket, config.backlog) < 0)
     {
         cerr << "Listen failed!" << endl;
         close(serverSocket);
         return -1;
     }
     
-    cout << "Server listening on port " << DEFAULT_PORT << endl;
-    cout << "Database operation timeout: " << DB_OPERATION_TIMEOUT_SEC << " seconds" << endl;
-    cout << "Waiting for connections..." << endl;
-    
-    while (true) 
-    {
-        sockaddr_in clientAddress;
-        socklen_t clientLen = sizeof(clientAddress);
-        
-        int clientSocket = accept(serverSocket, (struct sockaddr*)&clientAddress, &clientLen);
-        
-        if (clientSocket < 0) 
-        {
-            cerr << "Error accepting client connection" << endl;
-            continue;
-        }
-        
-        string clientAddr = inet_ntoa(clientAddress.sin_addr);
-        int clientPort = ntohs(clientAddress.sin_port);
-        
-        cout << "New client connected from " << clientAddr << ":" << clientPort << endl;
-        
-        thread clientThread(handleUser, clientSocket);
-        clientThread.detach();
+    cout << "Server listening on port " << config.port << endl;
+    cout << "Database operation timeout: " << config.operationTimeoutMs << " ms" << endl;
+    cout << "Workers: " << config.workerThreads << ", queue capacity: " << config.queueCapacity
+         << ", max connections: " << config.maxConnections << endl;
+    cout << "FIND batch size: " << config.batchSize << ", idle cursor timeout: " << config.cursorTimeoutSec << " seconds" << endl;
+    cout << "Log level: " << logLevelName(config.logThreshold) << ", one request in " << config.logSampleEvery << " logged"
+         << (config.logFile.empty() ? "" : ", to " + config.logFile) << endl;
+    if (config.metricsPort > 0)
+    {
+        int metricsListener = openMetricsListener(config.metricsPort);
+        if (metricsListener < 0)
+        {
+            cerr << "Cannot open metrics port " << config.metricsPort << ": " << strerror(errno) << endl;
+        }
+        else
+        {
+            thread(serveMetrics, metricsListener).detach();
+            cout << "Metrics: http://127.0.0.1:" << config.metricsPort << "/metrics" << endl;
+        }
     }
+    cout << "Waiting for connections..." << endl;
     
+    Reactor reactor(config);
+    int result = reactor.run();
+
     close(serverSocket);
-    return 0;
-}
\ No newline at end of file
+    return result;
+}
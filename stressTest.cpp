@@ -0,0 +1,160 @@
+#include <nlohmann/json.hpp>
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+#include "database.hpp"
+
+using namespace std;
+
+// Concurrent readers and writers on a shared Database. Every writer appends documents with an
+// increasing seq and trims old ones, each a single atomic operation, so any consistent read must see
+// a contiguous seq range per writer where every document passes its checksum. Anything else is a
+// torn read.
+
+struct StressStats
+{
+    atomic<size_t> inserts{0};
+    atomic<size_t> deletes{0};
+    atomic<size_t> reads{0};
+    atomic<size_t> tornReads{0};
+};
+
+int64_t checksum(int64_t writer, int64_t seq, size_t payloadLength)
+{
+    return seq * 31 + writer * 7 + static_cast<int64_t>(payloadLength);
+}
+
+void writerLoop(Database& db, const string& collectionName, int writer, atomic<bool>& stop, StressStats& stats)
+{
+    for (int64_t seq = 0; !stop; seq++)
+    {
+        string payload(static_cast<size_t>(seq % 64), 'x');
+        json doc = {
+            {"_id", "w" + to_string(writer) + "_" + to_string(seq)},
+            {"writer", writer},
+            {"seq", seq},
+            {"payload", payload},
+            {"checksum", checksum(writer, seq, payload.size())}
+        };
+        db.insert(collectionName, doc.dump());
+        stats.inserts++;
+
+        if (seq % 50 == 49)
+        {
+            json query = {{"writer", writer}, {"seq", {{"$lt", seq - 100}}}};
+            db.remove(collectionName, query.dump());
+            stats.deletes++;
+        }
+    }
+}
+
+bool validDocument(const Document& doc, int writer)
+{
+    const json& data = doc.getData();
+    if (!data.contains("seq") || !data.contains("payload") || !data.contains("checksum") || data["writer"] != writer)
+    {
+        return false;
+    }
+
+    int64_t seq = data["seq"].get<int64_t>();
+    size_t payloadLength = data["payload"].get<string>().size();
+    return payloadLength == static_cast<size_t>(seq % 64) &&
+           data["checksum"].get<int64_t>() == checksum(writer, seq, payloadLength);
+}
+
+void readerLoop(Database& db, const string& collectionName, int writers, atomic<bool>& stop, StressStats& stats)
+{
+    for (int round = 0; !stop; round++)
+    {
+        int writer = round % writers;
+        json query = {{"writer", writer}};
+        myVector<Document> docs = db.find(collectionName, query.dump());
+
+        vector<int64_t> seqs;
+        bool torn = false;
+        for (size_t i = 0; i < docs.size(); i++)
+        {
+            if (!validDocument(docs[i], writer))
+            {
+                torn = true;
+                break;
+            }
+            seqs.push_back(docs[i].getData()["seq"].get<int64_t>());
+        }
+
+        if (!torn && !seqs.empty())
+        {
+            sort(seqs.begin(), seqs.end());
+            torn = unique(seqs.begin(), seqs.end()) != seqs.end() ||
+                   seqs.back() - seqs.front() + 1 != static_cast<int64_t>(seqs.size());
+        }
+
+        if (torn)
+        {
+            stats.tornReads++;
+        }
+        stats.reads++;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int durationSec = argc > 1 ? stoi(argv[1]) : 10;
+    int writers = argc > 2 ? stoi(argv[2]) : 4;
+    int readers = argc > 3 ? stoi(argv[3]) : 8;
+
+    string dbName = "stress_test";
+    filesystem::remove_all("databases/" + dbName);
+
+    DatabaseOptions options;
+    options.walSync = WAL_SYNC_NONE;
+    options.flushEveryWrites = 5000;
+    options.parallelScanThreshold = 0;
+    options.scanChunkSize = 64;
+
+    StressStats stats;
+    atomic<bool> stop(false);
+    {
+        Database db(dbName, options);
+        db.createIndex("indexed", "writer");
+
+        streambuf* original = cout.rdbuf(nullptr);
+        vector<thread> threads;
+        const string collectionNames[] = {"indexed", "scanned"};
+
+        for (const string& collectionName : collectionNames)
+        {
+            for (int w = 0; w < writers; w++)
+            {
+                threads.emplace_back(writerLoop, ref(db), collectionName, w, ref(stop), ref(stats));
+            }
+            for (int r = 0; r < readers; r++)
+            {
+                threads.emplace_back(readerLoop, ref(db), collectionName, writers, ref(stop), ref(stats));
+            }
+        }
+
+        this_thread::sleep_for(chrono::seconds(durationSec));
+        stop = true;
+        for (thread& t : threads)
+        {
+            t.join();
+        }
+        cout.rdbuf(original);
+    }
+
+    cout << "inserts: " << stats.inserts << endl;
+    cout << "deletes: " << stats.deletes << endl;
+    cout << "reads: " << stats.reads << endl;
+    cout << "torn reads: " << stats.tornReads << endl;
+
+    filesystem::remove_all("databases/" + dbName);
+    return stats.tornReads == 0 ? 0 : 1;
+}
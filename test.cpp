@@ -1,10 +1,15 @@
 #include "database.hpp"
+#include "cursor.hpp"
+#include "protocol.hpp"
 #include <iostream>
 #include <cassert>
 #include <vector>
+#include <set>
+#include <fstream>
+#include <filesystem>
+#include <thread>
 
 using namespace std;
-using json = nlohmann::json;
 
 class DatabaseTester {
 private:
@@ -154,6 +159,697 @@ DatabaseTester() : db("test_db") {}
         cout << "Тест 8 пройден" << endl << endl;
     }
 
+    void testIndexes() 
+    {
+        cout << " ТЕСТ 9: Вторичные индексы" << endl;
+        
+        db.insert("orders", "{\"_id\": \"o1\", \"status\": \"new\", \"user_id\": 1}");
+        db.insert("orders", "{\"_id\": \"o2\", \"status\": \"paid\", \"user_id\": 2}");
+        db.insert("orders", "{\"_id\": \"o3\", \"status\": \"new\", \"user_id\": 2}");
+        
+        db.createIndex("orders", "status");
+        db.createIndex("orders", "user_id");
+        
+        cout << "Заказы со статусом new:" << endl;
+        assert(db.find("orders", "{\"status\": \"new\"}").size() == 2);
+        
+        cout << "Заказы пользователей 1 и 2 со статусом paid:" << endl;
+        assert(db.find("orders", "{\"user_id\": {\"$in\": [1, 2.0]}, \"status\": \"paid\"}").size() == 1);
+        
+        cout << "Индекс обновляется после удаления:" << endl;
+        db.remove("orders", "{\"_id\": \"o1\"}");
+        assert(db.find("orders", "{\"status\": {\"$eq\": \"new\"}}").size() == 1);
+        
+        cout << "Массивы и объекты с числами разных типов:" << endl;
+        db.createIndex("orders", "items");
+        db.insert("orders", "{\"_id\": \"o4\", \"items\": [1, {\"qty\": 2}]}");
+        assert(db.find("orders", "{\"items\": [1.0, {\"qty\": 2.0}]}").size() == 1);
+        assert(db.find("orders", "{\"items\": {\"$in\": [[1, {\"qty\": 2.0}]]}}").size() == 1);
+        
+        cout << "Тест 9 пройден" << endl << endl;
+    }
+
+    void testOrderedIndex() 
+    {
+        cout << " ТЕСТ 10: Упорядоченный индекс" << endl;
+        
+        db.insert("events", "{\"_id\": \"e1\", \"created_at\": 300}");
+        db.insert("events", "{\"_id\": \"e2\", \"created_at\": 100}");
+        db.insert("events", "{\"_id\": \"e3\", \"created_at\": 200.5}");
+        db.insert("events", "{\"_id\": \"e4\", \"created_at\": \"late\"}");
+        
+        db.createIndex("events", "created_at", INDEX_ORDERED);
+        
+        cout << "События в окне (100, 400):" << endl;
+        myVector<Document> window = db.find("events", "{\"created_at\": {\"$gt\": 100, \"$lt\": 400}}");
+        assert(window.size() == 2);
+        assert(window[0].getId() == "e3" && window[1].getId() == "e1");
+        
+        cout << "Сравнение разных типов совпадает с полным сканированием:" << endl;
+        assert(db.find("events", "{\"created_at\": {\"$gt\": 150}}").size() == 3);
+        
+        cout << "Тест 10 пройден" << endl << endl;
+    }
+
+    void testFindOptions() 
+    {
+        cout << " ТЕСТ 11: Проекция, сортировка, skip и limit" << endl;
+        
+        db.insert("scores", "{\"_id\": \"s1\", \"player\": \"ann\", \"points\": 40}");
+        db.insert("scores", "{\"_id\": \"s2\", \"player\": \"bob\", \"points\": 10}");
+        db.insert("scores", "{\"_id\": \"s3\", \"player\": \"cid\", \"points\": 30}");
+        db.insert("scores", "{\"_id\": \"s4\", \"player\": \"dan\", \"points\": 50}");
+        db.insert("scores", "{\"_id\": \"s5\", \"player\": \"eve\"}");
+        
+        cout << "Топ-2 после пропуска лидера:" << endl;
+        myVector<Document> top = db.find("scores", "{}", "{\"sort\": {\"points\": -1}, \"skip\": 1, \"limit\": 2}");
+        assert(top.size() == 2);
+        assert(top[0].getId() == "s1" && top[1].getId() == "s3");
+        
+        cout << "Документ без поля сортируется первым:" << endl;
+        assert(db.find("scores", "{}", "{\"sort\": {\"points\": 1}, \"limit\": 1}")[0].getId() == "s5");
+        
+        cout << "Сортировка по упорядоченному индексу:" << endl;
+        db.createIndex("scores", "points", INDEX_ORDERED);
+        myVector<Document> indexed = db.find("scores", "{\"points\": {\"$gt\": 15}}", "{\"sort\": {\"points\": -1}, \"limit\": 2}");
+        assert(indexed.size() == 2);
+        assert(indexed[0].getId() == "s4" && indexed[1].getId() == "s1");
+        
+        cout << "Проекция:" << endl;
+        myVector<Document> names = db.find("scores", "{\"_id\": \"s2\"}", "{\"projection\": {\"player\": 1, \"_id\": 0}}");
+        assert(names.size() == 1 && names[0].getData() == json({{"player", "bob"}}));
+        
+        cout << "Тест 11 пройден" << endl << endl;
+    }
+
+    void testAggregation() 
+    {
+        cout << " ТЕСТ 12: Агрегация" << endl;
+        
+        db.insert("sales", "{\"_id\": \"t1\", \"city\": \"London\", \"amount\": 10}");
+        db.insert("sales", "{\"_id\": \"t2\", \"city\": \"London\", \"amount\": 30}");
+        db.insert("sales", "{\"_id\": \"t3\", \"city\": \"Paris\", \"amount\": 5.5}");
+        db.insert("sales", "{\"_id\": \"t4\", \"city\": \"Berlin\", \"amount\": 100}");
+        
+        cout << "Сумма, среднее и минимум по городам:" << endl;
+        myVector<json> totals = db.aggregate("sales", "[{\"$match\": {\"amount\": {\"$lt\": 50}}}, "
+            "{\"$group\": {\"_id\": \"$city\", \"total\": {\"$sum\": \"$amount\"}, \"avg\": {\"$avg\": \"$amount\"}, \"low\": {\"$min\": \"$amount\"}}}, "
+            "{\"$sort\": {\"total\": -1}}]");
+        assert(totals.size() == 2);
+        assert(totals[0]["_id"] == "London" && totals[0]["total"] == 40 && totals[0]["avg"] == 20.0 && totals[0]["low"] == 10);
+        assert(totals[1]["_id"] == "Paris" && totals[1]["total"] == 5.5);
+        
+        cout << "Подсчёт и проекция:" << endl;
+        assert(db.aggregate("sales", "[{\"$match\": {\"city\": \"London\"}}, {\"$count\": \"n\"}]")[0]["n"] == 2);
+        myVector<json> top = db.aggregate("sales", "[{\"$sort\": {\"amount\": -1}}, {\"$limit\": 1}, {\"$project\": {\"city\": 1, \"_id\": 0}}]");
+        assert(top.size() == 1 && top[0] == json({{"city", "Berlin"}}));
+        
+        cout << "Тест 12 пройден" << endl << endl;
+    }
+
+    void testInsertMany() 
+    {
+        cout << " ТЕСТ 13: Пакетная вставка" << endl;
+        
+        db.remove("batch", "{}");
+        
+        cout << "NDJSON с ошибочными строками:" << endl;
+        InsertManyResult lines = db.insertMany("batch", "{\"kind\": \"line\", \"n\": 1}\n"
+            "{\"kind\": \"line\", \"n\": 2}\n"
+            "{\"kind\": \"line\", \"n\": \n"
+            "\n"
+            "[1, 2]\n"
+            "{\"_id\": \"b1\", \"kind\": \"line\", \"n\": 3}\n");
+        assert(lines.inserted == 3);
+        assert(lines.errors.size() == 2 && lines.errors[0].first == 2 && lines.errors[1].first == 3);
+        assert(db.find("batch", "{\"kind\": \"line\"}").size() == 3);
+        
+        cout << "JSON-массив:" << endl;
+        InsertManyResult array = db.insertMany("batch", "[{\"_id\": \"b2\", \"kind\": \"array\"}, \"text\", {\"_id\": \"b3\", \"kind\": \"array\"}]");
+        assert(array.inserted == 2 && array.errors.size() == 1 && array.errors[0].first == 1);
+        assert(db.find("batch", "{\"kind\": \"array\"}").size() == 2);
+        
+        cout << "Тест 13 пройден" << endl << endl;
+    }
+
+    void testUpdate() 
+    {
+        cout << " ТЕСТ 14: Обновление документов" << endl;
+        
+        db.remove("counters", "{}");
+        db.createIndex("counters", "group", INDEX_HASH);
+        db.insert("counters", "{\"_id\": \"c1\", \"group\": \"a\", \"hits\": 1, \"tmp\": true}");
+        db.insert("counters", "{\"_id\": \"c2\", \"group\": \"a\", \"hits\": 1.5}");
+        db.insert("counters", "{\"_id\": \"c3\", \"group\": \"b\", \"hits\": 7}");
+        
+        cout << "$inc, $set, $unset и $push:" << endl;
+        assert(db.update("counters", "{\"group\": \"a\"}", "{\"$inc\": {\"hits\": 2}, \"$unset\": {\"tmp\": 1}, \"$push\": {\"log\": \"x\"}}") == SUCCESS);
+        myVector<Document> c1 = db.find("counters", "{\"_id\": \"c1\"}");
+        assert(c1.size() == 1 && c1[0].getData()["hits"] == 3 && !c1[0].getData().contains("tmp"));
+        assert(c1[0].getData()["log"] == json::array({"x"}));
+        assert(db.find("counters", "{\"_id\": \"c2\"}")[0].getData()["hits"] == 3.5);
+        
+        cout << "Индекс после изменения поля:" << endl;
+        assert(db.update("counters", "{\"_id\": \"c3\"}", "{\"$set\": {\"group\": \"a\", \"meta.seen\": true}}") == SUCCESS);
+        assert(db.find("counters", "{\"group\": \"a\"}").size() == 3);
+        assert(db.find("counters", "{\"group\": \"b\"}").size() == 0);
+        assert(db.find("counters", "{\"_id\": \"c3\"}")[0].getData()["meta"]["seen"] == true);
+        
+        cout << "Ошибки и upsert:" << endl;
+        assert(db.update("counters", "{}", "{\"$push\": {\"hits\": 1}}") == FAILED);
+        assert(db.find("counters", "{\"hits\": 3}").size() == 1);
+        assert(db.update("counters", "{\"_id\": \"c1\"}", "{\"$set\": {\"_id\": \"other\"}}") == FAILED);
+        assert(db.update("counters", "{\"_id\": \"c9\", \"group\": \"c\"}", "{\"$inc\": {\"hits\": 1}}", true) == SUCCESS);
+        myVector<Document> upserted = db.find("counters", "{\"group\": \"c\"}");
+        assert(upserted.size() == 1 && upserted[0].getId() == "c9" && upserted[0].getData()["hits"] == 1);
+        
+        cout << "Переполнение $inc:" << endl;
+        db.insert("counters", "{\"_id\": \"big\", \"n\": 9223372036854775807, \"low\": -9223372036854775808}");
+        assert(db.update("counters", "{\"_id\": \"big\"}", "{\"$inc\": {\"n\": 1}}") == SUCCESS);
+        assert(db.find("counters", "{\"_id\": \"big\"}")[0].getData()["n"] == 9223372036854775808ULL);
+        assert(db.update("counters", "{\"_id\": \"big\"}", "{\"$inc\": {\"n\": 9223372036854775808}}") == FAILED);
+        assert(db.update("counters", "{\"_id\": \"big\"}", "{\"$inc\": {\"n\": -10}}") == SUCCESS);
+        assert(db.find("counters", "{\"_id\": \"big\"}")[0].getData()["n"] == 9223372036854775798LL);
+        assert(db.update("counters", "{\"_id\": \"big\"}", "{\"$inc\": {\"low\": -1}}") == FAILED);
+        assert(db.find("counters", "{\"_id\": \"big\"}")[0].getData()["low"] == numeric_limits<int64_t>::min());
+        
+        cout << "Тест 14 пройден" << endl << endl;
+    }
+
+    void testDocumentIds() 
+    {
+        cout << " ТЕСТ 15: Идентификаторы документов" << endl;
+        
+        DocumentId previous = DocumentId::generate();
+        for (int i = 0; i < 100000; i++)
+        {
+            DocumentId next = DocumentId::generate();
+            assert(previous < next && previous.toString() < next.toString());
+            previous = next;
+        }
+        
+        DocumentId parsed;
+        assert(DocumentId::parse(previous.toString(), parsed) && parsed == previous);
+        assert(!DocumentId::parse("doc_1700000000", parsed));
+        
+        cout << "Слот завершившегося потока достается следующему:" << endl;
+        DocumentId first;
+        DocumentId second;
+        thread([&first]() { first = DocumentId::generate(); }).join();
+        thread([&second]() { second = DocumentId::generate(); }).join();
+        assert(first.toBinary().substr(8, 2) == second.toBinary().substr(8, 2) && first < second);
+        
+        cout << "Вставка без _id в одну секунду:" << endl;
+        db.remove("generated", "{}");
+        InsertManyResult batch = db.insertMany("generated", "[{\"v\": 1}, {\"v\": 2}, {\"v\": 3}]");
+        assert(batch.inserted == 3);
+        myVector<Document> docs = db.find("generated", "{}");
+        assert(docs.size() == 3);
+        assert(db.find("generated", "{\"_id\": \"" + docs[0].getId() + "\"}").size() == 1);
+        
+        cout << "Тест 15 пройден" << endl << endl;
+    }
+
+    void testSegmentStorage() 
+    {
+        cout << " ТЕСТ 16: Бинарный сегмент" << endl;
+        
+        db.remove("segment", "{}");
+        db.createIndex("segment", "group", INDEX_HASH);
+        db.insertMany("segment", "[{\"_id\": \"s1\", \"group\": \"a\", \"n\": 1, \"tags\": [\"x\"]}, "
+            "{\"_id\": \"s2\", \"group\": \"b\", \"n\": 2.5}, {\"_id\": \"s3\", \"group\": \"a\", \"n\": -3}]");
+        
+        cout << "Поиск после выгрузки и отображения сегмента:" << endl;
+        db.evict("segment");
+        assert(db.find("segment", "{}").size() == 3);
+        assert(db.find("segment", "{\"n\": {\"$gt\": 0}}").size() == 2);
+        myVector<Document> s1 = db.find("segment", "{\"group\": \"a\", \"n\": 1}");
+        assert(s1.size() == 1 && s1[0].getData()["tags"] == json::array({"x"}));
+        
+        cout << "Изменение записей сегмента:" << endl;
+        db.update("segment", "{\"_id\": \"s2\"}", "{\"$set\": {\"group\": \"a\"}}");
+        db.remove("segment", "{\"_id\": \"s3\"}");
+        assert(db.find("segment", "{\"group\": \"a\"}").size() == 2);
+        db.evict("segment");
+        assert(db.find("segment", "{\"group\": \"a\"}").size() == 2);
+        assert(db.find("segment", "{\"_id\": \"s3\"}").size() == 0);
+        
+        cout << "Тест 16 пройден" << endl << endl;
+    }
+
+    void testColumnStore() 
+    {
+        cout << " ТЕСТ 17: Колоночное хранение" << endl;
+        
+        db.remove("prices", "{}");
+        db.createIndex("prices", "price", INDEX_COLUMN);
+        db.insertMany("prices", "[{\"_id\": \"p1\", \"price\": 40}, {\"_id\": \"p2\", \"price\": 75.5}, "
+            "{\"_id\": \"p3\", \"price\": \"n/a\"}, {\"_id\": \"p4\"}, {\"_id\": \"p5\", \"price\": 120}]");
+        
+        cout << "Диапазоны и равенство по колонке:" << endl;
+        assert(db.find("prices", "{\"price\": {\"$gt\": 50, \"$lt\": 100}}").size() == 1);
+        assert(db.find("prices", "{\"price\": {\"$gt\": 50}}").size() == 3);
+        assert(db.find("prices", "{\"price\": \"n/a\"}").size() == 1);
+        assert(db.find("prices", "{\"price\": {\"$in\": [40, 120]}}").size() == 2);
+        
+        cout << "Синхронизация при изменениях:" << endl;
+        db.remove("prices", "{\"_id\": \"p1\"}");
+        db.update("prices", "{\"_id\": \"p4\"}", "{\"$set\": {\"price\": 60}}");
+        assert(db.find("prices", "{\"price\": {\"$lt\": 80}}").size() == 2);
+        db.evict("prices");
+        assert(db.find("prices", "{\"price\": {\"$lt\": 80}}").size() == 2);
+        assert(db.find("prices", "{\"price\": {\"$lt\": 80}, \"tag\": \"x\"}").size() == 0);
+        assert(db.find("prices", "{\"price\": {\"$gt\": 100}}")[0].getData()["price"] == 120);
+        
+        cout << "Тест 17 пройден" << endl << endl;
+    }
+
+    void testPooledDocuments() 
+    {
+        cout << " ТЕСТ 18: Пул памяти документов" << endl;
+        
+        cout << "Документы создаются в одном потоке и освобождаются в другом:" << endl;
+        vector<json> built;
+        thread producer([&]()
+        {
+            for (int i = 0; i < 5000; i++)
+            {
+                built.push_back({{"n", i}, {"tags", {"a", "b"}}});
+            }
+        });
+        producer.join();
+        thread consumer([&]() { built.clear(); });
+        consumer.join();
+        json reused = {{"n", 1}, {"tags", {"a", "b"}}};
+        assert(reused["tags"].size() == 2);
+        
+        cout << "Документ забирает разобранное дерево без копии:" << endl;
+        json parsed = json::parse("{\"_id\": \"moved\", \"name\": \"Zed\"}");
+        Document moved(std::move(parsed));
+        assert(parsed.is_null() && moved.getId() == "moved" && moved.getData()["name"] == "Zed");
+        
+        cout << "Удаление из середины резидентных документов:" << endl;
+        db.remove("pool", "{}");
+        db.insertMany("pool", "[{\"_id\": \"r1\"}, {\"_id\": \"r2\"}, {\"_id\": \"r3\"}, {\"_id\": \"r4\"}]");
+        db.remove("pool", "{\"_id\": \"r2\"}");
+        db.remove("pool", "{\"_id\": \"r1\"}");
+        assert(db.find("pool", "{\"_id\": \"r3\"}").size() == 1);
+        assert(db.find("pool", "{\"_id\": \"r4\"}").size() == 1);
+        assert(db.find("pool", "{}").size() == 2);
+        
+        cout << "Тест 18 пройден" << endl << endl;
+    }
+
+    void testMetrics() 
+    {
+        cout << " ТЕСТ 19: Метрики" << endl;
+        
+        cout << "Гистограмма задержек:" << endl;
+        LatencyHistogram histogram;
+        for (uint64_t value = 1; value <= 10000; value++)
+        {
+            histogram.record(value);
+        }
+        HistogramSnapshot latency = histogram.snapshot();
+        assert(latency.count == 10000 && latency.max == 10000);
+        assert(latency.percentile(0.5) >= 5000 && latency.percentile(0.5) <= 5000 * 1.07);
+        assert(latency.percentile(0.99) >= 9900 && latency.percentile(0.99) <= 10000);
+        assert(latency.countAtMost(15) == 15 && latency.countAtMost(20000) == 10000);
+        
+        cout << "Счетчики сканирования и реестр операций:" << endl;
+        MetricsRegistry& metrics = MetricsRegistry::global();
+        uint64_t scanned = metrics.documentsScanned.value();
+        uint64_t returned = metrics.documentsReturned.value();
+        db.find("users", "{\"age\": {\"$gt\": 0}}");
+        assert(metrics.documentsScanned.value() > scanned && metrics.documentsReturned.value() > returned);
+        
+        metrics.recordOperation("FIND", "metrics_test", 120, false);
+        metrics.recordOperation("FIND", "metrics_test", 80, true);
+        json stats = metrics.snapshot();
+        bool found = false;
+        for (const auto& entry : stats["operations"])
+        {
+            if (entry["collection"] == "metrics_test")
+            {
+                found = entry["count"] == 2 && entry["errors"] == 1;
+            }
+        }
+        assert(found);
+        assert(metrics.prometheusText().find("db_operation_duration_microseconds_count{operation=\"FIND\",collection=\"metrics_test\"} 2") != string::npos);
+        
+        cout << "Тест 19 пройден" << endl << endl;
+    }
+
+    void testLogger()
+    {
+        cout << " ТЕСТ 20: Асинхронный журнал" << endl;
+        
+        Logger& logger = Logger::global();
+        string path = "logger_test.log";
+        remove(path.c_str());
+        logger.setFile(path);
+        
+        cout << "Уровни, выборка и обрезка полей:" << endl;
+        LogLine(LOG_DEBUG, "hidden").field("value", 1);
+        LogLine(LOG_WARN, "visible").field("count", size_t(42)).field("ok", true).field("text", "say \"hi\"\n");
+        logger.setPayloadBytes(8);
+        LogLine(LOG_INFO, "payload").field("command", string(100, 'x'));
+        logger.setPayloadBytes(DEFAULT_LOG_PAYLOAD_BYTES);
+        logger.setSampleEvery(4);
+        for (int i = 0; i < 8; i++)
+        {
+            LogLine(LOG_INFO, "sampled", true).field("i", i);
+        }
+        logger.setSampleEvery(1);
+        logger.flush();
+        logger.setFile("");
+        
+        ifstream file(path);
+        vector<string> lines;
+        string line;
+        while (getline(file, line))
+        {
+            lines.push_back(line);
+        }
+        assert(lines.size() == 4);
+        assert(lines[0].find("WARN visible count=42 ok=true text=\"say \\\"hi\\\"\\n\"") != string::npos);
+        assert(lines[1].find("INFO payload command=\"xxxxxxxx...\"") != string::npos);
+        assert(lines[2].find("sampled i=") != string::npos && lines[3].find("sampled i=") != string::npos);
+        remove(path.c_str());
+        
+        cout << "Тест 20 пройден" << endl << endl;
+    }
+
+    void testDeadlines()
+    {
+        cout << " ТЕСТ 21: Сроки выполнения операций" << endl;
+        
+        Deadline none;
+        assert(!none.isSet() && !none.expired());
+        Deadline passed(chrono::steady_clock::now() - chrono::milliseconds(1));
+        assert(passed.expired());
+        assert(!Deadline::after(chrono::minutes(1)).expired());
+        
+        for (int i = 0; i < 3000; i++)
+        {
+            db.insert("deadlines", "{\"n\": " + to_string(i) + "}");
+        }
+        
+        cout << "Истекший срок прерывает поиск до сканирования:" << endl;
+        uint64_t scanned = MetricsRegistry::global().documentsScanned.value();
+        bool thrown = false;
+        try
+        {
+            db.findDocuments("deadlines", CompiledQuery(json::parse("{\"n\": {\"$gte\": 0}}")), FindOptions(), passed);
+        }
+        catch (const DeadlineExceeded&)
+        {
+            thrown = true;
+        }
+        assert(thrown && MetricsRegistry::global().documentsScanned.value() == scanned);
+        
+        cout << "Удаление и обновление с истекшим сроком ничего не меняют:" << endl;
+        CompiledQuery all(json::parse("{}"));
+        assert(db.remove("deadlines", all, passed) == TIMED_OUT);
+        UpdateResult updated;
+        assert(db.update("deadlines", all, CompiledUpdate(json::parse("{\"$set\": {\"n\": -1}}")), false, updated, passed) == TIMED_OUT);
+        assert(db.findDocuments("deadlines", CompiledQuery(json::parse("{\"n\": -1}"))).size() == 0);
+        
+        thrown = false;
+        try
+        {
+            db.aggregate("deadlines", AggregationPipeline(json::parse("[{\"$group\": {\"_id\": null, \"c\": {\"$sum\": 1}}}]")), passed);
+        }
+        catch (const DeadlineExceeded&)
+        {
+            thrown = true;
+        }
+        assert(thrown);
+        
+        cout << "С запасом времени операции выполняются:" << endl;
+        Deadline later = Deadline::after(chrono::minutes(1));
+        assert(db.findDocuments("deadlines", all, FindOptions(), later).size() == 3000);
+        assert(db.remove("deadlines", all, later) == SUCCESS);
+        assert(db.findDocuments("deadlines", all).size() == 0);
+        
+        cout << "Тест 21 пройден" << endl << endl;
+    }
+
+    void testQueryPlans()
+    {
+        cout << " ТЕСТ 22: Планы запросов и EXPLAIN" << endl;
+        
+        FindOptions none;
+        assert(queryShape(json::parse("{\"n\": {\"$gt\": 1}}"), none) == queryShape(json::parse("{\"n\": {\"$gt\": 50}}"), none));
+        assert(queryShape(json::parse("{\"n\": 1}"), none) != queryShape(json::parse("{\"n\": {\"$gt\": 1}}"), none));
+        
+        for (int i = 0; i < 2000; i++)
+        {
+            db.insert("plans", "{\"n\": " + to_string(i) + ", \"group\": " + to_string(i % 10) + "}");
+        }
+        
+        cout << "Без индекса коллекция сканируется целиком:" << endl;
+        json plan = db.explain("plans", "{\"group\": 3}");
+        assert(plan["plan"]["access"] == "COLLECTION_SCAN" && !plan["plan"]["cached"].get<bool>());
+        assert(plan["documentsExamined"] == 2000 && plan["documentsReturned"] == 200);
+        
+        cout << "Индекс сбрасывает кэш, план запоминается по форме запроса:" << endl;
+        db.createIndex("plans", "group");
+        plan = db.explain("plans", "{\"group\": 4}");
+        assert(plan["plan"]["access"] == "INDEX_EQUALITY" && !plan["plan"]["cached"].get<bool>());
+        assert(plan["estimatedDocuments"] == 200 && plan["documentsExamined"] == 200);
+        plan = db.explain("plans", "{\"group\": 5}");
+        assert(plan["plan"]["cached"].get<bool>() && plan["documentsReturned"] == 200);
+        
+        cout << "Сортировка читается из упорядоченного индекса:" << endl;
+        db.createIndex("plans", "n", INDEX_ORDERED);
+        plan = db.explain("plans", "{\"n\": {\"$gt\": 10}}", "{\"sort\": {\"n\": 1}, \"limit\": 5}");
+        assert(plan["plan"]["indexOrder"].get<bool>() && plan["access"] == "INDEX_RANGE");
+        assert(plan["documentsExamined"] == 5 && plan["documentsReturned"] == 5);
+        assert(!plan["stages"].empty());
+        
+        cout << "Тест 22 пройден" << endl << endl;
+    }
+
+    void testCursors()
+    {
+        cout << " ТЕСТ 23: Курсоры" << endl;
+        
+        db.remove("cursors", "{}");
+        db.insertMany("cursors", "[{\"_id\": \"k1\", \"v\": 1}, {\"_id\": \"k2\", \"v\": 2}, {\"_id\": \"k3\", \"v\": 3}, {\"_id\": \"k4\", \"v\": 4}]");
+        CompiledQuery query(json::parse("{\"v\": {\"$gt\": 0}}"));
+        FindOptions findOptions;
+        CursorManager manager;
+        uint64_t id = manager.open(1, {"k2", "k3", "k4"}, [this, query, findOptions](const vector<string>& ids, vector<DocumentPtr>& out)
+        {
+            db.fetchDocuments("cursors", ids, query, findOptions, out);
+        });
+        
+        cout << "Документ, переставший подходить под запрос, не возвращается:" << endl;
+        db.update("cursors", "{\"_id\": \"k2\"}", "{\"$set\": {\"v\": -2}}");
+        db.update("cursors", "{\"_id\": \"k3\"}", "{\"$set\": {\"v\": 30}}");
+        vector<DocumentPtr> batch;
+        bool exhausted = false;
+        assert(manager.next(id, 1, 2, batch, exhausted) && !exhausted);
+        assert(batch.size() == 1 && batch[0]->getId() == "k3" && batch[0]->getData()["v"] == 30);
+        
+        cout << "Первая пачка документами, остальное идентификаторами:" << endl;
+        db.evict("cursors");
+        vector<string> restIds;
+        FindOptions skipOne;
+        skipOne.skip = 1;
+        myVector<DocumentPtr> first = db.findDocuments("cursors", CompiledQuery(json::parse("{}")), skipOne, 1, restIds);
+        assert(first.size() == 1 && restIds.size() == 2);
+        assert(first[0]->getId() != restIds[0] && restIds[0] != restIds[1]);
+        FindOptions sorted = parseFindOptions(json::parse("{\"sort\": {\"v\": -1}}"));
+        restIds.clear();
+        first = db.findDocuments("cursors", CompiledQuery(json::parse("{}")), sorted, 2, restIds);
+        assert(first.size() == 2 && first[0]->getId() == "k3" && restIds.size() == 2 && restIds[1] == "k2");
+        
+        cout << "Тест 23 пройден" << endl << endl;
+    }
+
+    void testWalRecovery()
+    {
+        cout << " ТЕСТ 24: Восстановление из журнала" << endl;
+        
+        string directory = "databases/wal_test_db";
+        string walPath = directory + "/journal.wal";
+        filesystem::remove_all(directory);
+        DatabaseOptions manual;
+        manual.flush = FLUSH_MANUAL;
+        {
+            Database crashed("wal_test_db", manual);
+            crashed.insert("journal", "{\"_id\": \"w1\", \"n\": 1}");
+            crashed.insert("journal", "{\"_id\": \"w2\", \"n\": 2}");
+            crashed.insert("journal", "{\"_id\": \"w3\", \"n\": 3}");
+            crashed.remove("journal", "{\"_id\": \"w2\"}");
+            crashed.insert("journal", "{\"_id\": \"w4\", \"n\": 4}");
+            // The closing checkpoint is undone below, as if the process had died before it.
+            filesystem::copy_file(walPath, walPath + ".crash", filesystem::copy_options::overwrite_existing);
+        }
+        
+        auto recover = [&](size_t cutBytes, bool corruptLast)
+        {
+            filesystem::remove(directory + "/journal.seg");
+            filesystem::copy_file(walPath + ".crash", walPath, filesystem::copy_options::overwrite_existing);
+            size_t walBytes = filesystem::file_size(walPath);
+            if (cutBytes > 0)
+            {
+                filesystem::resize_file(walPath, walBytes - cutBytes);
+            }
+            if (corruptLast)
+            {
+                fstream wal(walPath, ios::in | ios::out | ios::binary);
+                wal.seekp(walBytes - 1);
+                wal.put('\x7f');
+            }
+            
+            Database recovered("wal_test_db", manual);
+            myVector<Document> docs = recovered.find("journal", "{}");
+            set<string> ids;
+            for (size_t i = 0; i < docs.size(); i++)
+            {
+                ids.insert(docs[i].getId());
+            }
+            return ids;
+        };
+        
+        cout << "Журнал без контрольной точки:" << endl;
+        assert(recover(0, false) == set<string>({"w1", "w3", "w4"}));
+        
+        cout << "Оборванная последняя запись отбрасывается:" << endl;
+        assert(recover(3, false) == set<string>({"w1", "w3"}));
+        
+        cout << "Повреждённая последняя запись отбрасывается:" << endl;
+        assert(recover(0, true) == set<string>({"w1", "w3"}));
+        
+        filesystem::remove_all(directory);
+        cout << "Тест 24 пройден" << endl << endl;
+    }
+
+    void testCursorManager()
+    {
+        cout << " ТЕСТ 25: Менеджер курсоров" << endl;
+        
+        vector<DocumentPtr> rows;
+        for (int i = 0; i < 5; i++)
+        {
+            rows.push_back(make_shared<const Document>(json{{"_id", "r" + to_string(i)}, {"n", i}}));
+        }
+        CursorManager manager;
+        uint64_t id = manager.open(7, rows);
+        
+        cout << "Выдача пачками и закрытие исчерпанного курсора:" << endl;
+        vector<DocumentPtr> batch;
+        bool exhausted = false;
+        assert(manager.next(id, 7, 2, batch, exhausted) && !exhausted && batch.size() == 2);
+        assert(batch[0]->getId() == "r0" && batch[1]->getId() == "r1");
+        batch.clear();
+        assert(!manager.next(id, 8, 2, batch, exhausted) && batch.empty());
+        assert(manager.next(id, 7, 2, batch, exhausted) && !exhausted && batch[0]->getId() == "r2");
+        batch.clear();
+        assert(manager.next(id, 7, 10, batch, exhausted) && exhausted && batch.size() == 1 && batch[0]->getId() == "r4");
+        assert(manager.size() == 0 && !manager.next(id, 7, 1, batch, exhausted));
+        
+        cout << "Закрытие курсоров соединения и по простою:" << endl;
+        uint64_t first = manager.open(1, rows);
+        manager.open(1, rows);
+        uint64_t other = manager.open(2, rows);
+        assert(!manager.kill(first, 2) && manager.kill(first, 1));
+        manager.open(1, rows);
+        assert(manager.killOwner(1) == 2 && manager.size() == 1);
+        assert(manager.expireIdle() == 0);
+        manager.setIdleTimeout(chrono::seconds(0));
+        this_thread::sleep_for(chrono::milliseconds(5));
+        assert(manager.expireIdle() == 1 && manager.size() == 0 && !manager.kill(other, 2));
+        
+        cout << "Тест 25 пройден" << endl << endl;
+    }
+
+    void testFrameDecoder()
+    {
+        cout << " ТЕСТ 26: Разбор сообщений протокола" << endl;
+        
+        cout << "Строки, пришедшие по частям:" << endl;
+        FrameDecoder decoder(64);
+        string message;
+        decoder.feed("FIND users {}\r\nINS", 18);
+        assert(decoder.next(message) && message == "FIND users {}");
+        assert(!decoder.next(message) && decoder.pendingBytes() == 3);
+        decoder.feed("ERT users {}\n", 13);
+        assert(decoder.next(message) && message == "INSERT users {}" && decoder.pendingBytes() == 0);
+        
+        cout << "Кадры с длиной, разрезанные между чтениями:" << endl;
+        string frames;
+        for (const string payload : {"first", "second"})
+        {
+            string frame(FRAME_HEADER_BYTES, '\0');
+            frame += payload;
+            writeFrameLength(frame);
+            frames += frame;
+        }
+        decoder.setFraming(FRAMING_LENGTH);
+        decoder.feed(frames.data(), 2);
+        assert(!decoder.next(message));
+        decoder.feed(frames.data() + 2, 5);
+        assert(!decoder.next(message));
+        decoder.feed(frames.data() + 7, frames.size() - 7);
+        assert(decoder.next(message) && message == "first");
+        assert(decoder.next(message) && message == "second");
+        assert(!decoder.next(message) && !decoder.overflow());
+        
+        cout << "Сообщения больше предела:" << endl;
+        FrameDecoder longLine(8);
+        longLine.feed("0123456789", 10);
+        assert(!longLine.next(message) && longLine.overflow());
+        FrameDecoder longFrame(8);
+        longFrame.setFraming(FRAMING_LENGTH);
+        string header(FRAME_HEADER_BYTES, '\0');
+        header += string(9, 'x');
+        writeFrameLength(header);
+        longFrame.feed(header.data(), FRAME_HEADER_BYTES);
+        assert(!longFrame.next(message) && longFrame.overflow());
+        
+        cout << "Тест 26 пройден" << endl << endl;
+    }
+
+    void testFailedLoad()
+    {
+        cout << " ТЕСТ 27: Повторная загрузка после ошибки" << endl;
+        
+        string directory = "databases/load_test_db";
+        filesystem::remove_all(directory);
+        {
+            Database saved("load_test_db");
+            saved.createIndex("items", "k");
+            saved.insertMany("items", "[{\"_id\": \"i1\", \"k\": 1}, {\"_id\": \"i2\", \"k\": 2}]");
+        }
+        
+        cout << "Ошибка после чтения сегмента не оставляет частичного состояния:" << endl;
+        string walPath = directory + "/items.wal";
+        filesystem::remove(walPath);
+        filesystem::create_directory(walPath);
+        Collection items("items", directory);
+        bool failed = false;
+        try
+        {
+            items.ensureLoaded();
+        }
+        catch (const exception&)
+        {
+            failed = true;
+        }
+        assert(failed && items.size() == 0);
+        
+        filesystem::remove(walPath);
+        items.ensureLoaded();
+        assert(items.size() == 2);
+        
+        filesystem::remove_all(directory);
+        cout << "Тест 27 пройден" << endl << endl;
+    }
+
     void runAllTests() 
     {
         cout << "ЗАПУСК ВСЕХ ТЕСТОВ БАЗЫ ДАННЫХ" << endl << endl;
@@ -166,6 +862,25 @@ DatabaseTester() : db("test_db") {}
         testMultiQueries();
         testDeleteOperations();
         testEdgeCases();
+        testIndexes();
+        testOrderedIndex();
+        testFindOptions();
+        testAggregation();
+        testInsertMany();
+        testUpdate();
+        testDocumentIds();
+        testSegmentStorage();
+        testColumnStore();
+        testPooledDocuments();
+        testMetrics();
+        testLogger();
+        testDeadlines();
+        testQueryPlans();
+        testCursors();
+        testWalRecovery();
+        testCursorManager();
+        testFrameDecoder();
+        testFailedLoad();
         
         cout << "ВСЕ ТЕСТЫ УСПЕШНО ЗАВЕРШЕНЫ!" << endl;
     }
@@ -194,6 +909,13 @@ void testQueryEvaluator()
     json query5 = {{"$or", {{{"age", 30}}, {{"name", "Alice"}}}}};
     cout << "Or условие: " << evaluator.evaluate(doc1, query5) << endl;
     
+    assert(CompiledQuery(query1).matches(doc1) == evaluator.evaluate(doc1, query1));
+    assert(CompiledQuery(query2).matches(doc1) == evaluator.evaluate(doc1, query2));
+    assert(CompiledQuery(query3).matches(doc2) == evaluator.evaluate(doc2, query3));
+    assert(CompiledQuery(query4).matches(doc1) == evaluator.evaluate(doc1, query4));
+    assert(CompiledQuery(query5).matches(doc1) == evaluator.evaluate(doc1, query5));
+    cout << "Скомпилированные запросы совпадают с QueryEvaluator" << endl;
+    
     cout << "Тесты QueryEvaluator пройдены" << endl << endl;
 }
 
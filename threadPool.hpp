@@ -0,0 +1,184 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <algorithm>
+
+using namespace std;
+
+class ThreadPool
+{
+private:
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    size_t queueCapacity;
+    bool stopping;
+    mutex poolMutex;
+    condition_variable taskReady;
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(poolMutex);
+                taskReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                {
+                    return;
+                }
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threadCount, size_t capacity = 0) : queueCapacity(capacity), stopping(false)
+    {
+        threadCount = max<size_t>(threadCount, 1);
+        for (size_t i = 0; i < threadCount; i++)
+        {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(poolMutex);
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for (thread& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+    // Queues the task unless the pool is bounded and its queue is full.
+    bool trySubmit(function<void()> task)
+    {
+        {
+            lock_guard<mutex> lock(poolMutex);
+            if (stopping || (queueCapacity > 0 && tasks.size() >= queueCapacity))
+            {
+                return false;
+            }
+            tasks.push_back(move(task));
+        }
+        taskReady.notify_one();
+        return true;
+    }
+
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool(max(thread::hardware_concurrency(), 1u));
+        return pool;
+    }
+};
+
+// Runs body(begin, end, chunkIndex) over [0, count) in chunks of chunkSize on up to maxThreads
+// threads of the shared pool. The calling thread takes chunks too, so the loop always makes progress
+// even when every pool worker is busy; helpers that start after the last chunk was claimed just exit.
+template <typename Body>
+void parallelFor(size_t count, size_t chunkSize, size_t maxThreads, Body body)
+{
+    chunkSize = max<size_t>(chunkSize, 1);
+    size_t chunks = (count + chunkSize - 1) / chunkSize;
+    size_t helpers = min(min(maxThreads, chunks), ThreadPool::shared().size() + 1);
+    helpers = helpers > 0 ? helpers - 1 : 0;
+
+    struct State
+    {
+        atomic<size_t> nextChunk{0};
+        size_t chunks = 0;
+        size_t chunkSize = 0;
+        size_t count = 0;
+        Body* body = nullptr;
+        bool closed = false;
+        size_t active = 0;
+        exception_ptr error;
+        mutex stateMutex;
+        condition_variable idle;
+
+        void run()
+        {
+            try
+            {
+                size_t chunk;
+                while ((chunk = nextChunk.fetch_add(1)) < chunks)
+                {
+                    size_t begin = chunk * chunkSize;
+                    (*body)(begin, min(begin + chunkSize, count), chunk);
+                }
+            }
+            catch (...)
+            {
+                lock_guard<mutex> lock(stateMutex);
+                if (!error)
+                {
+                    error = current_exception();
+                }
+                nextChunk = chunks;
+            }
+        }
+    };
+
+    shared_ptr<State> state = make_shared<State>();
+    state->chunks = chunks;
+    state->chunkSize = chunkSize;
+    state->count = count;
+    state->body = &body;
+
+    for (size_t i = 0; i < helpers; i++)
+    {
+        ThreadPool::shared().trySubmit([state]()
+        {
+            {
+                lock_guard<mutex> lock(state->stateMutex);
+                if (state->closed)
+                {
+                    return;
+                }
+                state->active++;
+            }
+
+            state->run();
+
+            lock_guard<mutex> lock(state->stateMutex);
+            state->active--;
+            state->idle.notify_all();
+        });
+    }
+
+    state->run();
+
+    unique_lock<mutex> lock(state->stateMutex);
+    state->closed = true;
+    state->idle.wait(lock, [&]() { return state->active == 0; });
+    if (state->error)
+    {
+        rethrow_exception(state->error);
+    }
+}
+
+#endif
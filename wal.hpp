@@ -0,0 +1,318 @@
+#ifndef WAL_HPP
+#define WAL_HPP
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "deadline.hpp"
+#include "poolAllocator.hpp"
+
+using namespace std;
+
+enum walRecordType : uint8_t
+{
+    WAL_INSERT = 1,
+    WAL_DELETE = 2
+};
+
+enum walSyncMode
+{
+    WAL_SYNC_COMMIT,
+    WAL_SYNC_NONE
+};
+
+// Record layout: [u32 payload length][u32 crc32 of type + payload][u8 type][payload].
+// Insert payload is [u32 id length][id][msgpack document], delete payload is [u32 id length][id].
+class WriteAheadLog
+{
+private:
+    static const size_t HEADER_SIZE = 9;
+
+    string path;
+    int fd;
+    size_t fileBytes;
+    uint64_t writtenLsn;
+    uint64_t syncedLsn;
+    bool syncInProgress;
+    size_t groupCommitDelayMicros;
+    mutex walMutex;
+    condition_variable syncDone;
+
+    static const uint32_t* crcTable()
+    {
+        static uint32_t table[256];
+        static once_flag initialized;
+        call_once(initialized, []()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                table[i] = c;
+            }
+        });
+        return table;
+    }
+
+    static uint32_t crc32(const uint8_t* data, size_t length)
+    {
+        const uint32_t* table = crcTable();
+        uint32_t c = 0xFFFFFFFFu;
+        for (size_t i = 0; i < length; i++)
+        {
+            c = table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+        }
+        return c ^ 0xFFFFFFFFu;
+    }
+
+    static void putU32(string& out, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+    static uint32_t getU32(const uint8_t* data)
+    {
+        return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+               (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    static void encodeRecord(string& out, walRecordType type, const string& id, const vector<uint8_t>* document)
+    {
+        size_t start = out.size();
+        putU32(out, 0);
+        putU32(out, 0);
+        out.push_back(static_cast<char>(type));
+        putU32(out, static_cast<uint32_t>(id.size()));
+        out += id;
+        if (document)
+        {
+            out.append(reinterpret_cast<const char*>(document->data()), document->size());
+        }
+
+        uint32_t payloadLength = static_cast<uint32_t>(out.size() - start - HEADER_SIZE);
+        uint32_t crc = crc32(reinterpret_cast<const uint8_t*>(out.data() + start + 8), payloadLength + 1);
+        for (int i = 0; i < 4; i++)
+        {
+            out[start + i] = static_cast<char>((payloadLength >> (8 * i)) & 0xFF);
+            out[start + 4 + i] = static_cast<char>((crc >> (8 * i)) & 0xFF);
+        }
+    }
+
+public:
+    WriteAheadLog(const string& walPath, size_t commitDelayMicros = 0)
+        : path(walPath), fd(-1), fileBytes(0), writtenLsn(0), syncedLsn(0), syncInProgress(false),
+          groupCommitDelayMicros(commitDelayMicros)
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            throw runtime_error("Cannot open write-ahead log " + path + ": " + strerror(errno));
+        }
+        fileBytes = filesystem::file_size(path);
+    }
+
+    ~WriteAheadLog()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    static void encodeInsert(string& out, const string& id, const json& document)
+    {
+        vector<uint8_t> packed = json::to_msgpack(document);
+        encodeRecord(out, WAL_INSERT, id, &packed);
+    }
+
+    static void encodeDelete(string& out, const string& id)
+    {
+        encodeRecord(out, WAL_DELETE, id, nullptr);
+    }
+
+    size_t size()
+    {
+        lock_guard<mutex> lock(walMutex);
+        return fileBytes;
+    }
+
+    uint64_t append(const string& records)
+    {
+        lock_guard<mutex> lock(walMutex);
+
+        size_t written = 0;
+        while (written < records.size())
+        {
+            ssize_t n = ::write(fd, records.data() + written, records.size() - written);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw runtime_error("Cannot append to write-ahead log " + path + ": " + strerror(errno));
+            }
+            written += static_cast<size_t>(n);
+        }
+
+        fileBytes += records.size();
+        writtenLsn += records.size();
+        return writtenLsn;
+    }
+
+    // Group commit: the first waiter becomes the leader and fsyncs everything written so far,
+    // later waiters whose records were covered by that fsync return without a syscall of their own.
+    // Throws DeadlineExceeded when the deadline passes before lsn is durable; the records stay in the
+    // log and a later sync covers them. A leader's fsync is never interrupted.
+    void sync(uint64_t lsn, const Deadline& deadline = Deadline())
+    {
+        unique_lock<mutex> lock(walMutex);
+
+        while (syncedLsn < lsn)
+        {
+            if (syncInProgress)
+            {
+                if (!deadline.isSet())
+                {
+                    syncDone.wait(lock);
+                }
+                else if (syncDone.wait_until(lock, deadline.getExpiry()) == cv_status::timeout && syncedLsn < lsn)
+                {
+                    throw DeadlineExceeded();
+                }
+                continue;
+            }
+
+            deadline.check();
+
+            syncInProgress = true;
+            if (groupCommitDelayMicros > 0)
+            {
+                lock.unlock();
+                this_thread::sleep_for(chrono::microseconds(groupCommitDelayMicros));
+                lock.lock();
+            }
+
+            uint64_t target = writtenLsn;
+            lock.unlock();
+            int result = ::fdatasync(fd);
+            lock.lock();
+
+            syncInProgress = false;
+            if (result == 0)
+            {
+                syncedLsn = max(syncedLsn, target);
+            }
+            syncDone.notify_all();
+
+            if (result != 0)
+            {
+                throw runtime_error("Cannot sync write-ahead log " + path + ": " + strerror(errno));
+            }
+        }
+    }
+
+    void reset()
+    {
+        lock_guard<mutex> lock(walMutex);
+
+        if (::ftruncate(fd, 0) != 0 || ::fdatasync(fd) != 0)
+        {
+            throw runtime_error("Cannot truncate write-ahead log " + path + ": " + strerror(errno));
+        }
+        fileBytes = 0;
+        syncedLsn = writtenLsn;
+    }
+
+    // Applies every intact record in order and cuts off a torn or corrupted tail left by a crash.
+    template <typename Apply>
+    static size_t replay(const string& walPath, Apply apply)
+    {
+        if (!filesystem::exists(walPath))
+        {
+            return 0;
+        }
+
+        ifstream file(walPath, ios::binary);
+        if (!file.is_open())
+        {
+            throw runtime_error("Cannot open write-ahead log " + walPath);
+        }
+        string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        file.close();
+
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(contents.data());
+        size_t offset = 0;
+        size_t applied = 0;
+
+        while (contents.size() - offset >= HEADER_SIZE)
+        {
+            uint32_t payloadLength = getU32(data + offset);
+            uint32_t crc = getU32(data + offset + 4);
+
+            if (payloadLength < 4 || contents.size() - offset - HEADER_SIZE < payloadLength ||
+                crc32(data + offset + 8, payloadLength + 1) != crc)
+            {
+                break;
+            }
+
+            walRecordType type = static_cast<walRecordType>(data[offset + 8]);
+            const uint8_t* payload = data + offset + HEADER_SIZE;
+            uint32_t idLength = getU32(payload);
+            if (idLength > payloadLength - 4)
+            {
+                break;
+            }
+            string id(reinterpret_cast<const char*>(payload + 4), idLength);
+
+            if (type == WAL_INSERT)
+            {
+                const uint8_t* packed = payload + 4 + idLength;
+                apply(type, id, json::from_msgpack(packed, packed + (payloadLength - 4 - idLength)));
+            }
+            else if (type == WAL_DELETE)
+            {
+                apply(type, id, json());
+            }
+            else
+            {
+                break;
+            }
+
+            offset += HEADER_SIZE + payloadLength;
+            applied++;
+        }
+
+        if (offset < contents.size())
+        {
+            filesystem::resize_file(walPath, offset);
+        }
+
+        return applied;
+    }
+};
+
+#endif